@@ -0,0 +1,152 @@
+#include "adapterbalancer.h"
+#include "comm.h"
+#include "adaptermanager.h"
+
+#include <QDebug>
+
+AdapterBalancer::AdapterBalancer(QObject *parent)
+    : QObject{parent}
+{
+    auto manager = AdapterManager::instance();
+    connect(manager, &AdapterManager::adapterAdded, this, &AdapterBalancer::refreshAdapters);
+    connect(manager, &AdapterManager::adapterRemoved, this, &AdapterBalancer::refreshAdapters);
+    connect(manager, &AdapterManager::adapterPowerChanged, this, &AdapterBalancer::refreshAdapters);
+    refreshAdapters();
+}
+
+void AdapterBalancer::refreshAdapters()
+{
+    QList<AdapterStats> adapters;
+    const auto adapterList = AdapterManager::instance()->adapters();
+    for(const auto& adapter : adapterList)
+    {
+        if(!adapter.isPowered)
+            continue;
+        AdapterStats stats;
+        // keep the counters of known adapters
+        int i = indexOf(adapter.address);
+        if(i != -1)
+            stats = m_adapters[i];
+        stats.address = adapter.address;
+        stats.name = adapter.name;
+        adapters.append(stats);
+    }
+    m_adapters = adapters;
+    qDebug() << "adapters:" << m_adapters.length();
+    emit statsChanged();
+}
+
+QBluetoothAddress AdapterBalancer::attach(Comm *comm, const QBluetoothAddress &remoteAddress)
+{
+    if(comm == nullptr)
+        return QBluetoothAddress();
+    if(!comm->isAdapterBound())
+    {
+        // the system picks the adapter, it's not load on any of them
+        m_unboundSessions.insert(comm);
+        connect(comm, &QObject::destroyed, this, &AdapterBalancer::onSessionDestroyed);
+        qDebug() << "session" << remoteAddress << "->" << "unbound";
+        emit statsChanged();
+        return QBluetoothAddress();
+    }
+    if(m_adapters.isEmpty())
+        refreshAdapters();
+
+    int i = -1;
+    if(m_pinnedAdapters.contains(remoteAddress))
+    {
+        i = indexOf(m_pinnedAdapters[remoteAddress]);
+        if(i == -1)
+            qDebug() << "pinned adapter unavailable:" << m_pinnedAdapters[remoteAddress];
+    }
+    if(i == -1)
+        i = leastLoadedIndex();
+    if(i == -1)
+        return QBluetoothAddress();
+
+    m_adapters[i].linkCount++;
+    m_adapters[i].totalSessions++;
+    m_sessions[comm] = m_adapters[i].address;
+    m_sessionQueueDepth[comm] = 0;
+    // Comm lives in the I/O thread, so both connections are queued
+    connect(comm, &QObject::destroyed, this, &AdapterBalancer::onSessionDestroyed);
+    connect(comm, &Comm::queueDepthChanged, this, [ = ](int depth) {onSessionQueueDepthChanged(comm, depth);});
+    qDebug() << "session" << remoteAddress << "->" << "adapter" << m_adapters[i].address;
+    emit statsChanged();
+    return m_adapters[i].address;
+}
+
+void AdapterBalancer::setPinnedAdapter(const QBluetoothAddress &remoteAddress, const QBluetoothAddress &localAddress)
+{
+    m_pinnedAdapters[remoteAddress] = localAddress;
+}
+
+void AdapterBalancer::removePinnedAdapter(const QBluetoothAddress &remoteAddress)
+{
+    m_pinnedAdapters.remove(remoteAddress);
+}
+
+QList<AdapterBalancer::AdapterStats> AdapterBalancer::stats() const
+{
+    return m_adapters;
+}
+
+int AdapterBalancer::unboundSessionCount() const
+{
+    return m_unboundSessions.size();
+}
+
+int AdapterBalancer::indexOf(const QBluetoothAddress &localAddress) const
+{
+    for(int i = 0; i < m_adapters.length(); i++)
+    {
+        if(m_adapters[i].address == localAddress)
+            return i;
+    }
+    return -1;
+}
+
+int AdapterBalancer::leastLoadedIndex() const
+{
+    int result = -1;
+    for(int i = 0; i < m_adapters.length(); i++)
+    {
+        if(result == -1
+                || m_adapters[i].linkCount < m_adapters[result].linkCount
+                || (m_adapters[i].linkCount == m_adapters[result].linkCount && m_adapters[i].queueDepth < m_adapters[result].queueDepth))
+            result = i;
+    }
+    return result;
+}
+
+void AdapterBalancer::onSessionDestroyed(QObject *comm)
+{
+    // only used as a key, the object is already destroyed
+    Comm* session = static_cast<Comm*>(comm);
+    if(m_unboundSessions.remove(session))
+    {
+        emit statsChanged();
+        return;
+    }
+    if(!m_sessions.contains(session))
+        return;
+    int i = indexOf(m_sessions.take(session));
+    int depth = m_sessionQueueDepth.take(session);
+    if(i != -1)
+    {
+        m_adapters[i].linkCount--;
+        m_adapters[i].queueDepth -= depth;
+    }
+    emit statsChanged();
+}
+
+void AdapterBalancer::onSessionQueueDepthChanged(Comm *comm, int depth)
+{
+    if(!m_sessions.contains(comm))
+        return;
+    int i = indexOf(m_sessions[comm]);
+    if(i != -1)
+        m_adapters[i].queueDepth += depth - m_sessionQueueDepth[comm];
+    m_sessionQueueDepth[comm] = depth;
+    emit statsChanged();
+}
@@ -0,0 +1,55 @@
+#ifndef ADAPTERBALANCER_H
+#define ADAPTERBALANCER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QBluetoothAddress>
+
+class Comm;
+
+// Spreads sessions across all powered local adapters.
+// The adapter with the least links(then the shortest request queue) is chosen,
+// unless the remote device is pinned to a specific adapter.
+class AdapterBalancer : public QObject
+{
+    Q_OBJECT
+public:
+    struct AdapterStats
+    {
+        QBluetoothAddress address;
+        QString name;
+        int linkCount = 0;
+        int queueDepth = 0; // pending requests of all sessions on this adapter
+        quint64 totalSessions = 0;
+    };
+
+    explicit AdapterBalancer(QObject *parent = nullptr);
+
+    // returns the adapter for the new session, it is released when comm is destroyed
+    // sessions which can't be bound(RFCOMM) are counted apart and get a null address
+    QBluetoothAddress attach(Comm* comm, const QBluetoothAddress &remoteAddress);
+    void setPinnedAdapter(const QBluetoothAddress &remoteAddress, const QBluetoothAddress &localAddress);
+    void removePinnedAdapter(const QBluetoothAddress &remoteAddress);
+    QList<AdapterStats> stats() const;
+    int unboundSessionCount() const;
+public slots:
+    void refreshAdapters();
+private:
+    QList<AdapterStats> m_adapters;
+    QHash<QBluetoothAddress, QBluetoothAddress> m_pinnedAdapters;
+    // session -> (adapter, queue depth)
+    QHash<Comm*, QBluetoothAddress> m_sessions;
+    QHash<Comm*, int> m_sessionQueueDepth;
+    QSet<Comm*> m_unboundSessions;
+
+    int indexOf(const QBluetoothAddress &localAddress) const;
+    int leastLoadedIndex() const;
+private slots:
+    void onSessionDestroyed(QObject* comm);
+    void onSessionQueueDepthChanged(Comm* comm, int depth);
+signals:
+    void statsChanged();
+};
+
+#endif // ADAPTERBALANCER_H
@@ -0,0 +1,155 @@
+#include "adaptermanager.h"
+
+#include <QDebug>
+
+AdapterManager* AdapterManager::instance()
+{
+    static AdapterManager* manager = new AdapterManager;
+    return manager;
+}
+
+AdapterManager::AdapterManager(QObject *parent)
+    : QObject{parent}
+{
+    m_pollTimer = new QTimer(this);
+    m_pollTimer->setInterval(hotplugPollIntervalMs);
+    connect(m_pollTimer, &QTimer::timeout, this, &AdapterManager::refresh);
+    refresh();
+}
+
+QBluetoothAddress AdapterManager::firstPoweredAddress() const
+{
+    QReadLocker locker(&m_lock);
+    return m_firstPoweredAddress;
+}
+
+bool AdapterManager::isPowered(const QBluetoothAddress &address) const
+{
+    QReadLocker locker(&m_lock);
+    for(const auto& adapter : m_adapters)
+    {
+        if(adapter.address == address)
+            return adapter.isPowered;
+    }
+    return false;
+}
+
+QList<AdapterManager::AdapterInfo> AdapterManager::adapters() const
+{
+    QReadLocker locker(&m_lock);
+    return m_adapters;
+}
+
+void AdapterManager::refresh()
+{
+    const auto BTAdapterList = QBluetoothLocalDevice::allDevices();
+    QList<QBluetoothAddress> addedList;
+    QList<QBluetoothAddress> removedList = m_devices.keys();
+
+    for(auto it = BTAdapterList.cbegin(); it != BTAdapterList.cend(); ++it)
+    {
+        if(removedList.removeOne(it->address()))
+            continue; // known adapter, the state is updated by the signal
+        auto dev = new QBluetoothLocalDevice(it->address(), this);
+        if(!dev->isValid())
+        {
+            delete dev;
+            continue;
+        }
+        connect(dev, &QBluetoothLocalDevice::hostModeStateChanged, this, &AdapterManager::onHostModeStateChanged);
+        m_devices[it->address()] = dev;
+
+        AdapterInfo info;
+        info.address = it->address();
+        info.name = it->name();
+        info.isPowered = dev->hostMode() != QBluetoothLocalDevice::HostPoweredOff;
+        QWriteLocker locker(&m_lock);
+        m_adapters.append(info);
+        addedList.append(it->address());
+        qDebug() << "adapter added:" << info.name << info.address << info.isPowered;
+    }
+    for(const auto& address : qAsConst(removedList))
+    {
+        m_devices.take(address)->deleteLater();
+        QWriteLocker locker(&m_lock);
+        for(int i = 0; i < m_adapters.length(); i++)
+        {
+            if(m_adapters[i].address == address)
+            {
+                m_adapters.removeAt(i);
+                break;
+            }
+        }
+        qDebug() << "adapter removed:" << address;
+    }
+    updatePollTimer();
+    if(addedList.isEmpty() && removedList.isEmpty())
+        return;
+
+    updateFirstPoweredAddress();
+    for(const auto& address : qAsConst(addedList))
+        emit adapterAdded(address);
+    for(const auto& address : qAsConst(removedList))
+    {
+        emit adapterRemoved(address);
+        emit adapterUnavailable(address);
+    }
+}
+
+void AdapterManager::updateFirstPoweredAddress()
+{
+    QWriteLocker locker(&m_lock);
+    m_firstPoweredAddress.clear();
+    for(const auto& adapter : qAsConst(m_adapters))
+    {
+        if(adapter.isPowered)
+        {
+            m_firstPoweredAddress = adapter.address;
+            break; // find the first valid one
+        }
+    }
+}
+
+void AdapterManager::updatePollTimer()
+{
+    // QBluetoothLocalDevice::allDevices() is slow on some platforms, it's not polled while an adapter is there
+    if(m_devices.isEmpty())
+    {
+        if(!m_pollTimer->isActive())
+            m_pollTimer->start();
+    }
+    else
+        m_pollTimer->stop();
+}
+
+void AdapterManager::onHostModeStateChanged(QBluetoothLocalDevice::HostMode state)
+{
+    auto dev = qobject_cast<QBluetoothLocalDevice*>(sender());
+    if(dev == nullptr)
+        return;
+    const QBluetoothAddress address = dev->address();
+    const bool isPowered = state != QBluetoothLocalDevice::HostPoweredOff;
+    bool isChanged = false;
+    {
+        QWriteLocker locker(&m_lock);
+        for(auto& adapter : m_adapters)
+        {
+            if(adapter.address == address && adapter.isPowered != isPowered)
+            {
+                adapter.isPowered = isPowered;
+                isChanged = true;
+            }
+        }
+    }
+    if(!isChanged)
+        return;
+    qDebug() << "adapter" << address << "powered:" << isPowered;
+    updateFirstPoweredAddress();
+    emit adapterPowerChanged(address, isPowered);
+    if(!isPowered)
+    {
+        emit adapterUnavailable(address);
+        // it might be unplugged
+        refresh();
+    }
+}
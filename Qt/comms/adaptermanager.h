@@ -0,0 +1,58 @@
+#ifndef ADAPTERMANAGER_H
+#define ADAPTERMANAGER_H
+
+#include <QObject>
+#include <QHash>
+#include <QTimer>
+#include <QReadWriteLock>
+#include <QBluetoothAddress>
+#include <QBluetoothLocalDevice>
+
+// Long-lived cache of the local adapters.
+// It must be created in the GUI thread, the getters are thread-safe.
+class AdapterManager : public QObject
+{
+    Q_OBJECT
+public:
+    struct AdapterInfo
+    {
+        QBluetoothAddress address;
+        QString name;
+        bool isPowered = false;
+    };
+
+    static AdapterManager* instance();
+
+    // the first powered adapter, null if no adapter is available
+    QBluetoothAddress firstPoweredAddress() const;
+    bool isPowered(const QBluetoothAddress& address) const;
+    QList<AdapterInfo> adapters() const;
+
+    // there is no hotplug signal in Qt, so the adapter list is polled, but only while there is no adapter
+    // otherwise it is enumerated again when an adapter is powered off(unplugging reports it first),
+    // or when refresh() is called(a new search)
+    static const int hotplugPollIntervalMs = 3000;
+public slots:
+    void refresh();
+private:
+    explicit AdapterManager(QObject *parent = nullptr);
+
+    mutable QReadWriteLock m_lock;
+    QList<AdapterInfo> m_adapters;
+    QBluetoothAddress m_firstPoweredAddress;
+    QHash<QBluetoothAddress, QBluetoothLocalDevice*> m_devices;
+    QTimer* m_pollTimer = nullptr;
+
+    void updateFirstPoweredAddress();
+    void updatePollTimer();
+private slots:
+    void onHostModeStateChanged(QBluetoothLocalDevice::HostMode state);
+signals:
+    void adapterAdded(const QBluetoothAddress& address);
+    void adapterRemoved(const QBluetoothAddress& address);
+    void adapterPowerChanged(const QBluetoothAddress& address, bool isPowered);
+    // emitted when the adapter is removed or powered off
+    void adapterUnavailable(const QBluetoothAddress& address);
+};
+
+#endif // ADAPTERMANAGER_H
@@ -1,25 +1,63 @@
 #include "comm.h"
+#include "adaptermanager.h"
+#include "telemetry/tracerecorder.h"
 
 #include <QDebug>
-#include <QBluetoothLocalDevice>
 #include <QDateTime>
 #include <QIODevice>
 
 Comm::Comm(QObject *parent)
     : QObject{parent}
 {
-    rxBufferCleaner = new QTimer();
-    connect(rxBufferCleaner, &QTimer::timeout, this, &Comm::rxBufferCleanTask);
-    rxBufferCleaner->setInterval(packetTimeoutMs);
+    frameTimer = new QTimer(this);
+    frameTimer->setSingleShot(true);
+    frameTimer->setInterval(frameTimeoutMs);
+    connect(frameTimer, &QTimer::timeout, this, &Comm::onFrameTimeout);
+
+    deadlineTimer = new QTimer(this);
+    deadlineTimer->setSingleShot(true);
+    connect(deadlineTimer, &QTimer::timeout, this, &Comm::onDeadlineTimeout);
+
+    reconnectTimer = new QTimer(this);
+    reconnectTimer->setSingleShot(true);
+    connect(reconnectTimer, &QTimer::timeout, this, &Comm::onReconnectTimeout);
+
+    // a few frames, so the appends don't reallocate
+    rxBuffer.reserve(protocol::maxFrameLen * 4);
+
+    connect(this, &Comm::stateChanged, this, &Comm::onConnectionStateChanged);
+    connect(AdapterManager::instance(), &AdapterManager::adapterUnavailable, this, &Comm::onAdapterUnavailable);
 }
 
 bool Comm::sendCommand(const QByteArray& cmd, bool isRaw)
 {
-    QByteArray data = cmd;
-    if(!isRaw)
-        data = addChecksum(addPacketHead(cmd));
-    qDebug() << "send:" << data.toHex();
-    return write(data);
+    // raw commands have the head and the checksum, the type is unknown
+    return scheduleCommand(cmd, isRaw ? SettingPriority : autoPriority(cmd), isRaw);
+}
+
+bool Comm::scheduleCommand(const QByteArray& cmd, int priority, bool isRaw)
+{
+    if(cmd.isEmpty())
+        return false;
+    QueuedCommand item;
+    item.cmd = cmd;
+    item.isRaw = isRaw;
+    if(!isRaw && isDeferred(cmd))
+        item.priority = DeferredPriority;
+    else
+        item.priority = qBound<int>(InteractivePriority, priority, DeferredPriority);
+    TraceRecorder* recorder = TraceRecorder::instance();
+    if(recorder->isEnabled())
+    {
+        item.traceId = recorder->nextId();
+        traceBegin("command", item.traceId, cmd, {{"priority", item.priority}, {"raw", isRaw}});
+        traceBegin("queued", item.traceId, cmd);
+    }
+    commandQueue.enqueue(item);
+    // only one drain task is posted for a burst of commands
+    if(isDrainScheduled.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "drainCommandQueue", Qt::QueuedConnection);
+    return true;
 }
 
 bool Comm::sendCommand(const char *hexCmd, bool isRaw)
@@ -27,51 +65,192 @@ bool Comm::sendCommand(const char *hexCmd, bool isRaw)
     return sendCommand(QByteArray::fromHex(hexCmd), isRaw);
 }
 
+void Comm::cancelTransfer()
+{
+    if(!rxBuffer.isEmpty())
+        qDebug() << "transfer cancelled:" << rxBuffer.toHex();
+    rxBuffer.clear();
+    traceFrameStart = -1;
+    frameTimer->stop();
+}
+
+void Comm::drainCommandQueue()
+{
+    // clear the flag before draining,
+    // so a command queued during draining always schedules another drain
+    isDrainScheduled.storeRelease(0);
+    QueuedCommand item;
+    while(commandQueue.dequeue(item))
+    {
+        scheduledCommands[item.priority].enqueue(item);
+        scheduledCount++;
+    }
+    dispatchCommands();
+}
+
+void Comm::dispatchCommands()
+{
+    // writeCommand() might get here again through addPendingRequest()
+    // the commands are kept while the link is down
+    if(isDispatching || !isConnected)
+        return;
+    isDispatching = true;
+    for(int priority = InteractivePriority; priority < PriorityCount;)
+    {
+        QQueue<QueuedCommand>& queue = scheduledCommands[priority];
+        if(queue.isEmpty())
+        {
+            priority++;
+            continue;
+        }
+        const QueuedCommand& head = queue.head();
+        const bool isTracked = !head.isRaw && expectsResponse(head.cmd);
+        // lower priorities never overtake a held command,
+        // interactive commands preempt the slot so they are sent immediately
+        if(isTracked && priority != InteractivePriority && pendingRequests.length() >= maxInFlightRequests)
+            break;
+        const QueuedCommand item = queue.dequeue();
+        scheduledCount--;
+        traceEnd("queued", item.traceId, item.cmd);
+        if(!writeCommand(item.cmd, item.isRaw, item.priority, item.traceId))
+        {
+            qDebug() << "write failed:" << item.cmd.toHex();
+            traceEnd("command", item.traceId, item.cmd, QStringLiteral("write failed"));
+            emit requestFailed(item.cmd, tr("write failed"));
+        }
+    }
+    isDispatching = false;
+    updateQueueDepth();
+}
+
+bool Comm::writeCommand(const QByteArray& cmd, bool isRaw, int priority, quint32 traceId)
+{
+    TraceSpan span("comm", QStringLiteral("write"));
+    bool result;
+    if(isRaw)
+    {
+        qDebug() << "send:" << cmd.toHex();
+        result = write(cmd) >= 0;
+    }
+    else
+        result = writeFrame(cmd);
+    // raw commands are not tracked because the response is unknown
+    if(result && !isRaw && expectsResponse(cmd))
+    {
+        traceBegin("in flight", traceId, cmd);
+        addPendingRequest(cmd, priority, traceId);
+    }
+    else if(result)
+        traceEnd("command", traceId, cmd, QStringLiteral("sent"));
+    return result;
+}
+
+bool Comm::writeFrame(const QByteArray& cmd)
+{
+    // encoded on the stack, the transport copies the frame into its own TX buffer
+    protocol::Packet packet;
+    packet.size = protocol::encodeFrame(asSpan(cmd), packet.buffer());
+    if(packet.size == 0)
+        return false;
+    const QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char*>(packet.data), packet.size);
+    qDebug() << "send:" << data.toHex();
+    return write(data) >= 0;
+}
+
 void Comm::handlePackets()
 {
     while(!rxBuffer.isEmpty())
     {
-        int packetLen = getPacketLenInBuffer();
-        if(packetLen == 0)
+        const protocol::FrameResult frame = protocol::checkFrame(asSpan(rxBuffer));
+        if(frame.status == protocol::FrameStatus::BadHead)
+        {
+            qDebug() << "error:"
+                     << "unexpected head:" << (int)rxBuffer[0]
+                     << "data:" << rxBuffer.toHex();
+            skipToNextHead(1);
+        }
+        else if(frame.status == protocol::FrameStatus::Incomplete)
+        {
+            if(frame.length > 0)
+            {
+                // a long packet, reassemble it in place
+                rxBuffer.reserve(frame.length);
+                emit transferProgress(rxBuffer.length(), frame.length, false);
+            }
             break;
-        QByteArray data = removeCheckSum(rxBuffer.left(packetLen));
-        rxBuffer.remove(0, packetLen);
-        if(!data.isEmpty())
+        }
+        else if(frame.status == protocol::FrameStatus::BadChecksum)
         {
-            qDebug() << "received:" << data.toHex();
-            emit newData(data);
+            qDebug() << "checksum error:" << rxBuffer.left(frame.length).toHex();
+            // it might be an unsolicited frame, only a request expecting this head and cmd is retried,
+            // otherwise its deadline handles it
+            const int index = findPendingRequest(rxBuffer.left(3));
+            // the length byte might be broken as well, so only the head is dropped
+            skipToNextHead(1);
+            if(index >= 0)
+                retryPendingRequest(index, tr("checksum error"));
         }
         else
         {
-            qDebug() << "received unexpected:" << rxBuffer.toHex();
+            QByteArray data = rxBuffer.left(frame.length - protocol::checksumLen);
+            rxBuffer.remove(0, frame.length);
+            if(traceFrameStart >= 0)
+            {
+                TraceRecorder::instance()->complete("comm", "frame " + data.toHex().toUpper(), traceFrameStart);
+                // the next frame is already in rxBuffer
+                traceFrameStart = rxBuffer.isEmpty() ? -1 : TraceRecorder::instance()->timestamp();
+            }
+            qDebug() << "received:" << data.toHex();
+            const bool isReply = resolvePendingRequest(data);
+            emit newData(data, isReply);
         }
     }
+    // only an incomplete frame is left in rxBuffer
+    if(rxBuffer.isEmpty())
+        frameTimer->stop();
+    else
+        frameTimer->start();
 }
 
-void Comm::onReadyRead()
+void Comm::appendRxData(const QByteArray& data)
 {
     lastReceiveTime = QDateTime::currentMSecsSinceEpoch();
-    if (auto dev = qobject_cast<QIODevice*>(sender())) {
-	QByteArray rawData = dev->readAll();
-	rxBuffer.append(rawData);
-        handlePackets();
-        if(!rxBufferCleaner->isActive())
-           rxBufferCleaner->start();
+    TraceRecorder* recorder = TraceRecorder::instance();
+    if(recorder->isEnabled() && (rxBuffer.isEmpty() || traceFrameStart < 0))
+    {
+        traceFrameStart = recorder->timestamp();
+        recorder->instant("comm", QStringLiteral("rx"), {{"bytes", data.length()}});
     }
+    rxBuffer.append(data);
+    handlePackets();
+}
+
+void Comm::skipToNextHead(int from)
+{
+    rxBuffer.remove(0, protocol::findNextHead(asSpan(rxBuffer), from));
+}
+
+void Comm::onReadyRead()
+{
+    if (auto dev = qobject_cast<QIODevice*>(sender()))
+        appendRxData(dev->readAll());
 }
 
 QByteArray Comm::addPacketHead(QByteArray cmd)
 {
-    cmd.prepend(cmd.length()); // [1]
-    cmd.prepend('\xAA'); // [0]
-    return cmd;
+    QByteArray data;
+    // room for the checksum as well
+    data.reserve(cmd.length() + 4);
+    data.append('\xAA'); // [0]
+    data.append(cmd.length()); // [1]
+    data.append(cmd);
+    return data;
 }
 
 QByteArray Comm::addChecksum(QByteArray data)
 {
-    quint16 sum = 8217;
-    for(quint8 i : data)
-        sum += i;
+    quint16 sum = protocol::checksum(asSpan(data));
+    data.reserve(data.length() + 2);
     data.append(sum >> 8);
     data.append(sum & 0xFF);
     return data;
@@ -79,65 +258,428 @@ QByteArray Comm::addChecksum(QByteArray data)
 
 QByteArray Comm::removeCheckSum(QByteArray data)
 {
-    QByteArray removed = data.chopped(2);
-    QByteArray expected = addChecksum(removed);
-    if(data == expected)
+    if(protocol::verifyChecksum(asSpan(data)))
     {
-        return removed;
+        return data.chopped(2);
     }
     else
     {
         qDebug() << "checksum error:"
-                 << "expected:" << expected.toHex()
                  << "received:" << data.toHex();
         return QByteArray();
     }
 }
 
+protocol::ConstByteSpan Comm::asSpan(const QByteArray& data)
+{
+    return protocol::ConstByteSpan(reinterpret_cast<const std::byte*>(data.constData()), data.size());
+}
+
 int Comm::getPacketLenInBuffer()
 {
-    if(rxBuffer[0] != '\xBB' && rxBuffer[0] != '\xCC')
+    const protocol::FrameResult frame = protocol::checkFrame(asSpan(rxBuffer));
+    if(frame.status == protocol::FrameStatus::BadHead)
     {
         qDebug() << "error:"
                  << "unexpected head:" << (int)rxBuffer[0]
                  << "data:" << rxBuffer.toHex();
         return 0;
     }
-    int expectedLength = (int)rxBuffer[1] + 4;
-    if(rxBuffer.length() < expectedLength)
+    else if(frame.status == protocol::FrameStatus::Incomplete)
     {
         qDebug() << "packet length error:"
-                 << "expected:" << expectedLength
+                 << "expected:" << frame.length
                  << "received:" << rxBuffer.length()
                  << "data:" << rxBuffer.toHex();
         return 0;
     }
-    return expectedLength;
+    return frame.length;
 }
 
 QBluetoothAddress Comm::getLocalAddress()
 {
-    QBluetoothAddress localAddress;
+    // cached, the adapters are not enumerated there
+    return AdapterManager::instance()->firstPoweredAddress();
+}
+
+void Comm::setLocalAddress(const QBluetoothAddress& address)
+{
+    sessionLocalAddress = address;
+}
+
+QBluetoothAddress Comm::localAddress() const
+{
+    return sessionLocalAddress;
+}
 
-    auto BTAdapterList = QBluetoothLocalDevice::allDevices();
-    for(auto it = BTAdapterList.cbegin(); it != BTAdapterList.cend(); ++it)
+bool Comm::isAdapterBound() const
+{
+    return false;
+}
+
+bool Comm::isDeferred(const QByteArray& cmd)
+{
+    if(cmd.isEmpty())
+        return false;
+    const char type = cmd[0];
+    // poweroff, disconnect, re-pair, reset
+    if(type == '\xCE' || type == '\xCD' || type == '\xCF' || type == '\x07')
+        return true;
+    // setting LDAC triggers re-pairing, querying LDAC(0x48) is fine
+    return type == '\x49';
+}
+
+bool Comm::isIdempotent(const QByteArray& cmd)
+{
+    if(cmd.isEmpty() || isDeferred(cmd))
+        return false;
+    // volume up/down, next, previous step from the current state
+    if(cmd.length() == 2 && cmd[0] == '\xC2' && (quint8)cmd[1] >= 0x02 && (quint8)cmd[1] <= 0x05)
+        return false;
+    return true;
+}
+
+bool Comm::expectsResponse(const QByteArray& cmd)
+{
+    // only the commands answered in doc/KnownCommands, the others are fire-and-forget
+    return protocol::replyHead(asSpan(cmd)) != 0;
+}
+
+int Comm::autoPriority(const QByteArray& cmd)
+{
+    if(isDeferred(cmd))
+        return DeferredPriority;
+    // play, pause, volume up/down, previous, next
+    if(cmd.length() == 2 && cmd[0] == '\xC2' && (quint8)cmd[1] <= 0x05)
+        return InteractivePriority;
+    // queries have no argument, except F00A(control settings)
+    if(cmd.length() == 1 || cmd[0] == '\xF0')
+        return QueryPriority;
+    return SettingPriority;
+}
+
+void Comm::addPendingRequest(const QByteArray& cmd, int priority, quint32 traceId)
+{
+    PendingRequest request;
+    request.cmd = cmd;
+    request.deadline = QDateTime::currentMSecsSinceEpoch() + requestTimeoutMs;
+    request.retryCount = 0;
+    request.priority = priority;
+    request.sentTime = QDateTime::currentMSecsSinceEpoch();
+    request.traceId = traceId;
+    pendingRequests.append(request);
+    updateDeadlineTimer();
+}
+
+int Comm::findPendingRequest(const QByteArray& data) const
+{
+    if(data.length() < 3)
+        return -1;
+    // both 0xBB and 0xCC replies carry the cmd byte of the request,
+    // the head tells a reply from a notification with the same cmd byte(like a button press)
+    const quint8 head = data[0];
+    const char type = data[2];
+    for(int i = 0; i < pendingRequests.length(); i++)
     {
-        qDebug() << "dev:" << it->name() << it->address();
-        QBluetoothLocalDevice dev(it->address());
-        if(dev.isValid() && dev.hostMode() != QBluetoothLocalDevice::HostPoweredOff)
+        const QByteArray& cmd = pendingRequests[i].cmd;
+        if(cmd[0] != type)
+            continue;
+        const quint8 expectedHead = protocol::replyHead(asSpan(cmd));
+        if(expectedHead == 0 || expectedHead == head)
+            return i;
+    }
+    return -1;
+}
+
+bool Comm::resolvePendingRequest(const QByteArray& data)
+{
+    const int i = findPendingRequest(data);
+    if(i < 0)
+        return false;
+    const protocol::EchoStatus echo = protocol::checkEcho(asSpan(pendingRequests[i].cmd), asSpan(data));
+    if(echo == protocol::EchoStatus::Mismatched)
+    {
+        qDebug() << "echo mismatch:" << pendingRequests[i].cmd.toHex() << data.toHex();
+        // resend the same command, the last attempt reports the mismatch
+        if(isIdempotent(pendingRequests[i].cmd) && pendingRequests[i].retryCount < maxRetryCount)
         {
-            localAddress = it->address();
-            break; // find the first valid one
+            retryPendingRequest(i, tr("echo mismatch"));
+            return true;
         }
     }
-    return localAddress;
+    const PendingRequest request = pendingRequests.takeAt(i);
+    traceEnd("in flight", request.traceId, request.cmd);
+    if(echo == protocol::EchoStatus::Mismatched)
+    {
+        traceEnd("command", request.traceId, request.cmd, QStringLiteral("echo mismatch"));
+        emit writeVerified(request.cmd, static_cast<int>(echo));
+        emit requestFailed(request.cmd, tr("echo mismatch"));
+    }
+    else
+    {
+        traceEnd("command", request.traceId, request.cmd, QStringLiteral("ok"));
+        if(echo != protocol::EchoStatus::NotApplicable)
+            emit writeVerified(request.cmd, static_cast<int>(echo));
+        emit requestCompleted(request.cmd, QDateTime::currentMSecsSinceEpoch() - request.sentTime);
+    }
+    updateDeadlineTimer();
+    dispatchCommands();
+    return true;
 }
 
-void Comm::rxBufferCleanTask()
+void Comm::retryPendingRequest(int index, const QString& reason)
 {
-    if(QDateTime::currentMSecsSinceEpoch() - lastReceiveTime >= packetTimeoutMs)
+    PendingRequest request = pendingRequests.takeAt(index);
+    if(isIdempotent(request.cmd) && request.retryCount < maxRetryCount)
+    {
+        qDebug() << "retry:" << request.cmd.toHex() << reason;
+        request.retryCount++;
+        request.deadline = QDateTime::currentMSecsSinceEpoch() + requestTimeoutMs;
+        traceEnd("in flight", request.traceId, request.cmd, reason);
+        traceBegin("in flight", request.traceId, request.cmd, {{"retry", request.retryCount}});
+        pendingRequests.append(request);
+        writeFrame(request.cmd);
+    }
+    else
     {
-        rxBuffer.clear();
-        rxBufferCleaner->stop();
+        qDebug() << "request failed:" << request.cmd.toHex() << reason;
+        traceEnd("in flight", request.traceId, request.cmd, reason);
+        traceEnd("command", request.traceId, request.cmd, reason);
+        emit requestFailed(request.cmd, reason);
     }
+    updateDeadlineTimer();
+    dispatchCommands();
+}
+
+void Comm::clearPendingRequests()
+{
+    for(const auto& request : qAsConst(pendingRequests))
+    {
+        traceEnd("in flight", request.traceId, request.cmd);
+        traceEnd("command", request.traceId, request.cmd, QStringLiteral("cleared"));
+    }
+    pendingRequests.clear();
+    for(auto& queue : scheduledCommands)
+    {
+        for(const auto& item : qAsConst(queue))
+        {
+            traceEnd("queued", item.traceId, item.cmd);
+            traceEnd("command", item.traceId, item.cmd, QStringLiteral("cleared"));
+        }
+        queue.clear();
+    }
+    scheduledCount = 0;
+    updateDeadlineTimer();
+}
+
+void Comm::failQueuedCommands(const QString& reason)
+{
+    // the spans are ended there with the reason, not in clearPendingRequests()
+    for(auto& request : pendingRequests)
+    {
+        traceEnd("in flight", request.traceId, request.cmd);
+        traceEnd("command", request.traceId, request.cmd, reason);
+        request.traceId = 0;
+        emit requestFailed(request.cmd, reason);
+    }
+    for(auto& queue : scheduledCommands)
+    {
+        for(auto& item : queue)
+        {
+            traceEnd("queued", item.traceId, item.cmd);
+            traceEnd("command", item.traceId, item.cmd, reason);
+            item.traceId = 0;
+            emit requestFailed(item.cmd, reason);
+        }
+    }
+    clearPendingRequests();
+}
+
+void Comm::requeuePendingRequests()
+{
+    // in reverse order, so the oldest one ends up at the head
+    for(int i = pendingRequests.length() - 1; i >= 0; i--)
+    {
+        const PendingRequest& request = pendingRequests[i];
+        // a non-idempotent request might be the cause of the disconnection(LDAC, re-pair),
+        // assume it is applied
+        traceEnd("in flight", request.traceId, request.cmd, QStringLiteral("disconnected"));
+        if(!isIdempotent(request.cmd))
+        {
+            qDebug() << "not resumed:" << request.cmd.toHex();
+            traceEnd("command", request.traceId, request.cmd, QStringLiteral("assumed applied"));
+            emit requestCompleted(request.cmd, QDateTime::currentMSecsSinceEpoch() - request.sentTime);
+            continue;
+        }
+        QueuedCommand item;
+        item.cmd = request.cmd;
+        item.priority = request.priority;
+        item.traceId = request.traceId;
+        traceBegin("queued", item.traceId, item.cmd);
+        scheduledCommands[item.priority].prepend(item);
+        scheduledCount++;
+    }
+    pendingRequests.clear();
+    updateDeadlineTimer();
+}
+
+void Comm::setAutoReconnect(bool enabled)
+{
+    isAutoReconnectEnabled.storeRelease(enabled ? 1 : 0);
+}
+
+bool Comm::isOpen() const
+{
+    return isLinkUp.loadAcquire() != 0;
+}
+
+void Comm::scheduleReconnect()
+{
+    // a failed attempt might be reported more than once
+    if(reconnectTimer->isActive())
+        return;
+    if(reconnectAttempt >= maxReconnectAttempts)
+    {
+        qDebug() << "reconnect: giving up after" << reconnectAttempt << "attempts";
+        hasConnected = false;
+        reconnectAttempt = 0;
+        failQueuedCommands(tr("disconnected"));
+        emit showMessage(tr("Failed to reconnect"));
+        return;
+    }
+    const int delay = qMin(reconnectInitialDelayMs << reconnectAttempt, reconnectMaxDelayMs);
+    reconnectAttempt++;
+    qDebug() << "reconnect: attempt" << reconnectAttempt << "in" << delay << "ms";
+    reconnectTimer->start(delay);
+    emit reconnecting(reconnectAttempt, delay);
+}
+
+void Comm::onReconnectTimeout()
+{
+    if(!isAutoReconnectEnabled.loadAcquire())
+    {
+        failQueuedCommands(tr("disconnected"));
+        return;
+    }
+    open(sessionDeviceInfo);
+}
+
+void Comm::traceBegin(const char* stage, quint32 traceId, const QByteArray& cmd, const QJsonObject& args)
+{
+    if(traceId == 0)
+        return;
+    // the top level span is named after the command
+    const QString name = qstrcmp(stage, "command") == 0 ? QString(cmd.toHex().toUpper()) : QString(stage);
+    TraceRecorder::instance()->asyncBegin("command", name, traceId, args);
+}
+
+void Comm::traceEnd(const char* stage, quint32 traceId, const QByteArray& cmd, const QString& result)
+{
+    if(traceId == 0)
+        return;
+    const QString name = qstrcmp(stage, "command") == 0 ? QString(cmd.toHex().toUpper()) : QString(stage);
+    QJsonObject args;
+    if(!result.isEmpty())
+        args.insert("result", result);
+    TraceRecorder::instance()->asyncEnd("command", name, traceId, args);
+}
+
+void Comm::updateQueueDepth()
+{
+    const int depth = pendingRequests.length() + scheduledCount;
+    if(depth != lastQueueDepth)
+    {
+        lastQueueDepth = depth;
+        emit queueDepthChanged(lastQueueDepth);
+    }
+}
+
+void Comm::updateDeadlineTimer()
+{
+    updateQueueDepth();
+    if(pendingRequests.isEmpty())
+    {
+        deadlineTimer->stop();
+        return;
+    }
+    qint64 earliest = pendingRequests.first().deadline;
+    for(const auto& request : qAsConst(pendingRequests))
+        earliest = qMin(earliest, request.deadline);
+    qint64 remaining = earliest - QDateTime::currentMSecsSinceEpoch();
+    deadlineTimer->start(qMax<qint64>(remaining, 0));
+}
+
+void Comm::onFrameTimeout()
+{
+    if(rxBuffer.isEmpty())
+        return;
+    // drop the stale head and keep anything which looks like a new frame
+    qDebug() << "frame timeout:" << rxBuffer.toHex();
+    skipToNextHead(1);
+    handlePackets();
+}
+
+void Comm::onDeadlineTimeout()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for(int i = 0; i < pendingRequests.length();)
+    {
+        if(pendingRequests[i].deadline <= now)
+        {
+            // retryPendingRequest() moves the request to the tail with a new deadline
+            // or removes it, so the next request is at i now
+            retryPendingRequest(i, tr("timeout"));
+        }
+        else
+            i++;
+    }
+}
+
+void Comm::onAdapterUnavailable(const QBluetoothAddress& address)
+{
+    // only sessions bound to a known adapter can be matched
+    if(!isAdapterBound() || sessionLocalAddress.isNull() || address != sessionLocalAddress)
+        return;
+    qDebug() << "adapter unavailable:" << address;
+    failQueuedCommands(tr("adapter unavailable"));
+    // some transports report the disconnection in close(), it is reported only once
+    bool isReported = false;
+    const auto connection = connect(this, &Comm::stateChanged, this, [&isReported](bool connected) {
+        if(!connected)
+            isReported = true;
+    });
+    close();
+    disconnect(connection);
+    if(!isReported)
+        emit stateChanged(false);
+    emit showMessage(tr("Bluetooth adapter unavailable"));
+}
+
+void Comm::onConnectionStateChanged(bool connected)
+{
+    if(connected)
+    {
+        isConnected = true;
+        isLinkUp.storeRelease(1);
+        hasConnected = true;
+        reconnectAttempt = 0;
+        reconnectTimer->stop();
+        // resume the commands kept during the gap
+        dispatchCommands();
+        return;
+    }
+    const bool wasConnected = isConnected;
+    isConnected = false;
+    isLinkUp.storeRelease(0);
+    rxBuffer.clear();
+    traceFrameStart = -1;
+    frameTimer->stop();
+    if(isAutoReconnectEnabled.loadAcquire() && hasConnected && sessionDeviceInfo.isValid())
+    {
+        if(wasConnected)
+            requeuePendingRequests();
+        scheduleReconnect();
+    }
+    else
+        failQueuedCommands(tr("disconnected"));
 }
@@ -5,39 +5,181 @@
 #include <QBluetoothAddress>
 #include <QBluetoothDeviceInfo>
 #include <QTimer>
+#include <QAtomicInt>
+#include <QQueue>
+#include <QJsonObject>
+
+#include "mpscqueue.h"
+#include "protocol.h"
+#include "packet.h"
 
 class Comm : public QObject
 {
     Q_OBJECT
 public:
+    // queued commands are sent in ascending order, see scheduleCommand()
+    enum Priority
+    {
+        InteractivePriority = 0, // playback controls, not limited by maxInFlightRequests
+        QueryPriority, // status queries
+        SettingPriority, // settings, the priority in a profile(0-2) is added to it
+        DeferredPriority = SettingPriority + 3, // commands with side effects(LDAC, poweroff...)
+        PriorityCount
+    };
+
     explicit Comm(QObject *parent = nullptr);
-    virtual void open(const QBluetoothDeviceInfo &deviceInfo) = 0;
-    virtual void close() = 0;
     int getPacketLenInBuffer();
     static QByteArray addPacketHead(QByteArray cmd);
     static QByteArray addChecksum(QByteArray data);
     static QByteArray removeCheckSum(QByteArray data);
+    // view of a QByteArray for the protocol core, no copy
+    static protocol::ConstByteSpan asSpan(const QByteArray& data);
     static QBluetoothAddress getLocalAddress();
+    // the local adapter for this session, getLocalAddress() is used if it's null
+    void setLocalAddress(const QBluetoothAddress& address);
+    QBluetoothAddress localAddress() const;
+    // false if the transport can't be bound to a local adapter(RFCOMM),
+    // the session is neither balanced nor closed with its adapter then
+    virtual bool isAdapterBound() const;
+    // commands which change the connection or the device state(poweroff, reset, LDAC...),
+    // they are sent after everything else
+    static bool isDeferred(const QByteArray& cmd);
+    // the deferred commands and the playback steps(volume up/down, next, previous)
+    // must not be sent twice, they are never retried or resumed
+    static bool isIdempotent(const QByteArray& cmd);
+    // the commands with a known reply(protocol::replyHead()), only they are tracked and retried
+    static bool expectsResponse(const QByteArray& cmd);
+    // thread-safe, disable it before closing the session on purpose
+    void setAutoReconnect(bool enabled);
+    // thread-safe, the link state after the last stateChanged()
+    bool isOpen() const;
+    // the priority used by sendCommand()
+    static int autoPriority(const QByteArray& cmd);
 
-    static const int packetTimeoutMs = 5000;
+    // a request without response will be retried after requestTimeoutMs
+    static const int requestTimeoutMs = 500;
+    static const int maxRetryCount = 2;
+    // queued commands are held back while this many requests are waiting for the response
+    static const int maxInFlightRequests = 1;
+    // an incomplete frame will be dropped if no more data arrives in frameTimeoutMs
+    static const int frameTimeoutMs = 300;
+    // the delay doubles after each failed attempt
+    static const int reconnectInitialDelayMs = 1000;
+    static const int reconnectMaxDelayMs = 30000;
+    // the queued commands are failed after this many attempts
+    static const int maxReconnectAttempts = 8;
 public slots:
+    // Comm lives in the I/O thread, call open()/close() with Qt::QueuedConnection
+    virtual void open(const QBluetoothDeviceInfo &deviceInfo) = 0;
+    virtual void close() = 0;
+    // thread-safe, the command is queued and sent in the I/O thread
     bool sendCommand(const QByteArray& cmd, bool isRaw = false);
     bool sendCommand(const char* hexCmd, bool isRaw = false);
+    // thread-safe, deferred commands are always sent with DeferredPriority
+    bool scheduleCommand(const QByteArray& cmd, int priority, bool isRaw = false);
+    // drop the partial frame in rxBuffer, subclasses drop the unsent data as well
+    virtual void cancelTransfer();
 protected:
+    struct QueuedCommand
+    {
+        QByteArray cmd;
+        bool isRaw = false;
+        int priority = SettingPriority;
+        // 0 if tracing was disabled when it was queued
+        quint32 traceId = 0;
+    };
+    struct PendingRequest
+    {
+        QByteArray cmd; // without head and checksum
+        qint64 deadline;
+        int retryCount;
+        int priority;
+        qint64 sentTime; // the first attempt
+        quint32 traceId;
+    };
+
+    // data might point into a stack buffer, copy it if it is used after returning
     virtual qint64 write(const QByteArray &data) = 0;
+    bool writeCommand(const QByteArray& cmd, bool isRaw, int priority = SettingPriority, quint32 traceId = 0);
+    bool writeFrame(const QByteArray& cmd);
     void handlePackets();
+    void appendRxData(const QByteArray& data);
+    void skipToNextHead(int from);
+    void addPendingRequest(const QByteArray& cmd, int priority, quint32 traceId = 0);
+    // the index of the request answered by data(a received frame), -1 if none
+    int findPendingRequest(const QByteArray& data) const;
+    // returns false if data doesn't answer any pending request
+    bool resolvePendingRequest(const QByteArray& data);
+    void retryPendingRequest(int index, const QString& reason);
+    // clears the queued commands as well
+    void clearPendingRequests();
+    // emits requestFailed() for the pending requests and the queued commands, then clears them
+    void failQueuedCommands(const QString& reason);
+    // moves the unacknowledged requests back to the head of the queues
+    void requeuePendingRequests();
+    void scheduleReconnect();
+    void updateDeadlineTimer();
+    void updateQueueDepth();
+    void dispatchCommands();
+    // the lifecycle spans of a command in TraceRecorder, stage: command, queued, in flight
+    static void traceBegin(const char* stage, quint32 traceId, const QByteArray& cmd, const QJsonObject& args = QJsonObject());
+    static void traceEnd(const char* stage, quint32 traceId, const QByteArray& cmd, const QString& result = QString());
 
     QByteArray rxBuffer;
     qint64 lastReceiveTime = 0;
-    QTimer* rxBufferCleaner;
+    // the trace timestamp of the first byte of the frame in rxBuffer, -1 if tracing is disabled
+    qint64 traceFrameStart = -1;
+    QBluetoothAddress sessionLocalAddress;
+    // set by open() in subclasses, used for reconnecting
+    QBluetoothDeviceInfo sessionDeviceInfo;
+    bool isConnected = false;
+    // isConnected for the other threads
+    QAtomicInt isLinkUp;
+    // reconnecting is only tried after the session has been connected once
+    bool hasConnected = false;
+    QAtomicInt isAutoReconnectEnabled;
+    int reconnectAttempt = 0;
+    QTimer* reconnectTimer;
+    QTimer* frameTimer;
+    QList<PendingRequest> pendingRequests;
+    QTimer* deadlineTimer;
+    MpscQueue<QueuedCommand> commandQueue;
+    QAtomicInt isDrainScheduled;
+    // drained from commandQueue, waiting for a free request slot
+    QQueue<QueuedCommand> scheduledCommands[PriorityCount];
+    int scheduledCount = 0;
+    bool isDispatching = false;
+    int lastQueueDepth = 0;
 protected slots:
+    void drainCommandQueue();
     void onReadyRead();
-    void rxBufferCleanTask();
+    void onFrameTimeout();
+    void onDeadlineTimeout();
+    void onConnectionStateChanged(bool connected);
+    void onAdapterUnavailable(const QBluetoothAddress& address);
+    void onReconnectTimeout();
 signals:
-    void newData(const QByteArray& data);
+    // QByteArray is implicitly shared, so queued connections don't copy the data
+    // isReply: the frame answered a pending request, emitted after requestCompleted()/writeVerified()
+    void newData(const QByteArray& data, bool isReply);
     void stateChanged(bool connected);
     void showMessage(const QString& msg);
     void deviceFeature(const QString& feature, bool isBLE = true);
+    void requestFailed(const QByteArray& cmd, const QString& reason);
+    // the response arrived, latencyMs includes the retries,
+    // or a non-idempotent request is assumed applied after the link dropped(LDAC re-pairs the device)
+    void requestCompleted(const QByteArray& cmd, int latencyMs);
+    // a setting command is answered, echoStatus: protocol::EchoStatus(Acknowledged, Confirmed or Mismatched)
+    // a mismatch is resent like a timeout, only the last one is reported, followed by requestFailed(),
+    // otherwise it's followed by requestCompleted()
+    void writeVerified(const QByteArray& cmd, int echoStatus);
+    // pending requests and queued commands
+    void queueDepthChanged(int depth);
+    // for long packets which take more than one chunk
+    void transferProgress(qint64 done, qint64 total, bool isTx);
+    void transferFailed(const QString& reason);
+    // the link is lost, open() will be called again after delayMs
+    void reconnecting(int attempt, int delayMs);
 };
 
 #endif // COMM_H
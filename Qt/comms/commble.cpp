@@ -1,4 +1,5 @@
 #include "commble.h"
+#include "telemetry/tracerecorder.h"
 
 #include <QLowEnergyController>
 #include <QBluetoothLocalDevice>
@@ -9,7 +10,10 @@
 CommBLE::CommBLE(QObject *parent)
     : Comm{parent}
 {
-
+    m_txTimer = new QTimer(this);
+    m_txTimer->setSingleShot(true);
+    m_txTimer->setInterval(txTimeoutMs);
+    connect(m_txTimer, &QTimer::timeout, this, &CommBLE::onTxTimeout);
 }
 
 void CommBLE::open(const QBluetoothDeviceInfo &deviceInfo)
@@ -17,11 +21,23 @@ void CommBLE::open(const QBluetoothDeviceInfo &deviceInfo)
     if(m_Controller != nullptr)
         m_Controller->deleteLater();
 
-    QBluetoothAddress localAddress = getLocalAddress();
-    if(localAddress.isNull())
+    QBluetoothAddress adapterAddress = localAddress();
+    if(adapterAddress.isNull())
+        adapterAddress = getLocalAddress();
+    if(adapterAddress.isNull())
         return; // invalid
 
-    m_Controller = QLowEnergyController::createCentral(deviceInfo);
+    sessionDeviceInfo = deviceInfo;
+    TraceRecorder* recorder = TraceRecorder::instance();
+    traceConnectionPhase(nullptr, QStringLiteral("restarted"));
+    if(recorder->isEnabled())
+    {
+        m_connectionTraceId = recorder->nextId();
+        recorder->asyncBegin("ble", QStringLiteral("connection"), m_connectionTraceId, {{"address", deviceInfo.address().toString()}});
+        traceConnectionPhase("connect");
+    }
+    m_Controller = QLowEnergyController::createCentral(deviceInfo, adapterAddress);
+    connect(m_Controller, &QLowEnergyController::connected, this, [ = ] {traceConnectionPhase("discoverServices");});
     connect(m_Controller, &QLowEnergyController::connected, m_Controller, &QLowEnergyController::discoverServices);
     connect(m_Controller, &QLowEnergyController::errorOccurred, this, &CommBLE::onErrorOccurred);
     connect(m_Controller, &QLowEnergyController::serviceDiscovered, this, &CommBLE::onServiceDiscovered);
@@ -31,6 +47,8 @@ void CommBLE::open(const QBluetoothDeviceInfo &deviceInfo)
 
 void CommBLE::close()
 {
+    traceConnectionPhase(nullptr, QStringLiteral("closed"));
+    cancelTransfer();
     if(m_RxTxService != nullptr)
     {
         QLowEnergyDescriptor desc = m_RxTxService->characteristic(m_RxUUID).descriptor(QBluetoothUuid::DescriptorType::ClientCharacteristicConfiguration);
@@ -46,6 +64,12 @@ void CommBLE::close()
     }
 }
 
+bool CommBLE::isAdapterBound() const
+{
+    // QLowEnergyController is created on localAddress()
+    return true;
+}
+
 void CommBLE::onServiceDiscovered(const QBluetoothUuid& newService)
 {
     bool expected = false;
@@ -58,6 +82,7 @@ void CommBLE::onServiceDiscovered(const QBluetoothUuid& newService)
     {
         auto service = m_Controller->createServiceObject(newService);
         m_RxTxService = service;
+        traceConnectionPhase("discoverDetails");
         // for characteristics (assume no included services)
         connect(service, &QLowEnergyService::stateChanged, this, &CommBLE::onServiceDetailDiscovered);
         service->discoverDetails();
@@ -107,6 +132,9 @@ void CommBLE::onServiceDetailDiscovered(QLowEnergyService::ServiceState newState
                 connect(m_RxTxService, &QLowEnergyService::errorOccurred, this, &CommBLE::onErrorOccurred);
                 connect(m_RxTxService, &QLowEnergyService::characteristicChanged, this, &CommBLE::onDataArrived);
                 connect(m_RxTxService, &QLowEnergyService::characteristicRead, this, &CommBLE::onDataArrived); // not necessary
+                connect(m_RxTxService, &QLowEnergyService::characteristicWritten, this, &CommBLE::onCharacteristicWritten);
+                connect(m_RxTxService, &QLowEnergyService::descriptorWritten, this, &CommBLE::onDescriptorWritten);
+                traceConnectionPhase("CCCD write");
                 QLowEnergyDescriptor desc = m_RxTxService->characteristic(m_RxUUID).descriptor(QBluetoothUuid::DescriptorType::ClientCharacteristicConfiguration);
                 m_RxTxService->writeDescriptor(desc, QByteArray::fromHex("0100")); // Enable notify
                 // Tx
@@ -126,7 +154,17 @@ void CommBLE::onServiceDetailDiscovered(QLowEnergyService::ServiceState newState
 void CommBLE::onErrorOccurred()
 {
     if(sender() == m_Controller)
+    {
         qDebug() << "BLE Controller Error:" << m_Controller->error() << m_Controller->errorString();
+        traceConnectionPhase(nullptr, m_Controller->errorString());
+        // the link is not up yet, report the failed attempt so it can be retried
+        // a connected session is handled in onServiceStateChanged()
+        if(!isConnected)
+        {
+            close();
+            emit stateChanged(false);
+        }
+    }
     else if(sender() == m_RxTxService)
         qDebug() << "BLE Service Error:" << m_RxTxService->error();
 }
@@ -135,34 +173,141 @@ void CommBLE::onDataArrived(const QLowEnergyCharacteristic &characteristic, cons
 {
     // similar to Comm::onReadyRead()
     Q_UNUSED(characteristic);
-    lastReceiveTime = QDateTime::currentMSecsSinceEpoch();
-    rxBuffer.append(newValue);
-    handlePackets();
-    if(!rxBufferCleaner->isActive())
-        rxBufferCleaner->start();
+    appendRxData(newValue);
 }
 
 qint64 CommBLE::write(const QByteArray &data)
 {
     if(m_RxTxService != nullptr)
     {
-        int t = 0;
-        for(int i = 0; i < data.length(); i += maxPacketLen)
+        TraceSpan span("ble", QStringLiteral("chunking"));
+        TraceRecorder* recorder = TraceRecorder::instance();
+        // one span until all queued chunks are acknowledged
+        if(m_txTraceId == 0 && recorder->isEnabled())
+        {
+            m_txTraceId = recorder->nextId();
+            recorder->asyncBegin("ble", QStringLiteral("tx"), m_txTraceId);
+        }
+        const int len = chunkLen();
+        for(int i = 0; i < data.length(); i += len)
         {
-            // data.mid() will handle the case where i+maxPacketLen > data.length()
-            QTimer::singleShot(t, [ = ] {m_RxTxService->writeCharacteristic(m_TxCharacteristic, data.mid(i, maxPacketLen));});
-            t += packetDelayMs;
+            // data might be a raw view of a stack buffer, so the chunk must be a deep copy
+            // data.mid() doesn't copy if the chunk is the whole data
+            m_txChunks.append(QByteArray(data.constData() + i, qMin(len, data.length() - i)));
         }
+        m_txTotal += data.length();
+        sendNextChunks();
         return data.length(); // no feedback
     }
     else
         return -1;
 }
 
+int CommBLE::chunkLen() const
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    if(m_Controller != nullptr && m_Controller->mtu() > defaultChunkLen + 3)
+        return m_Controller->mtu() - 3;
+#endif
+    return defaultChunkLen;
+}
+
+void CommBLE::sendNextChunks()
+{
+    // the next chunk is sent when a previous one is acknowledged, no timer is involved
+    while(m_txInFlight < txWindowSize && !m_txChunks.isEmpty())
+    {
+        if(m_txTraceId != 0)
+            TraceRecorder::instance()->instant("ble", QStringLiteral("write chunk"), {{"bytes", m_txChunks.first().length()}});
+        m_RxTxService->writeCharacteristic(m_TxCharacteristic, m_txChunks.takeFirst());
+        m_txInFlight++;
+    }
+    if(m_txInFlight > 0)
+        m_txTimer->start();
+}
+
+void CommBLE::onCharacteristicWritten(const QLowEnergyCharacteristic &characteristic, const QByteArray &newValue)
+{
+    if(characteristic.uuid() != m_TxCharacteristic.uuid() || m_txInFlight == 0)
+        return;
+    m_txInFlight--;
+    m_txDone += newValue.length();
+    // only long transfers are reported
+    if(m_txTotal > chunkLen())
+        emit transferProgress(m_txDone, m_txTotal, true);
+    if(m_txInFlight == 0 && m_txChunks.isEmpty())
+    {
+        m_txTimer->stop();
+        m_txDone = 0;
+        m_txTotal = 0;
+        traceTxEnd(QStringLiteral("ok"));
+    }
+    else
+        sendNextChunks();
+}
+
+void CommBLE::onTxTimeout()
+{
+    qDebug() << "BLE write timeout:" << m_txChunks.length() << "chunks left";
+    // a frame being received is not affected
+    clearTx(QStringLiteral("timeout"));
+    emit transferFailed(tr("timeout"));
+}
+
+void CommBLE::cancelTransfer()
+{
+    Comm::cancelTransfer();
+    clearTx(QStringLiteral("cancelled"));
+}
+
+void CommBLE::clearTx(const QString& result)
+{
+    traceTxEnd(result);
+    m_txChunks.clear();
+    m_txInFlight = 0;
+    m_txDone = 0;
+    m_txTotal = 0;
+    m_txTimer->stop();
+}
+
+void CommBLE::onDescriptorWritten(const QLowEnergyDescriptor &descriptor, const QByteArray &newValue)
+{
+    Q_UNUSED(newValue);
+    if(descriptor.type() == QBluetoothUuid::DescriptorType::ClientCharacteristicConfiguration
+            && m_connectionPhase != nullptr && qstrcmp(m_connectionPhase, "CCCD write") == 0)
+        traceConnectionPhase(nullptr, QStringLiteral("connected"));
+}
+
+void CommBLE::traceConnectionPhase(const char* phase, const QString& result)
+{
+    if(m_connectionTraceId == 0)
+        return;
+    TraceRecorder* recorder = TraceRecorder::instance();
+    if(m_connectionPhase != nullptr)
+        recorder->asyncEnd("ble", m_connectionPhase, m_connectionTraceId);
+    m_connectionPhase = phase;
+    if(phase != nullptr)
+        recorder->asyncBegin("ble", phase, m_connectionTraceId);
+    else
+    {
+        recorder->asyncEnd("ble", QStringLiteral("connection"), m_connectionTraceId, {{"result", result}});
+        m_connectionTraceId = 0;
+    }
+}
+
+void CommBLE::traceTxEnd(const QString& result)
+{
+    if(m_txTraceId == 0)
+        return;
+    TraceRecorder::instance()->asyncEnd("ble", QStringLiteral("tx"), m_txTraceId, {{"result", result}});
+    m_txTraceId = 0;
+}
+
 void CommBLE::onServiceStateChanged(QLowEnergyService::ServiceState newState)
 {
     if(newState == QLowEnergyService::InvalidService)
     {
+        cancelTransfer();
         m_RxTxService->deleteLater();
         m_RxTxService = nullptr;
         if(m_Controller != nullptr)
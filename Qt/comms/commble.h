@@ -11,6 +11,8 @@ public:
     explicit CommBLE(QObject *parent = nullptr);
     void open(const QBluetoothDeviceInfo &address) override;
     void close() override;
+    void cancelTransfer() override;
+    bool isAdapterBound() const override;
 protected:
     qint64 write(const QByteArray &data) override;
 private slots:
@@ -19,6 +21,9 @@ private slots:
     void onServiceDetailDiscovered(QLowEnergyService::ServiceState newState);
     void onDataArrived(const QLowEnergyCharacteristic &characteristic, const QByteArray &newValue);
     void onServiceStateChanged(QLowEnergyService::ServiceState newState);
+    void onCharacteristicWritten(const QLowEnergyCharacteristic &characteristic, const QByteArray &newValue);
+    void onDescriptorWritten(const QLowEnergyDescriptor &descriptor, const QByteArray &newValue);
+    void onTxTimeout();
 private:
     QLowEnergyController* m_Controller = nullptr;
     QList<QBluetoothUuid> m_DiscoveredServices;
@@ -27,8 +32,30 @@ private:
     QLowEnergyCharacteristic m_TxCharacteristic;
     static const QList<QBluetoothUuid> specialRxUUIDList;
     static const QList<QBluetoothUuid> specialTxUUIDList;
-    static const int maxPacketLen = 20; // MTU?
-    static const int packetDelayMs = 50;
+    // chunks of all unsent packets, a chunk never crosses the packet boundary
+    QList<QByteArray> m_txChunks;
+    int m_txInFlight = 0;
+    qint64 m_txDone = 0;
+    qint64 m_txTotal = 0;
+    QTimer* m_txTimer = nullptr;
+    // TraceRecorder spans, 0 if not traced
+    quint32 m_connectionTraceId = 0;
+    const char* m_connectionPhase = nullptr;
+    quint32 m_txTraceId = 0;
+
+    int chunkLen() const;
+    void sendNextChunks();
+    // drops the unsent chunks, rxBuffer is kept
+    void clearTx(const QString& result);
+    // ends the current phase of the connection span and begins the next one,
+    // nullptr ends the connection span with result
+    void traceConnectionPhase(const char* phase, const QString& result = QString());
+    void traceTxEnd(const QString& result);
+
+    static const int defaultChunkLen = 20; // ATT_MTU(23) - 3
+    // the number of unacknowledged writes
+    static const int txWindowSize = 4;
+    static const int txTimeoutMs = 2000;
 };
 
 #endif // COMMBLE_H
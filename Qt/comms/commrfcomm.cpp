@@ -6,26 +6,81 @@
 CommRFCOMM::CommRFCOMM(QObject *parent)
     : Comm{parent}
 {
-    m_socket = new QBluetoothSocket(QBluetoothServiceInfo::RfcommProtocol);
+    // the parent is necessary, the socket is moved to the I/O thread with its parent
+    m_socket = new QBluetoothSocket(QBluetoothServiceInfo::RfcommProtocol, this);
     connect(m_socket, &QIODevice::readyRead, this, &CommRFCOMM::onReadyRead);
     connect(m_socket, &QBluetoothSocket::stateChanged, this, &CommRFCOMM::onStateChanged);
     connect(m_socket, &QBluetoothSocket::errorOccurred, this, &CommRFCOMM::onErrorOccurred);
+    connect(m_socket, &QIODevice::bytesWritten, this, &CommRFCOMM::onBytesWritten);
+    m_txBuffer.reserve(maxInFlightBytes);
 }
 
 void CommRFCOMM::open(const QBluetoothDeviceInfo &deviceInfo)
 {
+    // QBluetoothSocket can't be bound to a local adapter,
+    // it is not counted by AdapterBalancer, see isAdapterBound()
+    sessionDeviceInfo = deviceInfo;
     m_socket->connectToService(deviceInfo.address(), m_serviceUUID);
 }
 
 void CommRFCOMM::close()
 {
+    cancelTransfer();
     m_socket->disconnectFromService();
     m_socket->close();
 }
 
 qint64 CommRFCOMM::write(const QByteArray &data)
 {
-    return m_socket->write(data);
+    if(m_socket->state() != QBluetoothSocket::SocketState::ConnectedState)
+        return -1;
+    if(txBacklog() + data.length() > maxBacklogBytes)
+    {
+        qDebug() << "RFCOMM backlog full:" << txBacklog();
+        return -1;
+    }
+    // the packets written in the same event loop iteration are sent in one write
+    // the 0xAA head delimits them
+    // data is copied there, m_txBuffer keeps its capacity between flushes
+    m_txBuffer.append(data);
+    if(!m_isFlushScheduled)
+    {
+        m_isFlushScheduled = true;
+        QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+    }
+    return data.length();
+}
+
+void CommRFCOMM::flush()
+{
+    m_isFlushScheduled = false;
+    qint64 len = qMin<qint64>(maxInFlightBytes - m_inFlightBytes, m_txBuffer.length());
+    if(len <= 0)
+        return; // wait for bytesWritten()
+    qint64 written = m_socket->write(m_txBuffer.constData(), len);
+    if(written <= 0)
+        return;
+    m_txBuffer.remove(0, written); // keeps the capacity
+    m_inFlightBytes += written;
+}
+
+void CommRFCOMM::onBytesWritten(qint64 bytes)
+{
+    m_inFlightBytes = qMax<qint64>(m_inFlightBytes - bytes, 0);
+    if(!m_txBuffer.isEmpty())
+        flush();
+}
+
+qint64 CommRFCOMM::txBacklog() const
+{
+    return m_txBuffer.length() + m_inFlightBytes;
+}
+
+void CommRFCOMM::cancelTransfer()
+{
+    Comm::cancelTransfer();
+    m_txBuffer.resize(0); // clear() releases the reserved capacity
+    m_inFlightBytes = 0;
 }
 
 void CommRFCOMM::onStateChanged()
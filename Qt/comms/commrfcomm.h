@@ -12,13 +12,27 @@ public:
     explicit CommRFCOMM(QObject *parent = nullptr);
     void open(const QBluetoothDeviceInfo& deviceInfo) override;
     void close() override;
+    void cancelTransfer() override;
+
+    // the socket buffer is not filled beyond this, the rest waits in m_txBuffer
+    static const int maxInFlightBytes = 512;
+    // write() fails if the backlog is larger than this
+    static const int maxBacklogBytes = 16384;
 protected:
     qint64 write(const QByteArray &data) override;
 private slots:
     void onStateChanged();
     void onErrorOccurred(QBluetoothSocket::SocketError error);
+    void onBytesWritten(qint64 bytes);
+    void flush();
 private:
     QBluetoothSocket* m_socket = nullptr;
+    // framed packets which are not passed to the socket yet
+    QByteArray m_txBuffer;
+    qint64 m_inFlightBytes = 0;
+    bool m_isFlushScheduled = false;
+    // bytes in m_txBuffer and in the socket, a full backlog is logged by write()
+    qint64 txBacklog() const;
     const QBluetoothUuid m_serviceUUID = QBluetoothUuid(QStringLiteral("EDF00000-EDFE-DFED-FEDF-EDFEDFEDFEDF"));
 };
 
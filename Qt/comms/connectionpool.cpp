@@ -0,0 +1,163 @@
+#include "connectionpool.h"
+#include "comm.h"
+
+#include <QDebug>
+#include <QDateTime>
+#include <QTimer>
+
+ConnectionPool::ConnectionPool(QObject *parent)
+    : QObject{parent}
+{
+    m_idleTimer = new QTimer(this);
+    m_idleTimer->setSingleShot(true);
+    connect(m_idleTimer, &QTimer::timeout, this, &ConnectionPool::onIdleTimeout);
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    clear();
+}
+
+void ConnectionPool::setMaxIdle(int count)
+{
+    m_maxIdle = qMax(count, 0);
+    while(m_entries.length() > m_maxIdle)
+        evict(m_entries.length() - 1, "pool shrunk");
+}
+
+void ConnectionPool::setIdleTimeout(int timeoutMs)
+{
+    m_idleTimeoutMs = qMax(timeoutMs, 0);
+    updateIdleTimer();
+}
+
+Comm* ConnectionPool::acquire(const QString& address, bool isBLE, QString* model)
+{
+    for(int i = 0; i < m_entries.length(); i++)
+    {
+        if(m_entries[i].address != address)
+            continue;
+        if(m_entries[i].isBLE != isBLE)
+        {
+            // the caller opens the other transport, don't keep two links to one device
+            evict(i, "transport changed");
+            return nullptr;
+        }
+        const Entry entry = m_entries.takeAt(i);
+        disconnect(entry.comm, nullptr, this, nullptr);
+        if(model != nullptr)
+            *model = entry.model;
+        qDebug() << "pool: reusing" << address;
+        updateIdleTimer();
+        return entry.comm;
+    }
+    return nullptr;
+}
+
+bool ConnectionPool::release(const QString& address, bool isBLE, Comm* comm, const QString& model)
+{
+    if(comm == nullptr || m_maxIdle == 0)
+        return false;
+    // only one session per device
+    for(int i = 0; i < m_entries.length(); i++)
+    {
+        if(m_entries[i].address == address)
+        {
+            evict(i, "replaced");
+            break;
+        }
+    }
+    // an idle session is not worth reconnecting, it is dropped from the pool instead
+    comm->setAutoReconnect(false);
+    Entry entry;
+    entry.address = address;
+    entry.isBLE = isBLE;
+    entry.comm = comm;
+    entry.model = model;
+    entry.releaseTime = QDateTime::currentMSecsSinceEpoch();
+    m_entries.prepend(entry);
+    // Comm lives in the I/O thread, these are queued connections
+    connect(comm, &Comm::stateChanged, this, [ = ](bool connected) {onSessionStateChanged(comm, connected);});
+    connect(comm, &QObject::destroyed, this, [ = ]
+    {
+        for(int i = 0; i < m_entries.length(); i++)
+        {
+            if(m_entries[i].comm == comm)
+            {
+                m_entries.removeAt(i);
+                break;
+            }
+        }
+        updateIdleTimer();
+    });
+    qDebug() << "pool: parked" << address << "idle:" << m_entries.length();
+    while(m_entries.length() > m_maxIdle)
+        evict(m_entries.length() - 1, "least recently used");
+    updateIdleTimer();
+    return true;
+}
+
+int ConnectionPool::idleCount() const
+{
+    return m_entries.length();
+}
+
+void ConnectionPool::clear()
+{
+    while(!m_entries.isEmpty())
+        evict(m_entries.length() - 1, "cleared");
+}
+
+void ConnectionPool::closeSession(Comm* comm)
+{
+    if(comm == nullptr)
+        return;
+    comm->setAutoReconnect(false);
+    // Comm lives in the I/O thread
+    QMetaObject::invokeMethod(comm, "close", Qt::QueuedConnection);
+    comm->deleteLater();
+}
+
+void ConnectionPool::evict(int index, const QString& reason)
+{
+    const Entry entry = m_entries.takeAt(index);
+    qDebug() << "pool: closing" << entry.address << reason;
+    disconnect(entry.comm, nullptr, this, nullptr);
+    closeSession(entry.comm);
+    emit sessionEvicted(entry.address);
+}
+
+void ConnectionPool::updateIdleTimer()
+{
+    if(m_entries.isEmpty())
+    {
+        m_idleTimer->stop();
+        return;
+    }
+    // the least recently used one expires first
+    const qint64 remaining = m_entries.last().releaseTime + m_idleTimeoutMs - QDateTime::currentMSecsSinceEpoch();
+    m_idleTimer->start(qMax<qint64>(remaining, 0));
+}
+
+void ConnectionPool::onIdleTimeout()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    while(!m_entries.isEmpty() && m_entries.last().releaseTime + m_idleTimeoutMs <= now)
+        evict(m_entries.length() - 1, "idle timeout");
+    updateIdleTimer();
+}
+
+void ConnectionPool::onSessionStateChanged(Comm* comm, bool connected)
+{
+    if(connected)
+        return;
+    for(int i = 0; i < m_entries.length(); i++)
+    {
+        if(m_entries[i].comm == comm)
+        {
+            evict(i, "disconnected");
+            break;
+        }
+    }
+    updateIdleTimer();
+}
@@ -0,0 +1,63 @@
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include <QObject>
+#include <QList>
+
+class Comm;
+class QTimer;
+
+// Keeps recently used sessions open, so going back to a device skips connecting and service discovery.
+// The least recently used session is closed when there are more than maxIdle sessions,
+// a session is closed as well if it is idle for idleTimeoutMs.
+// The pool lives in the GUI thread, the Comm objects still live in the I/O thread.
+class ConnectionPool : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ConnectionPool(QObject *parent = nullptr);
+    ~ConnectionPool();
+
+    // 0 disables the pool
+    void setMaxIdle(int count);
+    void setIdleTimeout(int timeoutMs);
+    // takes a live session out of the pool, returns nullptr if there is none
+    // model: the model key saved by release()
+    Comm* acquire(const QString& address, bool isBLE, QString* model = nullptr);
+    // parks a connected session, the pool owns it afterwards
+    // returns false if the pool is disabled, the caller should close it then
+    bool release(const QString& address, bool isBLE, Comm* comm, const QString& model = QString());
+    int idleCount() const;
+    // closes all idle sessions
+    void clear();
+    // closes and deletes a session which is not in the pool
+    static void closeSession(Comm* comm);
+
+    static const int defaultMaxIdle = 3;
+    static const int defaultIdleTimeoutMs = 60000;
+private:
+    struct Entry
+    {
+        QString address;
+        bool isBLE;
+        Comm* comm;
+        QString model;
+        qint64 releaseTime;
+    };
+
+    // the most recently used one first
+    QList<Entry> m_entries;
+    int m_maxIdle = defaultMaxIdle;
+    int m_idleTimeoutMs = defaultIdleTimeoutMs;
+    QTimer* m_idleTimer = nullptr;
+
+    void evict(int index, const QString& reason);
+    void updateIdleTimer();
+private slots:
+    void onIdleTimeout();
+    void onSessionStateChanged(Comm* comm, bool connected);
+signals:
+    void sessionEvicted(const QString& address);
+};
+
+#endif // CONNECTIONPOOL_H
@@ -0,0 +1,89 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <QAtomicPointer>
+
+// Lock-free multi-producer single-consumer queue(intrusive, Vyukov style).
+// enqueue() can be called from any thread,
+// dequeue() must only be called from the consumer thread.
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue()
+    {
+        m_stub.next.storeRelease(nullptr);
+        m_head.storeRelease(&m_stub);
+        m_tail = &m_stub;
+    }
+    ~MpscQueue()
+    {
+        T value;
+        while(dequeue(value))
+            ;
+    }
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void enqueue(const T& value)
+    {
+        Node* node = new Node;
+        node->value = value;
+        push(node);
+    }
+
+    // returns false if the queue is empty
+    // or a producer has not finished linking its node yet
+    bool dequeue(T& value)
+    {
+        Node* tail = m_tail;
+        Node* next = tail->next.loadAcquire();
+        if(tail == &m_stub)
+        {
+            if(next == nullptr)
+                return false;
+            m_tail = next;
+            tail = next;
+            next = next->next.loadAcquire();
+        }
+        if(next != nullptr)
+        {
+            m_tail = next;
+            value = tail->value;
+            delete tail;
+            return true;
+        }
+        if(tail != m_head.loadAcquire())
+            return false;
+        push(&m_stub);
+        next = tail->next.loadAcquire();
+        if(next != nullptr)
+        {
+            m_tail = next;
+            value = tail->value;
+            delete tail;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct Node
+    {
+        QAtomicPointer<Node> next;
+        T value;
+    };
+
+    void push(Node* node)
+    {
+        node->next.storeRelease(nullptr);
+        Node* prev = m_head.fetchAndStoreAcquireRelease(node);
+        prev->next.storeRelease(node);
+    }
+
+    QAtomicPointer<Node> m_head;
+    Node* m_tail;
+    Node m_stub;
+};
+
+#endif // MPSCQUEUE_H
@@ -0,0 +1,645 @@
+#include "controlserver.h"
+#include "comms/comm.h"
+#include "comms/adapterbalancer.h"
+#include "devices/basedevice.h"
+#include "scripting/provisionscript.h"
+#include "scripting/scriptexecutor.h"
+#include "telemetry/tracerecorder.h"
+
+#include <QDebug>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QJsonDocument>
+#include <QSharedPointer>
+#include <QTimer>
+#include <QVector>
+#include <algorithm>
+
+namespace
+{
+// JSON-RPC 2.0 error codes
+const int ParseError = -32700;
+const int InvalidRequest = -32600;
+const int MethodNotFound = -32601;
+const int InvalidParams = -32602;
+const int NotConnected = -32000;
+const int Timeout = -32001;
+const int OperationFailed = -32002;
+
+// the responses of one line, sent together when the last request is replied
+struct Batch
+{
+    QPointer<QLocalSocket> socket;
+    QVector<QJsonValue> responses;
+    bool isArray = false;
+    // starts from 1 so the batch is not sent before all requests are dispatched
+    int remaining = 1;
+};
+}
+
+ControlServer::ControlServer(QObject *parent)
+    : QObject{parent}
+{
+    m_server = new QLocalServer(this);
+    connect(m_server, &QLocalServer::newConnection, this, &ControlServer::onNewConnection);
+
+    m_discoveryTimer = new QTimer(this);
+    m_discoveryTimer->setSingleShot(true);
+    connect(m_discoveryTimer, &QTimer::timeout, this, [ = ]
+    {
+        if(m_discoveryAgent != nullptr && m_discoveryAgent->isActive())
+            m_discoveryAgent->stop();
+        // stop() might not emit canceled() if the agent is in an error state
+        finishDiscovery();
+    });
+}
+
+ControlServer::~ControlServer()
+{
+    m_server->close();
+}
+
+bool ControlServer::listen(const QString& name)
+{
+    m_server->close();
+    // remove the socket file left by a crashed instance
+    QLocalServer::removeServer(name);
+    m_server->setSocketOptions(QLocalServer::UserAccessOption);
+    if(!m_server->listen(name))
+    {
+        qDebug() << "ControlServer: failed to listen on" << name << m_server->errorString();
+        return false;
+    }
+    qDebug() << "ControlServer: listening on" << m_server->fullServerName();
+    return true;
+}
+
+QString ControlServer::fullServerName() const
+{
+    return m_server->fullServerName();
+}
+
+void ControlServer::setSession(Comm* comm, const QString& address)
+{
+    if(m_comm != nullptr)
+        disconnect(m_comm, nullptr, this, nullptr);
+    failReadRequests(tr("Device changed"));
+    m_comm = comm;
+    m_address = address;
+    m_connected = false;
+    if(comm == nullptr)
+        return;
+    connect(comm, &Comm::newData, this, &ControlServer::onNewData);
+    connect(comm, &Comm::requestFailed, this, &ControlServer::onRequestFailed);
+    connect(comm, &Comm::writeVerified, this, &ControlServer::onWriteVerified);
+}
+
+void ControlServer::setDevice(BaseDevice* device)
+{
+    m_device = device;
+}
+
+void ControlServer::setModel(const QString& model)
+{
+    m_model = model;
+}
+
+void ControlServer::setAdapterBalancer(AdapterBalancer* balancer)
+{
+    if(m_adapterBalancer != nullptr)
+        disconnect(m_adapterBalancer, nullptr, this, nullptr);
+    m_adapterBalancer = balancer;
+    if(balancer != nullptr)
+        connect(balancer, &AdapterBalancer::statsChanged, this, [ = ] {notify("adapters", adapterStats());});
+}
+
+QJsonObject ControlServer::adapterStats() const
+{
+    QJsonArray adapters;
+    QJsonObject result;
+    if(m_adapterBalancer != nullptr)
+    {
+        const auto stats = m_adapterBalancer->stats();
+        for(const auto& adapter : stats)
+        {
+            QJsonObject item;
+            item["address"] = adapter.address.toString();
+            item["name"] = adapter.name;
+            item["links"] = adapter.linkCount;
+            item["queueDepth"] = adapter.queueDepth;
+            item["totalSessions"] = double(adapter.totalSessions);
+            adapters.append(item);
+        }
+        result["unbound"] = m_adapterBalancer->unboundSessionCount();
+    }
+    result["adapters"] = adapters;
+    return result;
+}
+
+void ControlServer::onCommStateChanged(bool connected)
+{
+    if(m_connected == connected)
+        return;
+    m_connected = connected;
+    QJsonObject state;
+    state["connected"] = connected;
+    state["address"] = m_address;
+    notify("state", state);
+    if(connected)
+    {
+        const QList<Reply> replies = m_connectReplies;
+        m_connectReplies.clear();
+        QJsonObject result;
+        result["address"] = m_address;
+        for(const auto& reply : replies)
+            reply(result, 0, QString());
+    }
+    else
+        failReadRequests(tr("Disconnected"));
+}
+
+void ControlServer::onNewConnection()
+{
+    while(m_server->hasPendingConnections())
+    {
+        QLocalSocket* socket = m_server->nextPendingConnection();
+        m_clients.insert(socket, Client());
+        connect(socket, &QLocalSocket::readyRead, this, &ControlServer::onReadyRead);
+        connect(socket, &QLocalSocket::disconnected, this, &ControlServer::onClientDisconnected);
+    }
+}
+
+void ControlServer::onClientDisconnected()
+{
+    auto socket = qobject_cast<QLocalSocket*>(sender());
+    if(socket == nullptr)
+        return;
+    m_clients.remove(socket);
+    // pending replies hold a QPointer to the socket
+    socket->deleteLater();
+}
+
+void ControlServer::onReadyRead()
+{
+    auto socket = qobject_cast<QLocalSocket*>(sender());
+    if(socket == nullptr || !m_clients.contains(socket))
+        return;
+    m_clients[socket].rxBuffer += socket->readAll();
+    while(true)
+    {
+        // the client might be removed while processing the previous line
+        auto it = m_clients.find(socket);
+        if(it == m_clients.end())
+            return;
+        QByteArray& buffer = it->rxBuffer;
+        const int end = buffer.indexOf('\n');
+        if(end < 0)
+        {
+            if(buffer.size() > maxLineLength)
+            {
+                qDebug() << "ControlServer: line too long, disconnecting the client";
+                buffer.clear();
+                socket->abort();
+            }
+            return;
+        }
+        const QByteArray line = buffer.left(end).trimmed();
+        buffer.remove(0, end + 1);
+        if(!line.isEmpty())
+            processLine(socket, line);
+    }
+}
+
+void ControlServer::processLine(QLocalSocket* socket, const QByteArray& line)
+{
+    QJsonParseError parseError;
+    const QJsonDocument doc = QJsonDocument::fromJson(line, &parseError);
+    QJsonArray requests;
+    auto batch = QSharedPointer<Batch>::create();
+    batch->socket = socket;
+    if(parseError.error != QJsonParseError::NoError)
+    {
+        QJsonObject error;
+        error["code"] = ParseError;
+        error["message"] = parseError.errorString();
+        QJsonObject response;
+        response["jsonrpc"] = "2.0";
+        response["id"] = QJsonValue::Null;
+        response["error"] = error;
+        write(socket, response);
+        return;
+    }
+    if(doc.isArray())
+    {
+        requests = doc.array();
+        batch->isArray = !requests.isEmpty();
+        if(requests.isEmpty())
+            requests.append(QJsonValue()); // replied with a single Invalid Request
+    }
+    else
+        requests.append(doc.object());
+    batch->responses.fill(QJsonValue(QJsonValue::Undefined), requests.size());
+
+    auto sendBatch = [ = ]
+    {
+        if(batch->socket == nullptr)
+            return;
+        QJsonArray responses;
+        for(const auto& response : qAsConst(batch->responses))
+        {
+            if(!response.isUndefined())
+                responses.append(response);
+        }
+        // nothing is sent if there are only notifications
+        if(responses.isEmpty())
+            return;
+        write(batch->socket, batch->isArray ? QJsonValue(responses) : responses.first());
+    };
+
+    for(int i = 0; i < requests.size(); i++)
+    {
+        const QJsonObject request = requests[i].toObject();
+        // a request without "id" is a notification
+        // invalid requests are replied with "id": null
+        const bool isValid = request.value("jsonrpc").toString() == "2.0" && request.value("method").isString();
+        const bool hasId = request.contains("id") || !isValid;
+        const QJsonValue id = request.contains("id") ? request.value("id") : QJsonValue(QJsonValue::Null);
+        if(hasId)
+            batch->remaining++;
+        auto isReplied = QSharedPointer<bool>::create(false);
+        Reply reply = [ = ](const QJsonValue & result, int errorCode, const QString & errorMessage)
+        {
+            if(*isReplied)
+                return;
+            *isReplied = true;
+            if(!hasId)
+                return;
+            QJsonObject response;
+            response["jsonrpc"] = "2.0";
+            response["id"] = id;
+            if(errorCode == 0)
+                response["result"] = result.isUndefined() ? QJsonValue(QJsonValue::Null) : result;
+            else
+            {
+                QJsonObject error;
+                error["code"] = errorCode;
+                error["message"] = errorMessage;
+                if(!result.isUndefined() && !result.isNull())
+                    error["data"] = result;
+                response["error"] = error;
+            }
+            batch->responses[i] = response;
+            if(--batch->remaining == 0)
+                sendBatch();
+        };
+        if(!isValid)
+            reply(QJsonValue(), InvalidRequest, "Invalid Request");
+        else
+            handleRequest(socket, request, reply);
+    }
+    if(--batch->remaining == 0)
+        sendBatch();
+}
+
+void ControlServer::handleRequest(QLocalSocket* socket, const QJsonObject& request, const Reply& reply)
+{
+    const QString method = request["method"].toString();
+    const QJsonObject params = request["params"].toObject();
+    // only the synchronous part, the commands have their own spans
+    TraceSpan span("rpc", method);
+
+    if(method == "status")
+    {
+        QJsonObject result;
+        result["connected"] = m_connected;
+        result["address"] = m_address;
+        result["model"] = m_model;
+        reply(result, 0, QString());
+    }
+    else if(method == "adapters")
+        reply(adapterStats(), 0, QString());
+    else if(method == "discover")
+        handleDiscover(params, reply);
+    else if(method == "connect")
+        handleConnect(params, reply);
+    else if(method == "disconnect")
+    {
+        emit disconnectDevice();
+        reply(true, 0, QString());
+    }
+    else if(method == "send")
+    {
+        if(!m_connected || m_comm == nullptr)
+        {
+            reply(QJsonValue(), NotConnected, tr("Device not connected"));
+            return;
+        }
+        const QByteArray cmd = QByteArray::fromHex(params["cmd"].toString().toLatin1());
+        if(cmd.isEmpty())
+        {
+            reply(QJsonValue(), InvalidParams, "Invalid params");
+            return;
+        }
+        // Comm::sendCommand() is thread-safe
+        if(params.contains("priority"))
+            m_comm->scheduleCommand(cmd, params["priority"].toInt(), params["raw"].toBool(false));
+        else
+            m_comm->sendCommand(cmd, params["raw"].toBool(false));
+        reply(true, 0, QString());
+    }
+    else if(method == "read")
+        handleRead(params, reply);
+    else if(method == "readSettings")
+    {
+        if(!m_connected || m_device == nullptr)
+        {
+            reply(QJsonValue(), NotConnected, tr("Device not connected"));
+            return;
+        }
+        m_device->readSettings();
+        reply(true, 0, QString());
+    }
+    else if(method == "applyProfile")
+    {
+        if(!m_connected || m_device == nullptr)
+        {
+            reply(QJsonValue(), NotConnected, tr("Device not connected"));
+            return;
+        }
+        QString errorString;
+        if(m_device->applyProfile(params["path"].toString(), &errorString))
+            reply(true, 0, QString());
+        else
+            reply(QJsonValue(), OperationFailed, errorString);
+    }
+    else if(method == "subscribe" || method == "unsubscribe")
+    {
+        static const QStringList validEvents = {"state", "data", "notification", "discovery", "requestFailed", "writeVerified", "adapters"};
+        auto it = m_clients.find(socket);
+        if(it == m_clients.end())
+            return;
+        const QJsonArray events = params["events"].toArray();
+        for(const auto& event : events)
+        {
+            if(!validEvents.contains(event.toString()))
+            {
+                reply(QJsonValue(), InvalidParams, "Unknown event: " + event.toString());
+                return;
+            }
+        }
+        for(const auto& event : events)
+        {
+            if(method == "subscribe")
+                it->events.insert(event.toString());
+            else
+                it->events.remove(event.toString());
+        }
+        reply(QJsonArray::fromStringList(it->events.values()), 0, QString());
+    }
+    else
+        reply(QJsonValue(), MethodNotFound, "Method not found");
+}
+
+void ControlServer::handleDiscover(const QJsonObject& params, const Reply& reply)
+{
+    m_discoveryReplies.append(reply);
+    // join the running scan
+    if(m_discoveryAgent != nullptr && m_discoveryAgent->isActive())
+        return;
+    if(m_discoveryAgent == nullptr)
+    {
+        m_discoveryAgent = new QBluetoothDeviceDiscoveryAgent(this);
+        connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::deviceDiscovered, this, &ControlServer::onDeviceDiscovered);
+        connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::finished, this, &ControlServer::finishDiscovery);
+        connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::canceled, this, &ControlServer::finishDiscovery);
+    }
+    const bool isBLE = params["ble"].toBool(false);
+    const int timeout = params["timeoutMs"].toInt(defaultDiscoveryTimeoutMs);
+    m_discoveryResults = QJsonObject();
+    if(isBLE)
+        m_discoveryAgent->setLowEnergyDiscoveryTimeout(timeout);
+    m_discoveryAgent->start(isBLE ?
+                            QBluetoothDeviceDiscoveryAgent::LowEnergyMethod :
+                            QBluetoothDeviceDiscoveryAgent::ClassicMethod);
+    // the classic discovery has no timeout
+    m_discoveryTimer->start(timeout + 1000);
+}
+
+void ControlServer::onDeviceDiscovered(const QBluetoothDeviceInfo& info)
+{
+    const QString address = info.address().toString();
+    m_discovered[address] = info;
+    const QJsonObject device = deviceInfo2Json(info);
+    m_discoveryResults[address] = device;
+    notify("discovery", device);
+}
+
+void ControlServer::finishDiscovery()
+{
+    m_discoveryTimer->stop();
+    // the nearest first, the devices without RSSI last
+    QList<QJsonObject> sorted;
+    for(const auto& device : qAsConst(m_discoveryResults))
+        sorted.append(device.toObject());
+    std::stable_sort(sorted.begin(), sorted.end(), [](const QJsonObject & lhs, const QJsonObject & rhs)
+    {
+        const int lhsRssi = lhs["rssi"].toInt();
+        const int rhsRssi = rhs["rssi"].toInt();
+        if(lhsRssi == 0 || rhsRssi == 0)
+            return lhsRssi != 0 && rhsRssi == 0;
+        return lhsRssi > rhsRssi;
+    });
+    QJsonArray devices;
+    for(const auto& device : qAsConst(sorted))
+        devices.append(device);
+    const QList<Reply> replies = m_discoveryReplies;
+    m_discoveryReplies.clear();
+    for(const auto& reply : replies)
+        reply(devices, 0, QString());
+}
+
+void ControlServer::handleConnect(const QJsonObject& params, const Reply& reply)
+{
+    const QString address = params["address"].toString().toUpper();
+    const QBluetoothAddress bluetoothAddress(address);
+    if(bluetoothAddress.isNull())
+    {
+        reply(QJsonValue(), InvalidParams, "Invalid address");
+        return;
+    }
+    const bool isBLE = params["ble"].toBool(false);
+    if(m_connected && m_address == bluetoothAddress.toString())
+    {
+        QJsonObject result;
+        result["address"] = m_address;
+        reply(result, 0, QString());
+        return;
+    }
+    // use the discovered info if possible, the name is used to match RFCOMM devices
+    QBluetoothDeviceInfo info = m_discovered.value(bluetoothAddress.toString());
+    if(!info.isValid())
+    {
+        info = QBluetoothDeviceInfo(bluetoothAddress, params["name"].toString(), 0);
+        if(isBLE)
+            info.setCoreConfigurations(QBluetoothDeviceInfo::LowEnergyCoreConfiguration);
+    }
+    m_connectReplies.append(reply);
+    QTimer::singleShot(connectTimeoutMs, this, [ = ] {reply(QJsonValue(), Timeout, tr("Timeout"));});
+    emit connectTo(info, isBLE);
+}
+
+void ControlServer::handleRead(const QJsonObject& params, const Reply& reply)
+{
+    if(!m_connected || m_comm == nullptr)
+    {
+        reply(QJsonValue(), NotConnected, tr("Device not connected"));
+        return;
+    }
+    ReadRequest request;
+    request.reply = reply;
+    QList<QByteArray> commands;
+    const QJsonArray fields = params["fields"].toArray();
+    for(const auto& field : fields)
+    {
+        const QString name = field.toString().toLower();
+        const QByteArray cmd = ProvisionScript::queryCommand(name);
+        if(cmd.isEmpty())
+        {
+            reply(QJsonValue(), InvalidParams, "Unknown field: " + field.toString());
+            return;
+        }
+        request.remaining.append(name);
+        // noise and ambientvolume share one query
+        if(!commands.contains(cmd))
+            commands.append(cmd);
+    }
+    if(request.remaining.isEmpty())
+    {
+        reply(QJsonObject(), 0, QString());
+        return;
+    }
+    const quint32 id = m_nextReadId++;
+    m_readRequests.insert(id, request);
+    for(const auto& cmd : commands)
+        m_comm->sendCommand(cmd);
+    QTimer::singleShot(params["timeoutMs"].toInt(defaultReadTimeoutMs), this, [ = ]
+    {
+        auto it = m_readRequests.find(id);
+        if(it == m_readRequests.end())
+            return;
+        const ReadRequest timedOut = it.value();
+        m_readRequests.erase(it);
+        timedOut.reply(timedOut.values, Timeout, tr("Timeout") + ": " + timedOut.remaining.join(", "));
+    });
+}
+
+void ControlServer::failReadRequests(const QString& reason)
+{
+    const auto requests = m_readRequests;
+    m_readRequests.clear();
+    for(const auto& request : requests)
+        request.reply(request.values, OperationFailed, reason);
+}
+
+void ControlServer::onNewData(const QByteArray& data, bool isReply)
+{
+    protocol::Decoded decoded;
+    QJsonObject fields;
+    if(protocol::decode(Comm::asSpan(data), decoded))
+    {
+        const auto values = ScriptExecutor::fieldValues(decoded);
+        for(const auto& value : values)
+            fields[value.first] = value.second;
+    }
+
+    QJsonObject params;
+    params["address"] = m_address;
+    params["raw"] = QString(data.toHex().toUpper());
+    params["fields"] = fields;
+    params["reply"] = isReply;
+    notify("data", params);
+    // unsolicited changes, so clients don't have to poll
+    // the acks of our own writes(CC02D101, CC02C4xx...) are not
+    if(decoded.isNotification && !isReply)
+        notify("notification", params);
+
+    if(fields.isEmpty())
+        return;
+    for(auto it = m_readRequests.begin(); it != m_readRequests.end();)
+    {
+        for(auto field = fields.constBegin(); field != fields.constEnd(); ++field)
+        {
+            if(it->remaining.removeAll(field.key()) > 0)
+                it->values[field.key()] = field.value();
+        }
+        if(it->remaining.isEmpty())
+        {
+            it->reply(it->values, 0, QString());
+            it = m_readRequests.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+void ControlServer::onRequestFailed(const QByteArray& cmd, const QString& reason)
+{
+    QJsonObject params;
+    params["address"] = m_address;
+    params["cmd"] = QString(cmd.toHex().toUpper());
+    params["reason"] = reason;
+    notify("requestFailed", params);
+}
+
+void ControlServer::onWriteVerified(const QByteArray& cmd, int echoStatus)
+{
+    QJsonObject params;
+    params["address"] = m_address;
+    params["cmd"] = QString(cmd.toHex().toUpper());
+    switch(static_cast<protocol::EchoStatus>(echoStatus))
+    {
+    case protocol::EchoStatus::Confirmed:
+        params["status"] = "confirmed";
+        break;
+    case protocol::EchoStatus::Acknowledged:
+        params["status"] = "acknowledged";
+        break;
+    default:
+        params["status"] = "mismatched";
+        break;
+    }
+    notify("writeVerified", params);
+}
+
+void ControlServer::notify(const QString& event, const QJsonObject& params)
+{
+    QJsonObject notification;
+    notification["jsonrpc"] = "2.0";
+    notification["method"] = event;
+    notification["params"] = params;
+    // a client might be removed while writing
+    QList<QLocalSocket*> subscribers;
+    for(auto it = m_clients.cbegin(); it != m_clients.cend(); ++it)
+    {
+        if(it->events.contains(event))
+            subscribers.append(it.key());
+    }
+    for(auto socket : qAsConst(subscribers))
+        write(socket, notification);
+}
+
+void ControlServer::write(QLocalSocket* socket, const QJsonValue& message)
+{
+    const QJsonDocument doc = message.isArray() ? QJsonDocument(message.toArray()) : QJsonDocument(message.toObject());
+    socket->write(doc.toJson(QJsonDocument::Compact) + '\n');
+}
+
+QJsonObject ControlServer::deviceInfo2Json(const QBluetoothDeviceInfo& info)
+{
+    QJsonObject device;
+    device["address"] = info.address().toString();
+    device["name"] = info.name();
+    device["rssi"] = info.rssi();
+    device["ble"] = bool(info.coreConfigurations() & QBluetoothDeviceInfo::LowEnergyCoreConfiguration);
+    return device;
+}
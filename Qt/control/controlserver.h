@@ -0,0 +1,124 @@
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QPointer>
+#include <QBluetoothDeviceInfo>
+#include <QBluetoothDeviceDiscoveryAgent>
+#include <functional>
+
+class QLocalServer;
+class QLocalSocket;
+class QTimer;
+class Comm;
+class BaseDevice;
+class AdapterBalancer;
+
+// JSON-RPC 2.0 over a local socket(a Unix domain socket on Linux/macOS, a named pipe on Windows)
+// Each message is one line of JSON, a JSON array is a batch request.
+//
+// Methods:
+// status                                        -> {connected, address, model}
+// discover {ble, timeoutMs}                     -> [{address, name, rssi, ble}], the nearest first
+// connect {address, ble}                        -> {address}, replied when the device is connected
+// disconnect
+// send {cmd, raw, priority}                     cmd: hex string without head and checksum, priority: Comm::Priority
+// read {fields: [...], timeoutMs}               -> {field: value}, field names are the same as provisioning scripts
+// readSettings                                  the values are pushed as "data" notifications
+// adapters                                      -> {adapters: [{address, name, links, queueDepth, totalSessions}], unbound}
+//                                               the load of the local adapters, unbound: the RFCOMM sessions
+// applyProfile {path}                           a file created by "Save to File"
+// subscribe/unsubscribe {events: [...]}         events: state, data({address, raw, fields, reply}), notification(0xCC frames which
+//                                               didn't answer a request of this app), discovery, requestFailed,
+//                                               writeVerified({cmd, status}, status: confirmed, acknowledged or mismatched),
+//                                               adapters(the result of "adapters", whenever the links or the queue depths change)
+//
+// Notifications are sent as {"jsonrpc": "2.0", "method": <event>, "params": {...}}
+class ControlServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ControlServer(QObject *parent = nullptr);
+    ~ControlServer();
+
+    // name: a socket name(created in the temporary directory) or an absolute path
+    bool listen(const QString& name);
+    QString fullServerName() const;
+    // the current session, comm can be nullptr
+    void setSession(Comm* comm, const QString& address);
+    void setDevice(BaseDevice* device);
+    void setModel(const QString& model);
+    void setAdapterBalancer(AdapterBalancer* balancer);
+
+    static const int defaultDiscoveryTimeoutMs = 10000;
+    static const int connectTimeoutMs = 20000;
+    static const int defaultReadTimeoutMs = 3000;
+    // a client sending a longer line is disconnected
+    static const int maxLineLength = 1024 * 1024;
+public slots:
+    void onCommStateChanged(bool connected);
+private:
+    // replies to one request, calling it more than once has no effect
+    using Reply = std::function<void(const QJsonValue& result, int errorCode, const QString& errorMessage)>;
+
+    struct Client
+    {
+        QByteArray rxBuffer;
+        QSet<QString> events;
+    };
+
+    struct ReadRequest
+    {
+        QStringList remaining;
+        QJsonObject values;
+        Reply reply;
+    };
+
+    QLocalServer* m_server = nullptr;
+    QHash<QLocalSocket*, Client> m_clients;
+    QPointer<Comm> m_comm;
+    QString m_address;
+    QString m_model;
+    QPointer<BaseDevice> m_device;
+    AdapterBalancer* m_adapterBalancer = nullptr;
+    bool m_connected = false;
+
+    QBluetoothDeviceDiscoveryAgent* m_discoveryAgent = nullptr;
+    QHash<QString, QBluetoothDeviceInfo> m_discovered;
+    QList<Reply> m_discoveryReplies;
+    // address -> device, the devices found in the current scan
+    QJsonObject m_discoveryResults;
+    QTimer* m_discoveryTimer = nullptr;
+    QList<Reply> m_connectReplies;
+    QHash<quint32, ReadRequest> m_readRequests;
+    quint32 m_nextReadId = 0;
+
+    void processLine(QLocalSocket* socket, const QByteArray& line);
+    void handleRequest(QLocalSocket* socket, const QJsonObject& request, const Reply& reply);
+    void handleDiscover(const QJsonObject& params, const Reply& reply);
+    void handleConnect(const QJsonObject& params, const Reply& reply);
+    void handleRead(const QJsonObject& params, const Reply& reply);
+    void finishDiscovery();
+    void failReadRequests(const QString& reason);
+    void notify(const QString& event, const QJsonObject& params);
+    QJsonObject adapterStats() const;
+    void write(QLocalSocket* socket, const QJsonValue& message);
+    static QJsonObject deviceInfo2Json(const QBluetoothDeviceInfo& info);
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onClientDisconnected();
+    void onNewData(const QByteArray& data, bool isReply);
+    void onRequestFailed(const QByteArray& cmd, const QString& reason);
+    void onWriteVerified(const QByteArray& cmd, int echoStatus);
+    void onDeviceDiscovered(const QBluetoothDeviceInfo& info);
+signals:
+    void connectTo(const QBluetoothDeviceInfo& address, bool isBLE);
+    void disconnectDevice();
+};
+
+#endif // CONTROLSERVER_H
@@ -16,6 +16,11 @@ DevForm::~DevForm()
     delete ui;
 }
 
+void DevForm::setTraceEnabled(bool enabled)
+{
+    ui->traceBox->setChecked(enabled);
+}
+
 void DevForm::on_copyLogButton_clicked()
 {
     QTextCursor cursor = ui->logEdit->textCursor();
@@ -25,38 +30,30 @@ void DevForm::on_copyLogButton_clicked()
     emit showMessage(tr("Copied"));
 }
 
-void DevForm::handleDevMessage(QtMsgType type, const QMessageLogContext& context, const QString& msg)
+void DevForm::handleDevMessage(const QString& type, const QString& msg)
 {
-    QString file = context.file ? context.file : "";
-    QString function = context.function ? context.function : "";
-    QString extraInfo;
-    if(file.isEmpty() || function.isEmpty())
-        extraInfo = QString(" (%1:%2, %3)").arg(file).arg(context.line).arg(function);
+    if(m_isLogVerbose)
+        ui->logEdit->appendPlainText(QString("[%1]%2: %3").arg(QDateTime::currentDateTime().toString(Qt::ISODate), type, msg));
+    else
+        ui->logEdit->appendPlainText(msg);
+}
 
-    QString typeStr;
+QString DevForm::typeName(QtMsgType type)
+{
     switch(type)
     {
     case QtDebugMsg:
-        typeStr = "Debug";
-        break;
+        return "Debug";
     case QtInfoMsg:
-        typeStr = "Info";
-        break;
+        return "Info";
     case QtWarningMsg:
-        typeStr = "Warning";
-        break;
+        return "Warning";
     case QtCriticalMsg:
-        typeStr = "Critical";
-        break;
+        return "Critical";
     case QtFatalMsg:
-        typeStr = "Fatal";
-        break;
+        return "Fatal";
     }
-
-    if(m_isLogVerbose)
-        ui->logEdit->appendPlainText(QString("[%1]%2: %3%4").arg(QDateTime::currentDateTime().toString(Qt::ISODate), typeStr, msg, extraInfo));
-    else
-        ui->logEdit->appendPlainText(QString("%1%2").arg(msg, extraInfo));
+    return QString();
 }
 
 void DevForm::on_verboseLogBox_clicked()
@@ -64,3 +61,17 @@ void DevForm::on_verboseLogBox_clicked()
     m_isLogVerbose = ui->verboseLogBox->isChecked();
 }
 
+void DevForm::on_exportTelemetryButton_clicked()
+{
+    emit exportTelemetry();
+}
+
+void DevForm::on_traceBox_clicked()
+{
+    emit traceEnabledChanged(ui->traceBox->isChecked());
+}
+
+void DevForm::on_exportTraceButton_clicked()
+{
+    emit exportTrace();
+}
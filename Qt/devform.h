@@ -15,15 +15,26 @@ class DevForm : public QWidget
 public:
     explicit DevForm(QWidget *parent = nullptr);
     ~DevForm();
+    // updates the checkbox only
+    void setTraceEnabled(bool enabled);
+    static QString typeName(QtMsgType type);
 
 public slots:
-    void handleDevMessage(QtMsgType type, const QMessageLogContext &context, const QString &msg);
+    // type: see typeName(), msg: with the source location if any
+    // the messages come from every thread, so only copyable types are passed
+    void handleDevMessage(const QString &type, const QString &msg);
 
 private slots:
     void on_copyLogButton_clicked();
 
     void on_verboseLogBox_clicked();
 
+    void on_exportTelemetryButton_clicked();
+
+    void on_traceBox_clicked();
+
+    void on_exportTraceButton_clicked();
+
 private:
     Ui::DevForm *ui;
 
@@ -31,6 +42,9 @@ private:
 
 signals:
     void showMessage(const QString& msg);
+    void exportTelemetry();
+    void traceEnabledChanged(bool enabled);
+    void exportTrace();
 };
 
 #endif // DEVFORM_H
@@ -1,10 +1,14 @@
 #include "deviceform.h"
 #include "ui_deviceform.h"
 #include "comms/comm.h"
+#include "comms/adaptermanager.h"
 
 #include <QDebug>
+#include <QDateTime>
+#include <QTimer>
 #include <QBluetoothUuid>
 #include <QBluetoothLocalDevice>
+#include <algorithm>
 #ifdef Q_OS_ANDROID
 #include <QtAndroid>
 #include <QAndroidJniEnvironment>
@@ -32,6 +36,18 @@ DeviceForm::DeviceForm(QWidget *parent) :
     m_discoveryAgent = new QBluetoothDeviceDiscoveryAgent();
     connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::deviceDiscovered, this, &DeviceForm::onDeviceDiscovered);
     connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::finished, this, &DeviceForm::onDiscoverFinished);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    // BLE scans report the new RSSI of the discovered devices there
+    connect(m_discoveryAgent, &QBluetoothDeviceDiscoveryAgent::deviceUpdated, this, [ = ](const QBluetoothDeviceInfo & info, QBluetoothDeviceInfo::Fields fields)
+    {
+        if(fields.testFlag(QBluetoothDeviceInfo::Field::RSSI))
+            updateDevice(info);
+    });
+#endif
+
+    m_refreshTimer = new QTimer(this);
+    m_refreshTimer->setInterval(refreshIntervalMs);
+    connect(m_refreshTimer, &QTimer::timeout, this, &DeviceForm::onRefreshTimeout);
 #ifdef Q_OS_WIN
     m_winBTThread = new QThread();
     m_winBTHelper = new WinBTHelper();
@@ -53,6 +69,8 @@ void DeviceForm::onSearchButtonClicked()
 #ifdef Q_OS_ANDROID
     getRequiredPermission();
 #endif
+    // a new search picks up the adapters plugged in since the last one
+    AdapterManager::instance()->refresh();
     if(Comm::getLocalAddress().isNull())
     {
         emit showMessage(tr("Bluetooth is not available"));
@@ -69,9 +87,16 @@ void DeviceForm::onSearchButtonClicked()
     }
     ui->deviceTableWidget->setRowCount(0);
     m_shownDevices.clear();
+    m_isScanPaused = false;
 #ifdef Q_OS_ANDROID
     getBondedTarget(m_isCurrDiscoveryMethodBLE);
 #endif
+    startScan();
+}
+
+void DeviceForm::startScan()
+{
+    m_isScanning = true;
 #ifdef Q_OS_WIN
     if(m_isCurrDiscoveryMethodBLE)
         m_discoveryAgent->start(QBluetoothDeviceDiscoveryAgent::LowEnergyMethod);
@@ -85,39 +110,42 @@ void DeviceForm::onSearchButtonClicked()
     ui->searchRFCOMMButton->setVisible(false);
     ui->searchBLEButton->setVisible(false);
     ui->searchStopButton->setVisible(true);
+    m_refreshTimer->start();
+}
 
+void DeviceForm::stopScan()
+{
+    m_isScanning = false;
+    m_discoveryAgent->stop();
+    onDiscoverFinished();
 }
 
 void DeviceForm::onDeviceDiscovered(const QBluetoothDeviceInfo &info)
 {
-    QString address = info.address().toString();
-    QString uuid = info.deviceUuid().toString(QUuid::StringFormat::WithoutBraces);
-    QString name = info.name();
-    for(QBluetoothDeviceInfo shownDevice : m_shownDevices){
-        if(shownDevice.deviceUuid() == info.deviceUuid()){
-            qDebug() << "dumplicate:" << address << uuid <<name;
+    const QString key = deviceKey(info);
+    for(const auto& shownDevice : qAsConst(m_shownDevices))
+    {
+        if(deviceKey(shownDevice.info) == key)
+        {
+            updateDevice(info);
             return;
         }
     }
+    ShownDevice device;
+    device.info = info;
+    device.isBLE = m_isCurrDiscoveryMethodBLE;
+    device.rssi = info.rssi();
+    device.lastSeen = QDateTime::currentMSecsSinceEpoch();
+    m_shownDevices.append(device);
+    // the first devices are shown at once, the order is fixed in the next refresh
     QTableWidget* deviceTable = ui->deviceTableWidget;
-    int i;
-
-    i = deviceTable->rowCount();
+    const int i = deviceTable->rowCount();
     deviceTable->setRowCount(i + 1);
-    deviceTable->setItem(i, 0, new QTableWidgetItem(name));
-    deviceTable->setItem(i, 1, new QTableWidgetItem(address));
-    QTableWidgetItem* typeItem = new QTableWidgetItem();
+    setRow(i, device);
+    m_isTableDirty = true;
 
-    if(m_isCurrDiscoveryMethodBLE)
-        typeItem->setText(tr("BLE"));
-    else
-        typeItem->setText(tr("RFCOMM"));
-    typeItem->setData(Qt::UserRole, m_isCurrDiscoveryMethodBLE);
-    deviceTable->setItem(i, 2, typeItem);
-    m_shownDevices.append(info);
-
-    qDebug() << name
-             << address
+    qDebug() << info.name()
+             << info.address().toString()
              << info.isValid()
              << info.rssi()
              << info.majorDeviceClass()
@@ -132,8 +160,126 @@ void DeviceForm::onDeviceDiscovered(const QBluetoothDeviceInfo &info)
 #endif
 }
 
+void DeviceForm::updateDevice(const QBluetoothDeviceInfo &info)
+{
+    const QString key = deviceKey(info);
+    for(auto& shownDevice : m_shownDevices)
+    {
+        if(deviceKey(shownDevice.info) != key)
+            continue;
+        shownDevice.lastSeen = QDateTime::currentMSecsSinceEpoch();
+        // 0 means the RSSI is not reported, like in some classic inquiries
+        const double rssi = info.rssi();
+        if(rssi != 0)
+            shownDevice.rssi = shownDevice.rssi == 0 ? rssi : shownDevice.rssi + m_rssiSmoothing * (rssi - shownDevice.rssi);
+        if(!info.name().isEmpty())
+            shownDevice.info = info;
+        m_isTableDirty = true;
+        return;
+    }
+}
+
+void DeviceForm::onRefreshTimeout()
+{
+    if(m_isScanning && m_isContinuous)
+    {
+        const qint64 now = QDateTime::currentMSecsSinceEpoch();
+        for(int i = m_shownDevices.length() - 1; i >= 0; i--)
+        {
+            if(!m_shownDevices[i].isBonded && now - m_shownDevices[i].lastSeen > m_ageOutMs)
+            {
+                qDebug() << "lost:" << deviceKey(m_shownDevices[i].info) << m_shownDevices[i].info.name();
+                m_shownDevices.removeAt(i);
+                m_isTableDirty = true;
+            }
+        }
+    }
+    if(m_isTableDirty)
+        refreshTable();
+}
+
+void DeviceForm::refreshTable()
+{
+    m_isTableDirty = false;
+    // the aged-out devices might be removed already, so the key is taken from the row
+    QString selectedKey;
+    const QModelIndexList selectedRows = ui->deviceTableWidget->selectionModel()->selectedRows();
+    if(!selectedRows.isEmpty())
+        selectedKey = ui->deviceTableWidget->item(selectedRows.first().row(), 0)->data(Qt::UserRole).toString();
+
+    // the nearest first, the devices without RSSI last
+    std::stable_sort(m_shownDevices.begin(), m_shownDevices.end(), [](const ShownDevice & lhs, const ShownDevice & rhs)
+    {
+        if(lhs.rssi == 0 || rhs.rssi == 0)
+            return lhs.rssi != 0 && rhs.rssi == 0;
+        return lhs.rssi > rhs.rssi;
+    });
+
+    QTableWidget* deviceTable = ui->deviceTableWidget;
+    deviceTable->clearSelection();
+    deviceTable->setRowCount(m_shownDevices.length());
+    for(int i = 0; i < m_shownDevices.length(); i++)
+    {
+        const ShownDevice& device = m_shownDevices[i];
+        setRow(i, device);
+        if(!selectedKey.isEmpty() && deviceKey(device.info) == selectedKey)
+            deviceTable->selectRow(i);
+    }
+}
+
+void DeviceForm::setRow(int row, const ShownDevice& device)
+{
+    QTableWidget* deviceTable = ui->deviceTableWidget;
+    QTableWidgetItem* nameItem = new QTableWidgetItem(device.info.name());
+    nameItem->setData(Qt::UserRole, deviceKey(device.info));
+    deviceTable->setItem(row, 0, nameItem);
+    deviceTable->setItem(row, 1, new QTableWidgetItem(device.info.address().toString()));
+    QTableWidgetItem* typeItem = new QTableWidgetItem(device.isBLE ? tr("BLE") : tr("RFCOMM"));
+    typeItem->setData(Qt::UserRole, device.isBLE);
+    deviceTable->setItem(row, 2, typeItem);
+    deviceTable->setItem(row, 3, new QTableWidgetItem(device.rssi == 0 ? QString() : QString::number(qRound(device.rssi))));
+}
+
+int DeviceForm::selectedIndex() const
+{
+    const QModelIndexList selectedRows = ui->deviceTableWidget->selectionModel()->selectedRows();
+    if(selectedRows.isEmpty())
+        return -1;
+    const QString key = ui->deviceTableWidget->item(selectedRows.first().row(), 0)->data(Qt::UserRole).toString();
+    for(int i = 0; i < m_shownDevices.length(); i++)
+    {
+        if(deviceKey(m_shownDevices[i].info) == key)
+            return i;
+    }
+    return -1;
+}
+
+QString DeviceForm::deviceKey(const QBluetoothDeviceInfo &info)
+{
+    if(info.address().isNull())
+        return info.deviceUuid().toString();
+    return info.address().toString();
+}
+
+QList<QPair<QBluetoothDeviceInfo, bool>> DeviceForm::shownDevices() const
+{
+    QList<QPair<QBluetoothDeviceInfo, bool>> devices;
+    for(const auto& device : m_shownDevices)
+        devices.append({device.info, device.isBLE});
+    return devices;
+}
+
 void DeviceForm::onDiscoverFinished()
 {
+    // a scan ends after a while, the next one continues with the same devices
+    if(m_isScanning && m_isContinuous)
+    {
+        startScan();
+        return;
+    }
+    m_isScanning = false;
+    m_refreshTimer->stop();
+    refreshTable();
     ui->searchRFCOMMButton->setVisible(true);
     ui->searchBLEButton->setVisible(true);
     ui->searchStopButton->setVisible(false);
@@ -151,6 +297,17 @@ void DeviceForm::onCommStateChanged(bool connected)
 {
     ui->connectButton->setVisible(!connected);
     ui->disconnectButton->setVisible(connected);
+    // scanning slows down the connection, so the continuous scan is paused until disconnected
+    if(connected && m_isScanning && m_isContinuous)
+    {
+        m_isScanPaused = true;
+        stopScan();
+    }
+    else if(!connected && m_isScanPaused)
+    {
+        m_isScanPaused = false;
+        startScan();
+    }
 }
 
 void DeviceForm::showEvent(QShowEvent *event)
@@ -169,13 +326,12 @@ void DeviceForm::showEvent(QShowEvent *event)
 void DeviceForm::on_connectButton_clicked()
 {
     QString addressStr = ui->deviceAddressEdit->text();
-    QModelIndexList selectedRows = ui->deviceTableWidget->selectionModel()->selectedRows();
-    if(selectedRows.size() == 0){
+    int selectedItem = selectedIndex();
+    if(selectedItem < 0){
         emit showMessage(tr("No valid device selected"));
         return;
     }
-    int selectedItem = selectedRows.first().row();
-    QBluetoothDeviceInfo selectedDevice = m_shownDevices[selectedItem];
+    QBluetoothDeviceInfo selectedDevice = m_shownDevices[selectedItem].info;
     qDebug() << selectedItem;
     bool isBLE = ui->deviceTypeBox->currentData().toBool();
     emit connectTo(selectedDevice, isBLE);
@@ -192,13 +348,33 @@ void DeviceForm::on_disconnectButton_clicked()
 
 void DeviceForm::on_searchStopButton_clicked()
 {
-    m_discoveryAgent->stop();
-    onDiscoverFinished();
+    m_isScanPaused = false;
+    stopScan();
+}
+
+void DeviceForm::on_continuousScanBox_clicked(bool checked)
+{
+    m_isContinuous = checked;
+    if(m_settings == nullptr)
+        return;
+    m_settings->beginGroup("DeviceForm");
+    m_settings->setValue("ContinuousScan", checked);
+    m_settings->endGroup();
 }
 
 void DeviceForm::setSettings(QSettings* settings)
 {
     m_settings = settings;
+    // [DeviceForm]
+    // ContinuousScan=false
+    // AgeOutMs=30000
+    // RssiSmoothing=0.3
+    m_settings->beginGroup("DeviceForm");
+    m_isContinuous = m_settings->value("ContinuousScan", false).toBool();
+    m_ageOutMs = qMax(m_settings->value("AgeOutMs", defaultAgeOutMs).toInt(), refreshIntervalMs);
+    m_rssiSmoothing = qBound(0.01, m_settings->value("RssiSmoothing", defaultRssiSmoothing).toDouble(), 1.0);
+    m_settings->endGroup();
+    ui->continuousScanBox->setChecked(m_isContinuous);
 }
 
 #ifdef Q_OS_ANDROID
@@ -245,25 +421,19 @@ void DeviceForm::getBondedTarget(bool isBLE)
     QAndroidJniObject array = QtAndroid::androidActivity().callObjectMethod("getBondedDevices", "(Z)[Ljava/lang/String;", isBLE);
     int arrayLen = androidEnv->GetArrayLength(array.object<jarray>());
     qDebug() << "arrayLen:" << arrayLen;
-    QTableWidget* deviceTable = ui->deviceTableWidget;
-    deviceTable->setRowCount(arrayLen);
     for(int i = 0; i < arrayLen; i++)
     {
         QString info = QAndroidJniObject::fromLocalRef(androidEnv->GetObjectArrayElement(array.object<jobjectArray>(), i)).toString();
         QString address = info.left(info.indexOf(' '));
         QString name = info.right(info.length() - info.indexOf(' ') - 1);
         qDebug() << address << name;
-        deviceTable->setItem(i, 0, new QTableWidgetItem(name));
-        deviceTable->setItem(i, 1, new QTableWidgetItem(address));
-        QTableWidgetItem* typeItem = new QTableWidgetItem();
-
-        if(isBLE)
-            typeItem->setText(tr("BLE"));
-        else
-            typeItem->setText(tr("RFCOMM"));
-        typeItem->setData(Qt::UserRole, isBLE);
-        deviceTable->setItem(i, 2, typeItem);
-        m_shownDevices.append(address);
+        // the bonded devices have no RSSI until they are discovered
+        ShownDevice device;
+        device.info = QBluetoothDeviceInfo(QBluetoothAddress(address), name, 0);
+        device.isBLE = isBLE;
+        device.isBonded = true;
+        m_shownDevices.append(device);
     }
+    refreshTable();
 }
 #endif
@@ -7,6 +7,8 @@
 #include <QThread>
 #include <QSettings>
 
+class QTimer;
+
 #ifdef Q_OS_WIN
 #include "comms/winbthelper.h"
 #endif
@@ -24,6 +26,15 @@ public:
     explicit DeviceForm(QWidget *parent = nullptr);
     ~DeviceForm();
     void setSettings(QSettings *settings);
+    // the devices in the table, with isBLE, the nearest first
+    QList<QPair<QBluetoothDeviceInfo, bool>> shownDevices() const;
+
+    // the table is sorted by the smoothed RSSI at most once per refreshIntervalMs
+    static const int refreshIntervalMs = 1000;
+    // in continuous scanning, a device not seen for this long is removed
+    static const int defaultAgeOutMs = 30000;
+    // the weight of a new RSSI sample in the moving average
+    static constexpr double defaultRssiSmoothing = 0.3;
 public slots:
     void onCommStateChanged(bool connected);
 protected:
@@ -33,6 +44,8 @@ private slots:
 
     void onDeviceDiscovered(const QBluetoothDeviceInfo &info);
     void onDiscoverFinished();
+    void onRefreshTimeout();
+    void on_continuousScanBox_clicked(bool checked);
     void onDeviceTableCellClicked(int row, int column);
     void on_connectButton_clicked();
 
@@ -43,10 +56,43 @@ private slots:
 private:
     Ui::DeviceForm *ui;
 
+    struct ShownDevice
+    {
+        QBluetoothDeviceInfo info;
+        bool isBLE = false;
+        // dBm, exponential moving average of the samples, 0 if unknown
+        double rssi = 0;
+        // msecs since epoch, 0 if not discovered yet
+        qint64 lastSeen = 0;
+        // listed from the bonded devices(Android), never removed
+        bool isBonded = false;
+    };
+
     QBluetoothDeviceDiscoveryAgent *m_discoveryAgent = nullptr;
     bool m_isCurrDiscoveryMethodBLE = false;
-    QList<QBluetoothDeviceInfo> m_shownDevices;
+    // in table order
+    QList<ShownDevice> m_shownDevices;
     QSettings* m_settings = nullptr;
+    QTimer* m_refreshTimer = nullptr;
+    bool m_isScanning = false;
+    bool m_isContinuous = false;
+    // the continuous scan is paused while connected
+    bool m_isScanPaused = false;
+    bool m_isTableDirty = false;
+    int m_ageOutMs = defaultAgeOutMs;
+    double m_rssiSmoothing = defaultRssiSmoothing;
+
+    void startScan();
+    void stopScan();
+    void updateDevice(const QBluetoothDeviceInfo &info);
+    // sorts the devices and rebuilds the table, the selection is kept
+    void refreshTable();
+    void setRow(int row, const ShownDevice& device);
+    // the index in m_shownDevices of the selected row, -1 if none
+    // the rows carry the device key, m_shownDevices might have changed since the last refresh
+    int selectedIndex() const;
+    // the address, or the UUID on macOS/iOS
+    static QString deviceKey(const QBluetoothDeviceInfo &info);
 #ifdef Q_OS_WIN
     WinBTHelper* m_winBTHelper = nullptr;
     QThread* m_winBTThread = nullptr;
@@ -1,11 +1,14 @@
 #include "basedevice.h"
 #include "ui_basedevice.h"
+#include "comms/comm.h"
+#include "telemetry/tracerecorder.h"
 
 #include <QDebug>
 #include <QTimer>
 #include <QMessageBox>
 #include <QFileDialog>
 #include <QJsonDocument>
+#include <QFileInfo>
 
 BaseDevice::BaseDevice(QWidget *parent) :
     QWidget(parent),
@@ -15,6 +18,13 @@ BaseDevice::BaseDevice(QWidget *parent) :
 
     ui->nameEdit->setMaxLength(m_maxNameLength);
     m_isSavingToFile = false;
+    m_uiUpdateTimer = new QTimer(this);
+    m_uiUpdateTimer->setSingleShot(true);
+    m_uiUpdateTimer->setInterval(uiUpdateIntervalMs);
+    connect(m_uiUpdateTimer, &QTimer::timeout, this, &BaseDevice::applyPendingFields);
+    // until setCapabilities() is called
+    m_queryPlan = DeviceCatalog::buildQueryPlan(m_features);
+    m_savePlan = DeviceCatalog::buildSavePlan(m_features);
 #ifndef Q_OS_ANDROID
     ui->connectAudioButton->hide();
 #endif
@@ -36,6 +46,15 @@ BaseDevice::BaseDevice(QWidget *parent) :
     connect(ui->LDAC48kButton, &QRadioButton::clicked, this, &BaseDevice::onBtnInLDACGroupClicked);
     connect(ui->LDAC96kButton, &QRadioButton::clicked, this, &BaseDevice::onBtnInLDACGroupClicked);
 
+    const QList<QWidget*> featureWidgets =
+    {
+        ui->nameGroup, ui->noiseGroup, ui->ambientSoundGroup, ui->controlSettingsGroup,
+        ui->soundEffectGroup, ui->promptVolumeGroup, ui->shutdownTimerGroup, ui->LDACGroup,
+        ui->gameModeBox, ui->autoPoweroffBox,
+    };
+    for(QWidget* widget : featureWidgets)
+        m_featureWidgets[widget->objectName()] = widget;
+
     connect(this, QOverload<const QByteArray&, const QString&, int>::of(&BaseDevice::pushCommand), this, QOverload<const QByteArray&, const QString&, int>::of(&BaseDevice::onCommandPushed));
     connect(this, QOverload<const char*, const QString&, int>::of(&BaseDevice::pushCommand), this, QOverload<const char*, const QString&, int>::of(&BaseDevice::onCommandPushed));
 }
@@ -223,156 +242,112 @@ void BaseDevice::on_nameSetButton_clicked()
 
 void BaseDevice::processData(const QByteArray& data)
 {
-    const char head = data[0];
-    const int len = (int)data[1];
-    if(head == '\xBB')
-    {
-        // cmd + single byte response
-        if(len == 2)
-        {
-            const char cmd = data[2];
-            const char ch = data[3];
-            if(cmd == '\xD5')
-            {
-                ui->SENormalButton->setChecked(ch == '\x00');
-                ui->SEPopButton->setChecked(ch == '\x01');
-                ui->SEClassicalButton->setChecked(ch == '\x02');
-                ui->SERockButton->setChecked(ch == '\x03');
-            }
-            else if(cmd == '\x08')
-            {
-                ui->gameModeBox->setChecked(ch == '\x01');
-            }
-            else if(cmd == '\xD0')
-            {
-                ui->batteryLabel->setText(QString::number((int)ch) + "%");
-            }
-            else if(cmd == '\x48')
-            {
-                ui->LDACOFFButton->setChecked(ch == '\x00');
-                ui->LDAC48kButton->setChecked(ch == '\x01');
-                ui->LDAC96kButton->setChecked(ch == '\x02');
-            }
-            else if(cmd == '\x05')
-            {
-                ui->PVBox->setValue((int)ch);
-            }
-            else if(cmd == '\xD3')
-            {
-                ui->shutdownTimerGroup->setChecked(ch != '\x00');
-            }
-            else if(cmd == '\xD7')
-            {
-                ui->autoPoweroffBox->setChecked(ch == '\x01');
-            }
-        }
-        else if(len > 2)
-        {
-            const char cmd = data[2];
-            if(cmd == '\xC8' && len == 7)
-            {
-                QString address = data.right(6).toHex(':');
-                ui->MACLabel->setText(address);
-                m_address = address;
-                emit updateLastAudioDeviceAddress(address);
-            }
-            else if(cmd == '\xC6' && len == 4)
-            {
-                ui->firmwareLabel->setText(data.right(3).toHex('.'));
-            }
-            else if(cmd == '\xCC' && len == 3)
-            {
-                char mode = data[3];
-                int ASVolume = (int)data[4] - 6;
-                ui->noiseNormalButton->setChecked(mode == '\x01');
-                ui->noiseReductionButton->setChecked(mode == '\x02');
-                ui->noiseAmbientSoundButton->setChecked(mode == '\x03');
-                ui->ASBox->setValue(ASVolume);
-            }
-            else if(cmd == '\xC9')
-            {
-                QString deviceName = QString::fromUtf8(data.mid(3));
-                ui->nameEdit->setText(deviceName);
-            }
-            else if(cmd == '\xF0' && len == 3 && data[3] == '\x0A')
-            {
-                quint8 mode = data[4];
-                ui->CSNormalBox->setChecked(mode & 1u);
-                ui->CSNoiseReductionBox->setChecked(mode & 2u);
-                ui->CSAmbientSoundBox->setChecked(mode & 4u);
-            }
-            else if(cmd == '\xD3' && len == 3)
-            {
-                int shutdownTimeout = data[4];
-                ui->shutdownTimerGroup->setChecked(true);
-                ui->STBox->setValue(shutdownTimeout);
-            }
-        }
-    }
-    else if(head == '\xCC')
+    TraceSpan span("ui", QStringLiteral("processData"));
+    protocol::Decoded decoded;
+    if(!protocol::decode(Comm::asSpan(data), decoded))
+        return;
+    // decoded.bytes points into data, copy it
+    PendingField pending;
+    pending.value = decoded.value;
+    pending.extra = decoded.extra;
+    pending.bytes = QByteArray(reinterpret_cast<const char*>(decoded.bytes.data()), decoded.bytes.size());
+    if(decoded.field == protocol::Field::MACAddress)
     {
-
+        // not a widget state, it's used by on_connectAudioButton_clicked() right away
+        m_address = pending.bytes.toHex(':');
+        emit updateLastAudioDeviceAddress(m_address);
     }
+    // only the last value of each field is kept, the widgets are updated once per frame
+    const int field = static_cast<int>(decoded.field);
+    m_pendingFieldOrder.removeOne(field);
+    m_pendingFieldOrder.append(field);
+    m_pendingFields[field] = pending;
+    if(!m_uiUpdateTimer->isActive())
+        m_uiUpdateTimer->start();
 }
 
-void BaseDevice::readSettings()
+void BaseDevice::applyPendingFields()
 {
-    const int interval = 150;
-    int i = 0;
+    TraceSpan span("ui", QStringLiteral("applyPendingFields"));
+    // in the order of the last update
+    const QList<int> order = m_pendingFieldOrder;
+    m_pendingFieldOrder.clear();
+    for(const int field : order)
+        applyField(static_cast<protocol::Field>(field), m_pendingFields.value(field));
+    m_pendingFields.clear();
+}
 
-    QTimer::singleShot(i, [ = ] {on_batteryGetButton_clicked();});
-    i += interval;
-    QTimer::singleShot(i, [ = ] {on_MACGetButton_clicked();});
-    i += interval;
-    QTimer::singleShot(i, [ = ] {on_firmwareGetButton_clicked();});
-    i += interval;
-    if(ui->ambientSoundGroup->isVisible())
-    {
-        QTimer::singleShot(i, [ = ] {emit sendCommand("CC");});
-        i += interval;
-    }
-    if(ui->nameGroup->isVisible())
-    {
-        QTimer::singleShot(i, [ = ] {emit sendCommand("C9");});
-        i += interval;
-    }
-    if(ui->soundEffectGroup->isVisible())
-    {
-        QTimer::singleShot(i, [ = ] {emit sendCommand("D5");});
-        i += interval;
-    }
-    if(ui->gameModeBox->isVisible())
-    {
-        QTimer::singleShot(i, [ = ] {emit sendCommand("08");});
-        i += interval;
-    }
-    if(ui->controlSettingsGroup->isVisible())
-    {
-        QTimer::singleShot(i, [ = ] {emit sendCommand("F00A");});
-        i += interval;
-    }
-    if(ui->LDACGroup->isVisible())
-    {
-        QTimer::singleShot(i, [ = ] {emit sendCommand("48");});
-        i += interval;
-    }
-    if(ui->promptVolumeGroup->isVisible())
-    {
-        QTimer::singleShot(i, [ = ] {emit sendCommand("05");});
-        i += interval;
-    }
-    if(ui->shutdownTimerGroup->isVisible())
-    {
-        QTimer::singleShot(i, [ = ] {emit sendCommand("D3");});
-        i += interval;
-    }
-    if(ui->autoPoweroffBox->isVisible())
+void BaseDevice::applyField(protocol::Field field, const PendingField& pending)
+{
+    const int value = pending.value;
+    const QByteArray& bytes = pending.bytes;
+    switch(field)
     {
-        QTimer::singleShot(i, [ = ] {emit sendCommand("D7");});
-        i += interval;
+    case protocol::Field::SoundEffect:
+        ui->SENormalButton->setChecked(value == 0);
+        ui->SEPopButton->setChecked(value == 1);
+        ui->SEClassicalButton->setChecked(value == 2);
+        ui->SERockButton->setChecked(value == 3);
+        break;
+    case protocol::Field::GameMode:
+        ui->gameModeBox->setChecked(value);
+        break;
+    case protocol::Field::Battery:
+        ui->batteryLabel->setText(QString::number(value) + "%");
+        break;
+    case protocol::Field::LDAC:
+        ui->LDACOFFButton->setChecked(value == 0);
+        ui->LDAC48kButton->setChecked(value == 1);
+        ui->LDAC96kButton->setChecked(value == 2);
+        break;
+    case protocol::Field::PromptVolume:
+        ui->PVBox->setValue(value);
+        break;
+    case protocol::Field::ShutdownTimerEnabled:
+        ui->shutdownTimerGroup->setChecked(value);
+        break;
+    case protocol::Field::AutoPoweroff:
+        ui->autoPoweroffBox->setChecked(value);
+        break;
+    case protocol::Field::MACAddress:
+        ui->MACLabel->setText(bytes.toHex(':'));
+        break;
+    case protocol::Field::Firmware:
+        ui->firmwareLabel->setText(bytes.toHex('.'));
+        break;
+    case protocol::Field::NoiseMode:
+        ui->noiseNormalButton->setChecked(value == 1);
+        ui->noiseReductionButton->setChecked(value == 2);
+        ui->noiseAmbientSoundButton->setChecked(value == 3);
+        // notifications of the noise mode don't carry the volume
+        if(pending.extra >= 0)
+            ui->ASBox->setValue(pending.extra);
+        break;
+    case protocol::Field::Name:
+        ui->nameEdit->setText(QString::fromUtf8(bytes));
+        break;
+    case protocol::Field::ControlSettings:
+        ui->CSNormalBox->setChecked(value & 1u);
+        ui->CSNoiseReductionBox->setChecked(value & 2u);
+        ui->CSAmbientSoundBox->setChecked(value & 4u);
+        break;
+    case protocol::Field::ShutdownTimer:
+        ui->shutdownTimerGroup->setChecked(true);
+        ui->STBox->setValue(value);
+        break;
+    default:
+        break;
     }
 }
 
+void BaseDevice::readSettings()
+{
+    // Comm paces the queries, they are sent with QueryPriority
+    // so playback controls can still overtake them
+    for(const auto& cmd : qAsConst(m_queryPlan))
+        emit sendCommand(cmd);
+}
+
 void BaseDevice::on_batteryGetButton_clicked()
 {
     emit sendCommand("D0");
@@ -436,6 +411,7 @@ bool BaseDevice::setMaxNameLength(int length)
     if(length <= 0)
         return false;
     m_maxNameLength = length;
+    ui->nameEdit->setMaxLength(m_maxNameLength);
     return true;
 }
 
@@ -443,13 +419,33 @@ bool BaseDevice::hideWidget(const QString& widgetName)
 {
     if(widgetName.isEmpty())
         return false;
-    QWidget* widget = findChild<QWidget *>(widgetName);
+    QWidget* widget = m_featureWidgets.value(widgetName);
+    if(widget == nullptr)
+        widget = findChild<QWidget *>(widgetName);
     if(widget == nullptr)
         return false;
     widget->hide();
     return true;
 }
 
+void BaseDevice::setHiddenFeatures(const QStringList& hiddenFeatures)
+{
+    for(auto it = m_featureWidgets.cbegin(); it != m_featureWidgets.cend(); ++it)
+        it.value()->setVisible(!hiddenFeatures.contains(it.key()));
+    for(const auto& feature : hiddenFeatures)
+    {
+        if(!m_featureWidgets.contains(feature))
+            hideWidget(feature);
+    }
+}
+
+void BaseDevice::setCapabilities(const DeviceCatalog::DeviceModel& model)
+{
+    m_features = model.features;
+    m_queryPlan = model.queryPlan;
+    m_savePlan = model.savePlan;
+}
+
 void BaseDevice::clearAddress()
 {
     m_address.clear();
@@ -457,6 +453,7 @@ void BaseDevice::clearAddress()
 
 void BaseDevice::onCommandPushed(const QByteArray &cmd, const QString &name, int priority)
 {
+    TraceSpan span("ui", QStringLiteral("pushCommand"), {{"name", name}});
     if(m_isSavingToFile)
     {
         if(m_cmdInFile == nullptr)
@@ -473,7 +470,13 @@ void BaseDevice::onCommandPushed(const QByteArray &cmd, const QString &name, int
         m_cmdInFile->append(cmdObject);
     }
     else
-        emit sendCommand(cmd);
+        emit scheduleCommand(cmd, profilePriority(priority));
+}
+
+int BaseDevice::profilePriority(int priority)
+{
+    // priorities out of range were dropped before, keep them in the setting range instead
+    return Comm::SettingPriority + qBound(0, priority, Comm::DeferredPriority - Comm::SettingPriority - 1);
 }
 
 void BaseDevice::onCommandPushed(const char* hexCmd, const QString& name, int priority)
@@ -495,30 +498,45 @@ void BaseDevice::on_fileSaveButton_clicked()
     m_isSavingToFile = true;
     m_cmdInFile = new QJsonArray;
 
-    if(ui->soundEffectGroup->isVisible())
-        onBtnInSoundEffectGroupClicked();
-    if(ui->controlSettingsGroup->isVisible())
-        onCheckBoxInControlSettingsGroupClicked();
-    if(ui->LDACGroup->isVisible())
-        onBtnInLDACGroupClicked();
-    if(ui->gameModeBox->isVisible())
-        on_gameModeBox_clicked();
-    if(ui->ambientSoundGroup->isVisible())
-    {
-        onBtnInNoiseGroupClicked();
-        on_ASSetButton_clicked();
-    }
-    if(ui->promptVolumeGroup->isVisible())
-        on_PVSetButton_clicked();
-    if(ui->shutdownTimerGroup->isVisible())
+    for(const auto feature : qAsConst(m_savePlan))
     {
-        on_shutdownTimerGroup_clicked();
-        on_STSetButton_clicked();
+        switch(feature)
+        {
+        case DeviceCatalog::SoundEffectFeature:
+            onBtnInSoundEffectGroupClicked();
+            break;
+        case DeviceCatalog::ControlSettingsFeature:
+            onCheckBoxInControlSettingsGroupClicked();
+            break;
+        case DeviceCatalog::LDACFeature:
+            onBtnInLDACGroupClicked();
+            break;
+        case DeviceCatalog::GameModeFeature:
+            on_gameModeBox_clicked();
+            break;
+        case DeviceCatalog::NoiseFeature:
+            onBtnInNoiseGroupClicked();
+            break;
+        case DeviceCatalog::AmbientSoundFeature:
+            on_ASSetButton_clicked();
+            break;
+        case DeviceCatalog::PromptVolumeFeature:
+            on_PVSetButton_clicked();
+            break;
+        case DeviceCatalog::ShutdownTimerFeature:
+            on_shutdownTimerGroup_clicked();
+            on_STSetButton_clicked();
+            break;
+        case DeviceCatalog::NameFeature:
+            on_nameSetButton_clicked();
+            break;
+        case DeviceCatalog::AutoPoweroffFeature:
+            on_autoPoweroffBox_clicked();
+            break;
+        default:
+            break;
+        }
     }
-    if(ui->nameGroup->isVisible())
-        on_nameSetButton_clicked();
-    if(ui->autoPoweroffBox->isVisible())
-        on_autoPoweroffBox_clicked();
 
     QJsonObject settingsObj;
     settingsObj.insert("name", m_deviceName);
@@ -546,51 +564,126 @@ void BaseDevice::on_fileWriteDeviceButton_clicked()
     if(filename.isEmpty())
         return;
 
+    QString errorString;
+    if(!applyProfile(filename, &errorString, true))
+        QMessageBox::information(this, tr("Error"), errorString);
+}
+
+bool BaseDevice::applyProfile(const QString& filename, QString* errorString, bool showDone)
+{
     QFile settingsFile(filename);
     if(!settingsFile.open(QFile::ReadOnly))
     {
-        QMessageBox::information(this, tr("Error"), tr("Failed to open") + "\n" + filename);
-        return;
+        if(errorString != nullptr)
+            *errorString = tr("Failed to open") + "\n" + filename;
+        return false;
     }
 
     QJsonDocument doc = QJsonDocument::fromJson(settingsFile.readAll());
     if(doc.isNull())
     {
-        QMessageBox::information(this, tr("Error"), tr("Invalid JSON file"));
-        return;
+        if(errorString != nullptr)
+            *errorString = tr("Invalid JSON file");
+        return false;
     }
     QJsonObject settingsObj = doc.object();
     if(settingsObj.isEmpty() || !settingsObj.contains("commands") || !settingsObj["commands"].isArray())
     {
-        QMessageBox::information(this, tr("Error"), tr("Invalid format"));
-        return;
+        if(errorString != nullptr)
+            *errorString = tr("Invalid format");
+        return false;
     }
     const QJsonArray cmdInFile = settingsObj["commands"].toArray();
+    m_profileWrites.clear();
+    m_profileName = QFileInfo(filename).completeBaseName();
+    m_profileConfirmed = 0;
+    m_profileFailed.clear();
+    m_isProfileDoneShown = showDone;
 
-    const int interval = 150;
-    int i = 0;
-    QList<QJsonValue> cmdList[3];
+    // Comm sends them in the order of priorities, one request at a time
     for(const auto& cmdItem : cmdInFile)
     {
         const QString cmd = cmdItem.toObject().value(QStringLiteral("cmd")).toString(); //cmdItem["cmd"].toString();
         int priority = cmdItem.toObject().value(QStringLiteral("priority")).toInt(0); // cmdItem["priority"].toInt(0);
         if(cmd.isEmpty())
             continue;
-        else if(priority < 3)
-            cmdList[priority].append(cmdItem);
+        const QByteArray data = QByteArray::fromHex(cmd.toLatin1());
+        if(Comm::expectsResponse(data))
+            m_profileWrites.append(data);
+        emit scheduleCommand(data, profilePriority(priority));
     }
-    for(int priority = 0; priority < 3; priority++)
+    // nothing to wait for
+    if(m_profileWrites.isEmpty())
+        finishProfile();
+    return true;
+}
+
+void BaseDevice::failPendingProfile(const QString& reason)
+{
+    if(m_profileWrites.isEmpty())
+        return;
+    qDebug() << "profile" << m_profileName << reason;
+    for(const auto& cmd : qAsConst(m_profileWrites))
+        m_profileFailed.append(cmd.toHex().toUpper());
+    m_profileWrites.clear();
+    finishProfile();
+}
+
+void BaseDevice::onWriteVerified(const QByteArray& cmd, int echoStatus)
+{
+    // emitted before requestCompleted(), a mismatch is followed by requestFailed()
+    if(echoStatus != static_cast<int>(protocol::EchoStatus::Mismatched) && m_profileWrites.contains(cmd))
+        m_profileConfirmed++;
+}
+
+void BaseDevice::onRequestCompleted(const QByteArray& cmd)
+{
+    finishProfileWrite(cmd, true);
+}
+
+void BaseDevice::onRequestFailed(const QByteArray& cmd, const QString& reason)
+{
+    Q_UNUSED(reason);
+    finishProfileWrite(cmd, false);
+}
+
+void BaseDevice::finishProfileWrite(const QByteArray& cmd, bool isApplied)
+{
+    if(!m_profileWrites.removeOne(cmd))
+        return;
+    if(!isApplied)
+        m_profileFailed.append(cmd.toHex().toUpper());
+    if(m_profileWrites.isEmpty())
+        finishProfile();
+}
+
+void BaseDevice::finishProfile()
+{
+    if(!m_profileFailed.isEmpty())
     {
-        for(const auto& cmdItem : qAsConst(cmdList[priority]))
-        {
-            const QString cmd = cmdItem["cmd"].toString();
-            const QString name = cmdItem["name"].toString();
-            QTimer::singleShot(i, [ = ] {emit sendCommand(QByteArray::fromHex(cmd.toLatin1()));});
-            i += interval;
-        }
+        const QString msg = tr("Profile %1: not applied").arg(m_profileName) + ": " + m_profileFailed.join(", ");
+        emit showMessage(msg);
+        if(m_isProfileDoneShown)
+            QMessageBox::information(this, tr("Error"), msg);
+        return;
     }
-    QTimer::singleShot(i, [ = ] {QMessageBox::information(this, tr("Info"), tr("Done"));});
+    emit profileApplied(m_profileName);
+    emit showMessage(tr("Profile %1: %n setting(s) confirmed by echo", "", m_profileConfirmed).arg(m_profileName));
+    if(m_isProfileDoneShown)
+        QMessageBox::information(this, tr("Info"), tr("Done"));
+}
 
+void BaseDevice::on_scriptRunButton_clicked()
+{
+    QString filename = QFileDialog::getOpenFileName(this, QString(), QString(), tr("Provisioning Script") + " (*.txt *.edscript);;" + tr("All Files") + " (*)");
+    if(filename.isEmpty())
+        return;
+    emit runScript(filename);
+}
+
+void BaseDevice::on_cloneButton_clicked()
+{
+    emit cloneRequested();
 }
 
 void BaseDevice::on_connectAudioButton_clicked()
@@ -5,6 +5,11 @@
 #include <QJsonArray>
 #include <QJsonObject>
 
+#include "devicecatalog.h"
+#include "protocol.h"
+
+class QTimer;
+
 namespace Ui
 {
 class BaseDevice;
@@ -22,10 +27,28 @@ public:
     void setDeviceName(const QString& deviceName);
     bool setMaxNameLength(int length);
     bool hideWidget(const QString &widgetName);
+    // show all features except hiddenFeatures, without rebuilding the widget
+    void setHiddenFeatures(const QStringList &hiddenFeatures);
+    // what readSettings() queries and "Save to File" writes, independent of the widget visibility
+    void setCapabilities(const DeviceCatalog::DeviceModel &model);
     void clearAddress();
+    // maps the priority in a profile(0-2) to Comm::Priority
+    static int profilePriority(int priority);
+
+    // decoded fields are applied to the widgets at most once per display frame(60Hz)
+    static const int uiUpdateIntervalMs = 16;
+    // queues the commands in a file created by "Save to File"
+    // profileApplied() is emitted after every command is answered, not if any of them fails
+    // showDone: shows "Done" or the failed commands in a message box
+    bool applyProfile(const QString& filename, QString* errorString = nullptr, bool showDone = false);
+    // the commands of the profile which are not answered yet are failed, like when the session is gone
+    void failPendingProfile(const QString& reason);
 public slots:
     void processData(const QByteArray &data);
     void readSettings();
+    void onWriteVerified(const QByteArray& cmd, int echoStatus);
+    void onRequestCompleted(const QByteArray& cmd);
+    void onRequestFailed(const QByteArray& cmd, const QString& reason);
 protected:
     Ui::BaseDevice *ui;
     bool m_isSavingToFile = false;
@@ -35,8 +58,38 @@ protected:
     // the default length is 24
     int m_maxNameLength = 24;
     QJsonArray* m_cmdInFile = nullptr;
+    // the widgets which can be hidden by "HiddenFeatures" in deviceinfo.json
+    QHash<QString, QWidget*> m_featureWidgets;
+    DeviceCatalog::Features m_features = DeviceCatalog::AllFeatures;
+    QList<QByteArray> m_queryPlan;
+    QList<DeviceCatalog::Feature> m_savePlan;
+
+    struct PendingField
+    {
+        int value = 0;
+        int extra = 0;
+        QByteArray bytes;
+    };
+    // protocol::Field -> the last decoded value, not applied yet
+    QHash<int, PendingField> m_pendingFields;
+    QList<int> m_pendingFieldOrder;
+    QTimer* m_uiUpdateTimer = nullptr;
+
+    // the commands of the last applied profile, waiting for the responses
+    QList<QByteArray> m_profileWrites;
+    QString m_profileName;
+    // the writes confirmed by their echoes, see Comm::writeVerified()
+    int m_profileConfirmed = 0;
+    QStringList m_profileFailed;
+    bool m_isProfileDoneShown = false;
+
+    void applyField(protocol::Field field, const PendingField& pending);
 
 protected slots:
+    void applyPendingFields();
+    void finishProfileWrite(const QByteArray& cmd, bool isApplied);
+    // shows the result after every command of the profile is answered
+    void finishProfile();
     void onBtnInNoiseGroupClicked();
     void onBtnInSoundEffectGroupClicked();
     void on_gameModeBox_clicked();
@@ -72,6 +125,8 @@ signals:
     // for sending commands
     void sendCommand(const QByteArray& cmd, bool isRaw = false);
     void sendCommand(const char* hexCmd, bool isRaw = false);
+    // priority: Comm::Priority
+    void scheduleCommand(const QByteArray& cmd, int priority, bool isRaw = false);
     // for sending/saving commands
     // commands with highest priority number will be sent at last
     void pushCommand(const QByteArray& cmd, const QString& name = QString(), int priority = 0);
@@ -79,10 +134,16 @@ signals:
     void showMessage(const QString& msg);
     void connectToAudio(const QString &address);
     void updateLastAudioDeviceAddress(const QString &address);
+    void profileApplied(const QString &profile);
+    void runScript(const QString &filename);
+    // replicate the settings of the connected device to other devices
+    void cloneRequested();
 private slots:
     void on_autoPoweroffBox_clicked();
     void on_fileSaveButton_clicked();
     void on_fileWriteDeviceButton_clicked();
+    void on_scriptRunButton_clicked();
+    void on_cloneButton_clicked();
     void onCommandPushed(const QByteArray& cmd, const QString &name = QString(), int priority = 0);
     void onCommandPushed(const char *hexCmd, const QString &name = QString(), int priority = 0);
     void on_connectAudioButton_clicked();
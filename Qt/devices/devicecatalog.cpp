@@ -0,0 +1,257 @@
+#include "devicecatalog.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QMap>
+
+DeviceCatalog::DeviceCatalog(QObject *parent)
+    : QObject{parent}
+{
+    m_watcher = new QFileSystemWatcher(this);
+    m_reloadTimer = new QTimer(this);
+    m_reloadTimer->setSingleShot(true);
+    m_reloadTimer->setInterval(reloadDelayMs);
+    // editors usually write a file in several steps, so the reload is delayed
+    connect(m_watcher, &QFileSystemWatcher::directoryChanged, m_reloadTimer, QOverload<>::of(&QTimer::start));
+    connect(m_watcher, &QFileSystemWatcher::fileChanged, m_reloadTimer, QOverload<>::of(&QTimer::start));
+    connect(m_reloadTimer, &QTimer::timeout, this, &DeviceCatalog::reload);
+}
+
+void DeviceCatalog::setExternalDir(const QString &dir)
+{
+    m_externalDir = dir;
+}
+
+QString DeviceCatalog::externalDir() const
+{
+    return m_externalDir;
+}
+
+void DeviceCatalog::reload()
+{
+    QHash<QString, DeviceModel> models;
+    if(!loadFile(":/devices/deviceinfo.json", models))
+        qDebug() << "Failed to load Device Info";
+    if(!m_externalDir.isEmpty())
+    {
+        QDir dir(m_externalDir);
+        const QStringList fileList = dir.entryList({"*.json"}, QDir::Files, QDir::Name);
+        for(const QString& file : fileList)
+        {
+            if(!loadFile(dir.filePath(file), models))
+                qDebug() << "Failed to load Device Info from" << dir.filePath(file);
+        }
+    }
+    rebuildIndex(models);
+    updateWatcher();
+    qDebug() << "Device Info loaded:" << m_models.length() << "models";
+    emit catalogChanged();
+}
+
+bool DeviceCatalog::loadFile(const QString &path, QHash<QString, DeviceModel> &models)
+{
+    QFile deviceInfoFile(path);
+    if(!deviceInfoFile.open(QIODevice::ReadOnly))
+        return false;
+    QJsonDocument deviceInfoDoc = QJsonDocument::fromJson(deviceInfoFile.readAll());
+    deviceInfoFile.close();
+    if(!deviceInfoDoc.isObject())
+        return false;
+
+    const QJsonObject deviceInfo = deviceInfoDoc.object();
+    for(auto it = deviceInfo.constBegin(); it != deviceInfo.constEnd(); ++it)
+    {
+        QJsonObject details = it->toObject();
+        DeviceModel model;
+        model.key = it.key();
+        model.name = details["Name"].toString();
+        QString serviceUUID = details["UniqueServiceUUID"].toString();
+        if(!serviceUUID.isEmpty())
+            model.serviceUUID = QBluetoothUuid(serviceUUID);
+        const QJsonArray namePatternArray = details["NamePatterns"].toArray();
+        for(const auto& pattern : namePatternArray)
+            model.namePatterns.append(pattern.toString());
+        model.maxNameLength = details["MaxNameLength"].toInt(24);
+        const QJsonArray hiddenFeatureArray = details["HiddenFeatures"].toArray();
+        for(const auto& feature : hiddenFeatureArray)
+        {
+            model.hiddenFeatures.append(feature.toString());
+            model.features &= ~Features(featureFromWidgetName(feature.toString()));
+        }
+        model.queryPlan = buildQueryPlan(model.features);
+        model.savePlan = buildSavePlan(model.features);
+        models[model.key] = model;
+    }
+    return true;
+}
+
+void DeviceCatalog::rebuildIndex(const QHash<QString, DeviceModel> &models)
+{
+    m_models.clear();
+    m_keyIndex.clear();
+    m_serviceUUIDIndex.clear();
+    m_nameIndex.clear();
+    m_namePatternList.clear();
+
+    // sorted by key, like the order in QJsonObject
+    QMap<QString, DeviceModel> sortedModels;
+    for(auto it = models.cbegin(); it != models.cend(); ++it)
+        sortedModels.insert(it.key(), it.value());
+    for(const auto& model : qAsConst(sortedModels))
+    {
+        int i = m_models.length();
+        m_models.append(model);
+        m_keyIndex[model.key] = i;
+        if(!model.serviceUUID.isNull())
+            m_serviceUUIDIndex[model.serviceUUID] = i;
+        // the advertised name is usually the model name, exact NamePatterns can still override it
+        if(!model.name.isEmpty())
+            m_nameIndex[model.name.toLower()] = i;
+        for(const auto& pattern : model.namePatterns)
+        {
+            if(pattern.contains('*') || pattern.contains('?'))
+                m_namePatternList.append(qMakePair(QRegularExpression(QRegularExpression::wildcardToRegularExpression(pattern), QRegularExpression::CaseInsensitiveOption), i));
+            else
+                m_nameIndex[pattern.toLower()] = i;
+        }
+    }
+}
+
+void DeviceCatalog::updateWatcher()
+{
+    if(!m_watcher->files().isEmpty())
+        m_watcher->removePaths(m_watcher->files());
+    if(!m_watcher->directories().isEmpty())
+        m_watcher->removePaths(m_watcher->directories());
+    if(m_externalDir.isEmpty())
+        return;
+    if(!QFileInfo(m_externalDir).isDir())
+    {
+        // watch the nearest existing parent, the directory is picked up after it is created
+        QString parent = QFileInfo(m_externalDir).absoluteFilePath();
+        do
+        {
+            const QString upper = QFileInfo(parent).absolutePath();
+            if(upper == parent)
+                break;
+            parent = upper;
+        } while(!QFileInfo(parent).isDir());
+        if(QFileInfo(parent).isDir())
+            m_watcher->addPath(parent);
+        return;
+    }
+    // directoryChanged() is for added/removed files, fileChanged() is for modified files
+    m_watcher->addPath(m_externalDir);
+    QDir dir(m_externalDir);
+    const QStringList fileList = dir.entryList({"*.json"}, QDir::Files);
+    for(const QString& file : fileList)
+        m_watcher->addPath(dir.filePath(file));
+}
+
+QList<DeviceCatalog::DeviceModel> DeviceCatalog::models() const
+{
+    return m_models;
+}
+
+bool DeviceCatalog::contains(const QString &key) const
+{
+    return m_keyIndex.contains(key);
+}
+
+const DeviceCatalog::DeviceModel* DeviceCatalog::model(const QString &key) const
+{
+    auto it = m_keyIndex.constFind(key);
+    return it == m_keyIndex.cend() ? nullptr : &m_models[it.value()];
+}
+
+const DeviceCatalog::DeviceModel* DeviceCatalog::findByServiceUUID(const QBluetoothUuid &uuid) const
+{
+    auto it = m_serviceUUIDIndex.constFind(uuid);
+    return it == m_serviceUUIDIndex.cend() ? nullptr : &m_models[it.value()];
+}
+
+const DeviceCatalog::DeviceModel* DeviceCatalog::findByName(const QString &name) const
+{
+    auto it = m_nameIndex.constFind(name.toLower());
+    if(it != m_nameIndex.cend())
+        return &m_models[it.value()];
+    for(const auto& pattern : m_namePatternList)
+    {
+        if(pattern.first.match(name).hasMatch())
+            return &m_models[pattern.second];
+    }
+    return nullptr;
+}
+
+DeviceCatalog::Feature DeviceCatalog::featureFromWidgetName(const QString &widgetName)
+{
+    static const QHash<QString, Feature> featureMap =
+    {
+        {"nameGroup", NameFeature},
+        {"noiseGroup", NoiseFeature},
+        {"ambientSoundGroup", AmbientSoundFeature},
+        {"controlSettingsGroup", ControlSettingsFeature},
+        {"soundEffectGroup", SoundEffectFeature},
+        {"promptVolumeGroup", PromptVolumeFeature},
+        {"shutdownTimerGroup", ShutdownTimerFeature},
+        {"LDACGroup", LDACFeature},
+        {"gameModeBox", GameModeFeature},
+        {"autoPoweroffBox", AutoPoweroffFeature},
+    };
+    return featureMap.value(widgetName, NoFeature);
+}
+
+QList<QByteArray> DeviceCatalog::buildQueryPlan(Features features)
+{
+    // battery, MAC address and firmware are supported by all models
+    QList<QByteArray> plan = {QByteArray("\xD0", 1), QByteArray("\xC8", 1), QByteArray("\xC6", 1)};
+    // the response of 0xCC carries both the noise mode and the ambient sound volume
+    if(features & (NoiseFeature | AmbientSoundFeature))
+        plan.append(QByteArray("\xCC", 1));
+    if(features & NameFeature)
+        plan.append(QByteArray("\xC9", 1));
+    if(features & SoundEffectFeature)
+        plan.append(QByteArray("\xD5", 1));
+    if(features & GameModeFeature)
+        plan.append(QByteArray("\x08", 1));
+    if(features & ControlSettingsFeature)
+        plan.append(QByteArray("\xF0\x0A", 2));
+    if(features & LDACFeature)
+        plan.append(QByteArray("\x48", 1));
+    if(features & PromptVolumeFeature)
+        plan.append(QByteArray("\x05", 1));
+    if(features & ShutdownTimerFeature)
+        plan.append(QByteArray("\xD3", 1));
+    if(features & AutoPoweroffFeature)
+        plan.append(QByteArray("\xD7", 1));
+    return plan;
+}
+
+QList<DeviceCatalog::Feature> DeviceCatalog::buildSavePlan(Features features)
+{
+    static const QList<Feature> saveOrder =
+    {
+        SoundEffectFeature,
+        ControlSettingsFeature,
+        LDACFeature,
+        GameModeFeature,
+        NoiseFeature,
+        AmbientSoundFeature,
+        PromptVolumeFeature,
+        ShutdownTimerFeature,
+        NameFeature,
+        AutoPoweroffFeature,
+    };
+    QList<Feature> plan;
+    for(const auto feature : saveOrder)
+    {
+        if(features.testFlag(feature))
+            plan.append(feature);
+    }
+    return plan;
+}
@@ -0,0 +1,94 @@
+#ifndef DEVICECATALOG_H
+#define DEVICECATALOG_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QBluetoothUuid>
+#include <QRegularExpression>
+#include <QFileSystemWatcher>
+#include <QTimer>
+
+// In-memory index of deviceinfo.json.
+// The built-in catalog is loaded first, then every *.json file in the external directory,
+// models with the same key are overridden.
+class DeviceCatalog : public QObject
+{
+    Q_OBJECT
+public:
+    // the names match the widget names in "HiddenFeatures"
+    enum Feature
+    {
+        NoFeature = 0,
+        NameFeature = 1 << 0, // nameGroup
+        NoiseFeature = 1 << 1, // noiseGroup
+        AmbientSoundFeature = 1 << 2, // ambientSoundGroup
+        ControlSettingsFeature = 1 << 3, // controlSettingsGroup
+        SoundEffectFeature = 1 << 4, // soundEffectGroup
+        PromptVolumeFeature = 1 << 5, // promptVolumeGroup
+        ShutdownTimerFeature = 1 << 6, // shutdownTimerGroup
+        LDACFeature = 1 << 7, // LDACGroup
+        GameModeFeature = 1 << 8, // gameModeBox
+        AutoPoweroffFeature = 1 << 9, // autoPoweroffBox
+        AllFeatures = (1 << 10) - 1,
+    };
+    Q_DECLARE_FLAGS(Features, Feature)
+
+    struct DeviceModel
+    {
+        QString key; // the key in deviceinfo.json, not "Name"
+        QString name;
+        QBluetoothUuid serviceUUID;
+        QStringList namePatterns;
+        int maxNameLength = 24;
+        QStringList hiddenFeatures;
+        Features features = AllFeatures;
+        // precomputed from features when loading
+        // the queries sent by readSettings(), without head and checksum
+        QList<QByteArray> queryPlan;
+        // the features written to a profile, in this order
+        QList<Feature> savePlan;
+    };
+
+    explicit DeviceCatalog(QObject *parent = nullptr);
+
+    void setExternalDir(const QString& dir);
+    QString externalDir() const;
+
+    QList<DeviceModel> models() const;
+    bool contains(const QString& key) const;
+    // returns nullptr if not found
+    // the pointer is valid until the next reload()
+    const DeviceModel* model(const QString& key) const;
+    const DeviceModel* findByServiceUUID(const QBluetoothUuid& uuid) const;
+    // exact names are hashed, wildcard patterns(like "W820NB*") are checked afterwards
+    const DeviceModel* findByName(const QString& name) const;
+
+    static Feature featureFromWidgetName(const QString& widgetName);
+    static QList<QByteArray> buildQueryPlan(Features features);
+    static QList<Feature> buildSavePlan(Features features);
+
+    static const int reloadDelayMs = 500;
+public slots:
+    void reload();
+private:
+    QList<DeviceModel> m_models;
+    QHash<QString, int> m_keyIndex;
+    QHash<QBluetoothUuid, int> m_serviceUUIDIndex;
+    QHash<QString, int> m_nameIndex;
+    QList<QPair<QRegularExpression, int>> m_namePatternList;
+    QString m_externalDir;
+    QFileSystemWatcher* m_watcher = nullptr;
+    QTimer* m_reloadTimer = nullptr;
+
+    bool loadFile(const QString& path, QHash<QString, DeviceModel>& models);
+    void rebuildIndex(const QHash<QString, DeviceModel>& models);
+    void updateWatcher();
+signals:
+    void catalogChanged();
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(DeviceCatalog::Features)
+
+#endif // DEVICECATALOG_H
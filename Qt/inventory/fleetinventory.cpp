@@ -0,0 +1,227 @@
+#include "fleetinventory.h"
+#include "comms/comm.h"
+
+#include <QDebug>
+#include <QDateTime>
+#include <QSqlQuery>
+#include <QSqlError>
+
+FleetInventory::FleetInventory(QObject *parent)
+    : QObject{parent}
+{
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(flushIntervalMs);
+    connect(m_flushTimer, &QTimer::timeout, this, &FleetInventory::flush);
+}
+
+FleetInventory::~FleetInventory()
+{
+    close();
+}
+
+bool FleetInventory::open(const QString &path)
+{
+    close();
+    m_db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+    m_db.setDatabaseName(path);
+    if(!m_db.open())
+    {
+        qDebug() << "Failed to open inventory:" << path << m_db.lastError().text();
+        return false;
+    }
+    return createSchema();
+}
+
+void FleetInventory::close()
+{
+    if(!m_db.isValid())
+        return;
+    flush();
+    m_db.close();
+    m_db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+bool FleetInventory::createSchema()
+{
+    QSqlQuery query(m_db);
+    const QStringList statements =
+    {
+        "PRAGMA journal_mode=WAL",
+        "CREATE TABLE IF NOT EXISTS devices ("
+        "address TEXT PRIMARY KEY, "
+        "mac TEXT, "
+        "model TEXT, "
+        "firmware TEXT, "
+        "name TEXT, "
+        "last_profile TEXT, "
+        "last_seen INTEGER DEFAULT 0, "
+        "provisioned INTEGER DEFAULT 0)",
+        "CREATE INDEX IF NOT EXISTS devices_mac ON devices(mac)",
+        // for queries like "all W820NB on firmware X not yet provisioned"
+        "CREATE INDEX IF NOT EXISTS devices_model_firmware ON devices(model, firmware, provisioned)",
+        "CREATE INDEX IF NOT EXISTS devices_firmware ON devices(firmware)",
+    };
+    for(const QString& statement : statements)
+    {
+        if(!query.exec(statement))
+        {
+            qDebug() << "Inventory error:" << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+void FleetInventory::addSession(const QString &address, Comm *comm)
+{
+    update(address, "last_seen", QDateTime::currentSecsSinceEpoch());
+    // Comm lives in the I/O thread, this is a queued connection
+    connect(comm, &Comm::newData, this, [ = ](const QByteArray & data) {onNewData(address, data);});
+}
+
+void FleetInventory::recordModel(const QString &address, const QString &model)
+{
+    update(address, "model", model);
+}
+
+void FleetInventory::recordProfile(const QString &address, const QString &profile)
+{
+    update(address, "last_profile", profile);
+    update(address, "provisioned", 1);
+}
+
+void FleetInventory::onNewData(const QString &address, const QByteArray &data)
+{
+    protocol::Decoded decoded;
+    if(!protocol::decode(Comm::asSpan(data), decoded))
+        return;
+    const QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(decoded.bytes.data()), decoded.bytes.size());
+    if(decoded.field == protocol::Field::MACAddress)
+        update(address, "mac", QString(bytes.toHex(':')));
+    else if(decoded.field == protocol::Field::Firmware)
+        update(address, "firmware", QString(bytes.toHex('.')));
+    else if(decoded.field == protocol::Field::Name)
+        update(address, "name", QString::fromUtf8(bytes));
+    else
+        return;
+    update(address, "last_seen", QDateTime::currentSecsSinceEpoch());
+}
+
+void FleetInventory::update(const QString &address, const QString &column, const QVariant &value)
+{
+    if(address.isEmpty())
+        return;
+    // only the last value of each column is written
+    m_pendingUpdates[address][column] = value;
+    if(m_pendingUpdates.size() >= maxBatchSize)
+        flush();
+    else if(!m_flushTimer->isActive())
+        m_flushTimer->start();
+}
+
+bool FleetInventory::flush()
+{
+    m_flushTimer->stop();
+    if(m_pendingUpdates.isEmpty() || !m_db.isOpen())
+        return true;
+
+    // one transaction for the whole batch
+    m_db.transaction();
+    QSqlQuery insertQuery(m_db);
+    insertQuery.prepare("INSERT OR IGNORE INTO devices(address) VALUES(?)");
+    bool result = true;
+    for(auto it = m_pendingUpdates.cbegin(); it != m_pendingUpdates.cend() && result; ++it)
+    {
+        insertQuery.addBindValue(it.key());
+        result = insertQuery.exec();
+
+        // the columns are fixed names in this file, not user input
+        QStringList assignments;
+        for(auto columnIt = it->cbegin(); columnIt != it->cend(); ++columnIt)
+            assignments.append(columnIt.key() + " = ?");
+        QSqlQuery updateQuery(m_db);
+        updateQuery.prepare("UPDATE devices SET " + assignments.join(", ") + " WHERE address = ?");
+        for(auto columnIt = it->cbegin(); columnIt != it->cend(); ++columnIt)
+            updateQuery.addBindValue(columnIt.value());
+        updateQuery.addBindValue(it.key());
+        result = result && updateQuery.exec();
+        if(!result)
+            qDebug() << "Inventory error:" << insertQuery.lastError().text() << updateQuery.lastError().text();
+    }
+    if(result)
+    {
+        result = m_db.commit();
+        m_pendingUpdates.clear();
+    }
+    else
+        m_db.rollback();
+    return result;
+}
+
+QList<FleetInventory::DeviceRecord> FleetInventory::find(const QString &model, const QString &firmware, int provisioned)
+{
+    QList<DeviceRecord> result;
+    // the pending updates should be visible
+    flush();
+    QStringList conditions;
+    QVariantList values;
+    if(!model.isEmpty())
+    {
+        conditions.append("model = ?");
+        values.append(model);
+    }
+    if(!firmware.isEmpty())
+    {
+        conditions.append("firmware = ?");
+        values.append(firmware);
+    }
+    if(provisioned >= 0)
+    {
+        conditions.append("provisioned = ?");
+        values.append(provisioned > 0 ? 1 : 0);
+    }
+    QString statement = "SELECT address, mac, model, firmware, name, last_profile, last_seen, provisioned FROM devices";
+    if(!conditions.isEmpty())
+        statement += " WHERE " + conditions.join(" AND ");
+    QSqlQuery query(m_db);
+    query.prepare(statement);
+    for(const auto& value : qAsConst(values))
+        query.addBindValue(value);
+    if(!query.exec())
+    {
+        qDebug() << "Inventory error:" << query.lastError().text();
+        return result;
+    }
+    while(query.next())
+        result.append(fromQuery(query));
+    return result;
+}
+
+FleetInventory::DeviceRecord FleetInventory::record(const QString &address)
+{
+    flush();
+    QSqlQuery query(m_db);
+    query.prepare("SELECT address, mac, model, firmware, name, last_profile, last_seen, provisioned FROM devices WHERE address = ?");
+    query.addBindValue(address);
+    if(query.exec() && query.next())
+        return fromQuery(query);
+    return DeviceRecord();
+}
+
+FleetInventory::DeviceRecord FleetInventory::fromQuery(const QSqlQuery &query)
+{
+    DeviceRecord record;
+    record.address = query.value(0).toString();
+    record.mac = query.value(1).toString();
+    record.model = query.value(2).toString();
+    record.firmware = query.value(3).toString();
+    record.name = query.value(4).toString();
+    record.lastProfile = query.value(5).toString();
+    record.lastSeen = query.value(6).toLongLong();
+    record.isProvisioned = query.value(7).toInt() != 0;
+    return record;
+}
+
+const char* FleetInventory::m_connectionName = "inventory";
@@ -0,0 +1,64 @@
+#ifndef FLEETINVENTORY_H
+#define FLEETINVENTORY_H
+
+#include <QObject>
+#include <QHash>
+#include <QTimer>
+#include <QVariant>
+#include <QSqlDatabase>
+
+class Comm;
+class QSqlQuery;
+
+// Persistent per-device knowledge in an embedded SQLite database.
+// Updates are merged in memory and written in one transaction per batch.
+class FleetInventory : public QObject
+{
+    Q_OBJECT
+public:
+    struct DeviceRecord
+    {
+        QString address; // the address used for connecting
+        QString mac; // from C8
+        QString model; // the key in deviceinfo.json
+        QString firmware; // from C6
+        QString name; // from C9
+        QString lastProfile;
+        qint64 lastSeen = 0; // seconds since epoch
+        bool isProvisioned = false;
+    };
+
+    explicit FleetInventory(QObject *parent = nullptr);
+    ~FleetInventory();
+
+    bool open(const QString& path);
+    void close();
+
+    // decodes C8/C6/C9 responses of this session
+    void addSession(const QString& address, Comm* comm);
+    void recordModel(const QString& address, const QString& model);
+    void recordProfile(const QString& address, const QString& profile);
+
+    // empty filters match everything, provisioned: -1 for any, 0 for no, 1 for yes
+    QList<DeviceRecord> find(const QString& model = QString(), const QString& firmware = QString(), int provisioned = -1);
+    DeviceRecord record(const QString& address);
+
+    static const int flushIntervalMs = 1000;
+    static const int maxBatchSize = 256;
+public slots:
+    bool flush();
+private:
+    QSqlDatabase m_db;
+    // address -> column -> value
+    QHash<QString, QHash<QString, QVariant>> m_pendingUpdates;
+    QTimer* m_flushTimer = nullptr;
+
+    bool createSchema();
+    void update(const QString& address, const QString& column, const QVariant& value);
+    void onNewData(const QString& address, const QByteArray& data);
+    static DeviceRecord fromQuery(const QSqlQuery& query);
+
+    static const char* m_connectionName;
+};
+
+#endif // FLEETINVENTORY_H
@@ -1,11 +1,11 @@
-QT += core gui bluetooth
+QT += core gui bluetooth sql network
 android {
     QT += androidextras
 }
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
-CONFIG += c++11
+CONFIG += c++17
 
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
@@ -16,21 +16,45 @@ SOURCES += \
     main.cpp \
     mainwindow.cpp \
     comms/comm.cpp \
+    comms/adapterbalancer.cpp \
+    comms/adaptermanager.cpp \
+    comms/connectionpool.cpp \
     comms/commrfcomm.cpp \
     comms/commble.cpp \
     comms/winbthelper.cpp \
     deviceform.cpp \
-    devices/basedevice.cpp
+    devices/basedevice.cpp \
+    devices/devicecatalog.cpp \
+    telemetry/telemetrysampler.cpp \
+    telemetry/tracerecorder.cpp \
+    inventory/fleetinventory.cpp \
+    scripting/provisionscript.cpp \
+    scripting/scriptexecutor.cpp \
+    scripting/clonejob.cpp \
+    control/controlserver.cpp
 
 HEADERS += \
     devform.h \
     mainwindow.h \
     comms/comm.h \
+    comms/adapterbalancer.h \
+    comms/adaptermanager.h \
+    comms/connectionpool.h \
+    comms/mpscqueue.h \
     comms/commrfcomm.h \
     comms/commble.h \
     comms/winbthelper.h \
     deviceform.h \
-    devices/basedevice.h
+    devices/basedevice.h \
+    devices/devicecatalog.h \
+    telemetry/timeseriesring.h \
+    telemetry/telemetrysampler.h \
+    telemetry/tracerecorder.h \
+    inventory/fleetinventory.h \
+    scripting/provisionscript.h \
+    scripting/scriptexecutor.h \
+    scripting/clonejob.h \
+    control/controlserver.h
 
 FORMS += \
     devform.ui \
@@ -66,3 +90,5 @@ win32: LIBS += -lBthprops
 
 RESOURCES += \
     devices/devices.qrc
+
+include(protocol/protocol.pri)
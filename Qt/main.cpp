@@ -1,6 +1,7 @@
 #include "mainwindow.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
 #include <QLocale>
 #include <QTranslator>
 
@@ -22,7 +23,23 @@ int main(int argc, char *argv[])
         }
     }
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption controlOption("control", QCoreApplication::translate("main", "Start the control server on <name>."), "name");
+    // the window is still created(the control server drives it), so a display is required
+    QCommandLineOption hiddenOption("hidden", QCoreApplication::translate("main", "Start the control server and keep the window hidden. A display is still required."));
+    parser.addOption(controlOption);
+    parser.addOption(hiddenOption);
+    parser.process(a);
+
     MainWindow w;
-    w.show();
+    const bool isHidden = parser.isSet(hiddenOption);
+    if(parser.isSet(controlOption) || isHidden)
+    {
+        if(!w.startControlServer(parser.value(controlOption)) && isHidden)
+            return 1;
+    }
+    if(!isHidden)
+        w.show();
     return a.exec();
 }
@@ -2,6 +2,8 @@
 #include "ui_mainwindow.h"
 #include "comms/commrfcomm.h"
 #include "comms/commble.h"
+#include "comms/adaptermanager.h"
+#include "telemetry/tracerecorder.h"
 
 #include <QDebug>
 #include <QScroller>
@@ -14,6 +16,14 @@
 #include <QTimer>
 #include <QFileInfo>
 #include <QStandardPaths>
+#include <QFileDialog>
+#include <QDir>
+#include <QDialog>
+#include <QDialogButtonBox>
+#include <QListWidget>
+#include <QCheckBox>
+#include <QVBoxLayout>
+#include <QLabel>
 #ifdef Q_OS_ANDROID
 #include <QtAndroid>
 #include <QAndroidJniEnvironment>
@@ -52,6 +62,71 @@ MainWindow::MainWindow(QWidget *parent)
 
     m_deviceForm->setSettings(m_settings);
 
+    qRegisterMetaType<QBluetoothDeviceInfo>();
+    qRegisterMetaType<QBluetoothAddress>();
+    // create the adapter cache in the GUI thread
+    AdapterManager::instance();
+    m_commThread = new QThread(this);
+    m_commThread->setObjectName("CommThread");
+    m_commThread->start();
+    m_adapterBalancer = new AdapterBalancer(this);
+    loadPinnedAdapters();
+
+    // [ConnectionPool]
+    // MaxIdle=3
+    // IdleTimeoutMs=60000
+    m_connectionPool = new ConnectionPool(this);
+    m_settings->beginGroup("ConnectionPool");
+    m_connectionPool->setMaxIdle(m_settings->value("MaxIdle", ConnectionPool::defaultMaxIdle).toInt());
+    m_connectionPool->setIdleTimeout(m_settings->value("IdleTimeoutMs", ConnectionPool::defaultIdleTimeoutMs).toInt());
+    m_settings->endGroup();
+
+    // [Telemetry]
+    // Enabled=true
+    m_telemetrySampler = new TelemetrySampler(this);
+    m_settings->beginGroup("Telemetry");
+    m_telemetrySampler->setEnabled(m_settings->value("Enabled", true).toBool());
+    m_settings->endGroup();
+
+    // [Trace]
+    // Enabled=false
+    // Capacity=100000
+    // the events of the command lifecycle, exported from the dev panel
+    TraceRecorder* traceRecorder = TraceRecorder::instance();
+    m_settings->beginGroup("Trace");
+    traceRecorder->setCapacity(m_settings->value("Capacity", TraceRecorder::defaultCapacity).toInt());
+    traceRecorder->setEnabled(m_settings->value("Enabled", false).toBool());
+    m_settings->endGroup();
+    m_devForm->setTraceEnabled(traceRecorder->isEnabled());
+
+    // [Inventory]
+    // Path=<path of the SQLite database>
+    m_inventory = new FleetInventory(this);
+    m_settings->beginGroup("Inventory");
+    QString inventoryPath = m_settings->value("Path").toString();
+    m_settings->endGroup();
+    if(inventoryPath.isEmpty())
+    {
+        QString dataDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+        QDir().mkpath(dataDir);
+        inventoryPath = dataDir + "/inventory.sqlite";
+    }
+    m_inventory->open(inventoryPath);
+
+    // [Control]
+    // Enabled=false
+    // SocketName=mEDIFIER
+    m_controlServer = new ControlServer(this);
+    m_controlServer->setAdapterBalancer(m_adapterBalancer);
+    connect(m_controlServer, &ControlServer::connectTo, this, &MainWindow::connectToDevice);
+    connect(m_controlServer, &ControlServer::disconnectDevice, this, &MainWindow::disconnectDevice);
+    connect(this, &MainWindow::commStateChanged, m_controlServer, &ControlServer::onCommStateChanged);
+    m_settings->beginGroup("Control");
+    const bool isControlEnabled = m_settings->value("Enabled", false).toBool();
+    m_settings->endGroup();
+    if(isControlEnabled)
+        startControlServer();
+
     ui->tabWidget->insertTab(0, m_deviceForm, tr("Device"));
     ui->tabWidget->setCurrentIndex(0);
 
@@ -61,9 +136,11 @@ MainWindow::MainWindow(QWidget *parent)
     connect(this, &MainWindow::commStateChanged, m_deviceForm, &DeviceForm::onCommStateChanged);
     connect(m_devForm, &DevForm::showMessage, this, &MainWindow::showMessage);
     connect(this, &MainWindow::devMessage, m_devForm, &DevForm::handleDevMessage);
+    connect(m_devForm, &DevForm::exportTelemetry, this, &MainWindow::exportTelemetry);
+    connect(m_devForm, &DevForm::traceEnabledChanged, this, [ = ](bool enabled) {TraceRecorder::instance()->setEnabled(enabled);});
+    connect(m_devForm, &DevForm::exportTrace, this, &MainWindow::exportTrace);
 
     loadDeviceInfo();
-    changeDevice("basedevice");
 
 #ifdef Q_OS_ANDROID
     ui->statusBar->hide();
@@ -75,52 +152,175 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    if(m_comm != nullptr)
+    {
+        ConnectionPool::closeSession(m_comm);
+        m_comm = nullptr;
+    }
+    // before stopping the thread, otherwise the queued close() is never called
+    delete m_cloneJob;
+    m_cloneJob = nullptr;
+    abortScript(tr("Closed"));
+    m_connectionPool->clear();
+    m_commThread->quit();
+    m_commThread->wait();
     delete ui;
 }
 
 void MainWindow::loadDeviceInfo()
 {
-    QFile deviceInfoFile(":/devices/deviceinfo.json");
-    deviceInfoFile.open(QIODevice::ReadOnly);
-    QJsonDocument deviceInfoDoc = QJsonDocument::fromJson(deviceInfoFile.readAll());
-    deviceInfoFile.close();
-    if(deviceInfoDoc.isObject())
-        m_deviceInfo = new QJsonObject(deviceInfoDoc.object());
+    // [Global]
+    // DeviceCatalogDir=<dir with extra *.json files, in the format of deviceinfo.json>
+    m_settings->beginGroup("Global");
+    QString catalogDir = m_settings->value("DeviceCatalogDir").toString();
+    m_settings->endGroup();
+    if(catalogDir.isEmpty())
+        catalogDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/devices";
+
+    m_deviceCatalog = new DeviceCatalog(this);
+    m_deviceCatalog->setExternalDir(catalogDir);
+    connect(m_deviceCatalog, &DeviceCatalog::catalogChanged, this, &MainWindow::onDeviceCatalogChanged);
+    m_deviceCatalog->reload();
+}
+
+void MainWindow::onDeviceCatalogChanged()
+{
+    QString currentDevice = ui->deviceBox->currentData().toString();
+    if(currentDevice.isEmpty())
+        currentDevice = "basedevice";
+
+    ui->deviceBox->blockSignals(true);
+    ui->deviceBox->clear();
+    const auto models = m_deviceCatalog->models();
+    for(const auto& model : models)
+        ui->deviceBox->addItem(tr(model.name.toUtf8()), model.key);
+    ui->deviceBox->blockSignals(false);
+
+    if(!m_deviceCatalog->contains(currentDevice))
+        currentDevice = "basedevice";
+    selectDevice(currentDevice);
+}
+
+void MainWindow::selectDevice(const QString& deviceName)
+{
+    int index = ui->deviceBox->findData(deviceName);
+    if(index == -1)
+        return;
+    if(index == ui->deviceBox->currentIndex())
+        changeDevice(deviceName); // the model might be updated
     else
-        qDebug() << "Failed to load Device Info";
+        ui->deviceBox->setCurrentIndex(index); // triggers changeDevice()
+}
 
-    for(auto it = m_deviceInfo->constBegin(); it != m_deviceInfo->constEnd(); ++it)
+void MainWindow::loadPinnedAdapters()
+{
+    // [PinnedAdapters]
+    // <remote address>=<local adapter address>
+    m_settings->beginGroup("PinnedAdapters");
+    const QStringList remoteList = m_settings->childKeys();
+    for(const QString& remote : remoteList)
     {
-        QJsonObject details = it->toObject();
-        ui->deviceBox->addItem(tr(details["Name"].toString().toUtf8()), it.key());
-        QString serviceUUID = details["UniqueServiceUUID"].toString();
-        if(!serviceUUID.isEmpty())
-            m_deviceServiceMap[QBluetoothUuid(serviceUUID)] = it.key();
+        QBluetoothAddress remoteAddress(remote);
+        QBluetoothAddress localAddress(m_settings->value(remote).toString());
+        if(!remoteAddress.isNull() && !localAddress.isNull())
+            m_adapterBalancer->setPinnedAdapter(remoteAddress, localAddress);
     }
+    m_settings->endGroup();
 }
 
 void MainWindow::connectToDevice(const QBluetoothDeviceInfo& address, bool isBLE)
 {
-    if(m_comm != nullptr)
+    abortScript(tr("Device changed"));
+    releaseComm();
+    if(m_connected)
     {
-        m_comm->deleteLater();
-        m_comm = nullptr;
+        m_connected = false;
+        emit commStateChanged(false);
     }
-    if(isBLE)
-        m_comm = new CommBLE;
-    else
-        m_comm = new CommRFCOMM;
+    m_currentAddress = address.address().toString();
+    QString pooledModel;
+    m_comm = m_connectionPool->acquire(m_currentAddress, isBLE, &pooledModel);
+    const bool isPooled = m_comm != nullptr;
+    if(!isPooled)
+    {
+        if(isBLE)
+            m_comm = new CommBLE;
+        else
+            m_comm = new CommRFCOMM;
+        m_comm->setLocalAddress(m_adapterBalancer->attach(m_comm, address.address()));
+        m_telemetrySampler->addSession(m_currentAddress, m_comm);
+        m_inventory->addSession(m_currentAddress, m_comm);
+        m_comm->moveToThread(m_commThread);
+    }
+    // [Connection]
+    // AutoReconnect=true
+    m_settings->beginGroup("Connection");
+    m_comm->setAutoReconnect(m_settings->value("AutoReconnect", true).toBool());
+    m_settings->endGroup();
+    m_controlServer->setSession(m_comm, m_currentAddress);
 
     connect(m_comm, &Comm::stateChanged, this, &MainWindow::onCommStateChanged);
     connect(m_comm, &Comm::showMessage, this, &MainWindow::showMessage);
+    connect(m_comm, &Comm::requestFailed, this, &MainWindow::onCommRequestFailed);
+    connect(m_comm, &Comm::transferFailed, this, [ = ](const QString & reason) {showMessage(tr("Transfer failed") + ": " + reason);});
+    connect(m_comm, &Comm::reconnecting, this, [ = ](int attempt, int delayMs)
+    {
+        showMessage(tr("Connection lost, reconnecting in %1 s (attempt %2)").arg(delayMs / 1000.0).arg(attempt));
+    });
     connectDevice2Comm();
 
-    m_comm->open(address);
+    if(isPooled)
+    {
+        // the device feature was reported on the first connection
+        if(!pooledModel.isEmpty())
+            selectDevice(pooledModel);
+        // checked after stateChanged() is connected, so a later drop still reaches onCommStateChanged()
+        if(m_comm->isOpen())
+        {
+            onCommStateChanged(true);
+            showMessage(tr("Device Connected"));
+            return;
+        }
+        // the link dropped while it was parked, the session is opened again
+        qDebug() << "pool: session lost" << m_currentAddress;
+    }
+
+    // BLE devices are detected by the service UUID after connected
+    if(!isBLE)
+    {
+        const DeviceCatalog::DeviceModel* model = m_deviceCatalog->findByName(address.name());
+        if(model != nullptr)
+            selectDevice(model->key);
+    }
+
+    QMetaObject::invokeMethod(m_comm, "open", Qt::QueuedConnection, Q_ARG(QBluetoothDeviceInfo, address));
+}
+
+void MainWindow::releaseComm(bool isKept)
+{
+    if(m_comm == nullptr)
+        return;
+    // BaseDevice calls Comm::sendCommand() directly, disconnect it before releasing
+    if(m_device != nullptr)
+    {
+        m_device->disconnect(m_comm);
+        m_comm->disconnect(m_device);
+        // the responses of this session won't reach the panel any more
+        m_device->failPendingProfile(tr("session released"));
+    }
+    m_comm->disconnect(this);
+    m_controlServer->setSession(nullptr, QString());
+    // a live session is kept in the pool, so connecting to it again is instant
+    const bool isBLE = qobject_cast<CommBLE*>(m_comm) != nullptr;
+    if(!isKept || !m_connected || !m_connectionPool->release(m_currentAddress, isBLE, m_comm, ui->deviceBox->currentData().toString()))
+        ConnectionPool::closeSession(m_comm);
+    m_comm = nullptr;
 }
 
 void MainWindow::disconnectDevice()
 {
-    m_comm->close();
+    // the user asked for it, the link is not kept in the pool
+    releaseComm(false);
     m_connected = false;
     emit commStateChanged(false);
 }
@@ -130,15 +330,239 @@ void MainWindow::onCommStateChanged(bool state)
     if(!m_connected && state)
     {
         m_connected = true;
+        m_inventory->recordModel(m_currentAddress, ui->deviceBox->currentData().toString());
         emit commStateChanged(true);
     }
     else if(m_connected && !state)
     {
         m_connected = false;
+        abortScript(tr("Disconnected"));
         emit commStateChanged(false);
     }
 }
 
+void MainWindow::onCommRequestFailed(const QByteArray& cmd, const QString& reason)
+{
+    showMessage(tr("Command failed") + ": " + cmd.toHex().toUpper() + " (" + reason + ")");
+}
+
+void MainWindow::exportTelemetry()
+{
+    QString filename = QFileDialog::getSaveFileName(this, tr("Export Telemetry"), "telemetry.csv");
+    if(filename.isEmpty())
+        return;
+    QFile file(filename);
+    if(!file.open(QFile::WriteOnly | QFile::Truncate) || !m_telemetrySampler->exportCsv(&file))
+        QMessageBox::information(this, tr("Error"), tr("Failed to save to") + "\n" + filename);
+    else
+        showMessage(tr("Saved"));
+}
+
+void MainWindow::exportTrace()
+{
+    QString filename = QFileDialog::getSaveFileName(this, tr("Export Trace"), "trace.json");
+    if(filename.isEmpty())
+        return;
+    QFile file(filename);
+    if(!file.open(QFile::WriteOnly | QFile::Truncate) || !TraceRecorder::instance()->exportJson(&file))
+        QMessageBox::information(this, tr("Error"), tr("Failed to save to") + "\n" + filename);
+    else
+        showMessage(tr("Saved") + QString(" (%1 events)").arg(TraceRecorder::instance()->eventCount()));
+}
+
+void MainWindow::onProfileApplied(const QString& profile)
+{
+    if(m_connected)
+        m_inventory->recordProfile(m_currentAddress, profile);
+}
+
+bool MainWindow::startControlServer(const QString& name)
+{
+    QString serverName = name;
+    if(serverName.isEmpty())
+    {
+        m_settings->beginGroup("Control");
+        serverName = m_settings->value("SocketName", "mEDIFIER").toString();
+        m_settings->endGroup();
+    }
+    if(!m_controlServer->listen(serverName))
+    {
+        showMessage(tr("Failed to start the control server"));
+        return false;
+    }
+    return true;
+}
+
+void MainWindow::runScript(const QString& filename)
+{
+    // foreach runs over the search results, the connected device is used outside of it
+    QList<ScriptExecutor::Target> targets;
+    if(m_connected && m_comm != nullptr)
+        targets.append({m_currentAddress, m_comm});
+    const auto devices = m_deviceForm->shownDevices();
+    for(const auto& device : devices)
+    {
+        const QString address = device.first.address().toString();
+        if(!targets.isEmpty() && address == m_currentAddress)
+            continue;
+        targets.append({address, nullptr, device.first, device.second});
+    }
+    if(targets.isEmpty())
+    {
+        showMessage(tr("Device not connected"));
+        return;
+    }
+    if(m_scriptExecutor != nullptr && m_scriptExecutor->isRunning())
+    {
+        showMessage(tr("A script is already running"));
+        return;
+    }
+    ProvisionScript script;
+    QString errorString;
+    if(!script.load(filename, &errorString))
+    {
+        QMessageBox::information(this, tr("Error"), errorString);
+        return;
+    }
+    if(m_scriptExecutor != nullptr)
+        m_scriptExecutor->deleteLater();
+    m_scriptExecutor = new ScriptExecutor(script, targets, this);
+    m_scriptExecutor->setSessionFactory([ = ](const QBluetoothDeviceInfo & info, bool isBLE) {return createSession(info, isBLE);});
+    connect(m_scriptExecutor, &ScriptExecutor::log, this, [ = ](const QString & msg) {qDebug() << "script:" << msg;});
+    connect(m_scriptExecutor, &ScriptExecutor::finished, this, [ = ](bool success, const QString & message)
+    {
+        showMessage((success ? tr("Script finished") : tr("Script failed")) + ": " + message);
+    });
+    m_scriptExecutor->start();
+}
+
+Comm* MainWindow::createSession(const QBluetoothDeviceInfo& info, bool isBLE)
+{
+    const QString address = info.address().toString();
+    // a parked session would hold the link
+    ConnectionPool::closeSession(m_connectionPool->acquire(address, isBLE));
+    Comm* comm;
+    if(isBLE)
+        comm = new CommBLE;
+    else
+        comm = new CommRFCOMM;
+    comm->setLocalAddress(m_adapterBalancer->attach(comm, info.address()));
+    m_inventory->addSession(address, comm);
+    comm->moveToThread(m_commThread);
+    return comm;
+}
+
+void MainWindow::startClone()
+{
+    const DeviceCatalog::DeviceModel* model = m_deviceCatalog->model(ui->deviceBox->currentData().toString());
+    if(!m_connected || m_comm == nullptr || model == nullptr)
+    {
+        showMessage(tr("Device not connected"));
+        return;
+    }
+    if(m_cloneJob != nullptr && m_cloneJob->isRunning())
+    {
+        showMessage(tr("A clone is already running"));
+        return;
+    }
+
+    // the targets are picked from the search results
+    QDialog dialog(this);
+    dialog.setWindowTitle(tr("Clone to Devices"));
+    QVBoxLayout* layout = new QVBoxLayout(&dialog);
+    layout->addWidget(new QLabel(tr("Devices to receive the settings of %1").arg(m_currentAddress)));
+    QListWidget* targetList = new QListWidget;
+    const auto devices = m_deviceForm->shownDevices();
+    QList<CloneJob::Target> candidates;
+    for(const auto& device : devices)
+    {
+        if(device.first.address().toString() == m_currentAddress)
+            continue;
+        QListWidgetItem* item = new QListWidgetItem(device.first.name() + " " + device.first.address().toString() + (device.second ? " BLE" : ""), targetList);
+        item->setCheckState(Qt::Checked);
+        candidates.append({device.first, device.second});
+    }
+    layout->addWidget(targetList);
+    QCheckBox* saveProfileBox = new QCheckBox(tr("Save the settings as a profile"));
+    layout->addWidget(saveProfileBox);
+    QDialogButtonBox* buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel);
+    connect(buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+    layout->addWidget(buttons);
+    if(candidates.isEmpty())
+    {
+        showMessage(tr("Search for the target devices first"));
+        return;
+    }
+    if(dialog.exec() != QDialog::Accepted)
+        return;
+    QList<CloneJob::Target> targets;
+    for(int i = 0; i < candidates.length(); i++)
+    {
+        if(targetList->item(i)->checkState() == Qt::Checked)
+            targets.append(candidates[i]);
+    }
+    if(targets.isEmpty())
+        return;
+    const bool isSavingProfile = saveProfileBox->isChecked();
+
+    if(m_cloneJob != nullptr)
+        m_cloneJob->deleteLater();
+    m_cloneJob = new CloneJob([ = ](const QBluetoothDeviceInfo & info, bool isBLE) {return createSession(info, isBLE);}, this);
+
+    // [Clone]
+    // MaxParallel=4
+    // MaxAttempts=3
+    m_settings->beginGroup("Clone");
+    m_cloneJob->setMaxParallel(m_settings->value("MaxParallel", CloneJob::defaultMaxParallel).toInt());
+    m_cloneJob->setMaxAttempts(m_settings->value("MaxAttempts", CloneJob::defaultMaxAttempts).toInt());
+    m_settings->endGroup();
+
+    const QString reference = m_currentAddress;
+    const QString deviceName = model->key;
+    CloneJob* job = m_cloneJob;
+    connect(job, &CloneJob::referenceRead, this, [ = ](bool success, const QString & message)
+    {
+        if(!success)
+        {
+            QMessageBox::information(this, tr("Error"), message);
+            return;
+        }
+        if(!message.isEmpty())
+            showMessage(message);
+        if(isSavingProfile)
+        {
+            QString filename = QFileDialog::getSaveFileName(this, tr("Save Settings"), deviceName + ".json");
+            QFile file(filename);
+            if(!filename.isEmpty() && (!file.open(QFile::WriteOnly | QFile::Truncate) || file.write(QJsonDocument(job->profile(deviceName)).toJson()) < 0))
+                QMessageBox::information(this, tr("Error"), tr("Failed to save to") + "\n" + filename);
+        }
+        job->start(targets);
+    });
+    connect(job, &CloneJob::unitStateChanged, this, [ = ](const QString & address, CloneJob::UnitState state, const QString & message)
+    {
+        showMessage(address + ": " + CloneJob::stateName(state) + (message.isEmpty() ? "" : " (" + message + ")"));
+        if(state == CloneJob::UnitState::Matched)
+            m_inventory->recordProfile(address, tr("clone of %1").arg(reference));
+    });
+    connect(job, &CloneJob::finished, this, [ = ](int matched, int total)
+    {
+        QMessageBox::information(this, tr("Clone finished"), tr("%1 of %2 devices match %3").arg(matched).arg(total).arg(reference) + "\n\n" + job->summary());
+    });
+    job->readReference(m_comm, model->queryPlan);
+}
+
+void MainWindow::abortScript(const QString& reason)
+{
+    // the executor holds raw Comm pointers
+    if(m_scriptExecutor != nullptr)
+    {
+        m_scriptExecutor->abort(reason);
+        m_scriptExecutor->deleteLater();
+        m_scriptExecutor = nullptr;
+    }
+}
+
 void MainWindow::on_readSettingsButton_clicked()
 {
     if(m_connected)
@@ -202,30 +626,33 @@ void MainWindow::showMessage(const QString& msg)
 void MainWindow::changeDevice(const QString& deviceName)
 {
     // the deviceName is the key in deviceinfo.json, not "Name"
-    if(!m_deviceInfo->contains(deviceName))
+    const DeviceCatalog::DeviceModel* model = m_deviceCatalog->model(deviceName);
+    if(model == nullptr)
         return;
-    if(m_device != nullptr)
-        m_device->deleteLater();
-    QJsonObject details = m_deviceInfo->value(deviceName).toObject();
-    m_device = new BaseDevice;
-    m_device->setDeviceName(deviceName);
-    m_device->setWindowTitle(tr(details["Name"].toString().toUtf8()));
-    m_device->setMaxNameLength(details["MaxNameLength"].toInt());
-    const QVariantList hiddenFeatureList = details["HiddenFeatures"].toArray().toVariantList();
-    for(const auto& it : hiddenFeatureList)
+    if(m_device == nullptr)
     {
-        m_device->hideWidget(it.toString());
+        // the panel is created once and reconfigured for each model
+        m_device = new BaseDevice;
+        connect(this, &MainWindow::readSettings, m_device, &BaseDevice::readSettings);
+        connect(m_device, &BaseDevice::showMessage, this, &MainWindow::showMessage);
+        connect(m_device, &BaseDevice::connectToAudio, this, &MainWindow::connectToAudio);
+        connect(m_device, &BaseDevice::updateLastAudioDeviceAddress, this, &MainWindow::updateLastAudioDeviceAddress);
+        connect(m_device, &BaseDevice::profileApplied, this, &MainWindow::onProfileApplied);
+        connect(m_device, &BaseDevice::runScript, this, &MainWindow::runScript);
+        connect(m_device, &BaseDevice::cloneRequested, this, &MainWindow::startClone);
+        ui->scrollAreaWidgetContents->layout()->addWidget(m_device);
     }
-
-    connect(this, &MainWindow::readSettings, m_device, &BaseDevice::readSettings);
-    connect(m_device, &BaseDevice::showMessage, this, &MainWindow::showMessage);
-    connect(m_device, &BaseDevice::connectToAudio, this, &MainWindow::connectToAudio);
-    connect(m_device, &BaseDevice::updateLastAudioDeviceAddress, this, &MainWindow::updateLastAudioDeviceAddress);
-
-    connectDevice2Comm();
+    m_device->setDeviceName(deviceName);
+    m_controlServer->setDevice(m_device);
+    m_controlServer->setModel(deviceName);
+    m_device->setWindowTitle(tr(model->name.toUtf8()));
+    m_device->setMaxNameLength(model->maxNameLength);
+    m_device->setHiddenFeatures(model->hiddenFeatures);
+    m_device->setCapabilities(*model);
 
     ui->tabWidget->setTabText(1, m_device->windowTitle());
-    ui->scrollAreaWidgetContents->layout()->addWidget(m_device);
+    if(m_connected)
+        m_inventory->recordModel(m_currentAddress, deviceName);
 }
 
 void MainWindow::on_deviceBox_currentIndexChanged(int index)
@@ -241,9 +668,15 @@ void MainWindow::connectDevice2Comm()
         qDebug() << "Error: Failed to connect Device to Comm";
         return;
     }
-    connect(m_device, QOverload<const QByteArray&, bool>::of(&BaseDevice::sendCommand), m_comm, QOverload<const QByteArray&, bool>::of(&Comm::sendCommand));
-    connect(m_device, QOverload<const char*, bool>::of(&BaseDevice::sendCommand), m_comm, QOverload<const char*, bool>::of(&Comm::sendCommand));
+    // Comm::sendCommand() is thread-safe, call it directly to skip the event loop
+    connect(m_device, QOverload<const QByteArray&, bool>::of(&BaseDevice::sendCommand), m_comm, QOverload<const QByteArray&, bool>::of(&Comm::sendCommand), Qt::DirectConnection);
+    connect(m_device, QOverload<const char*, bool>::of(&BaseDevice::sendCommand), m_comm, QOverload<const char*, bool>::of(&Comm::sendCommand), Qt::DirectConnection);
+    connect(m_device, &BaseDevice::scheduleCommand, m_comm, &Comm::scheduleCommand, Qt::DirectConnection);
+    // Comm lives in m_commThread, so this is a queued connection
     connect(m_comm, &Comm::newData, m_device, &BaseDevice::processData);
+    connect(m_comm, &Comm::writeVerified, m_device, &BaseDevice::onWriteVerified);
+    connect(m_comm, &Comm::requestCompleted, m_device, &BaseDevice::onRequestCompleted);
+    connect(m_comm, &Comm::requestFailed, m_device, &BaseDevice::onRequestFailed);
     connect(m_comm, &Comm::deviceFeature, this, &MainWindow::processDeviceFeature);
 
     // Calling MainWindow::connectDevice2Comm() indicates the m_device is reconnected
@@ -257,10 +690,10 @@ void MainWindow::processDeviceFeature(const QString& feature, bool isBLE)
     {
         QBluetoothUuid serviceUUID = QBluetoothUuid(feature);
         qDebug() << "Device service UUID:" << feature;
-        if(m_deviceServiceMap.contains(serviceUUID))
+        const DeviceCatalog::DeviceModel* model = m_deviceCatalog->findByServiceUUID(serviceUUID);
+        if(model != nullptr)
         {
-            int index = ui->deviceBox->findData(m_deviceServiceMap[serviceUUID]);
-            ui->deviceBox->setCurrentIndex(index); // triggers changeDevice()
+            selectDevice(model->key);
             showMessage(tr("Device detected") + ": " + ui->deviceBox->currentText());
         }
     }
@@ -295,8 +728,15 @@ void MainWindow::on_tabWidget_tabBarClicked(int index)
 
 void MainWindow::devMessageHandler(QtMsgType type, const QMessageLogContext& context, const QString& msg)
 {
-    if(m_ptr != nullptr)
-        emit m_ptr->devMessage(type, context, msg);
+    if(m_ptr == nullptr)
+        return;
+    // QMessageLogContext can't be queued, Comm logs from the I/O thread
+    const QString file = context.file ? context.file : "";
+    const QString function = context.function ? context.function : "";
+    QString extraInfo;
+    if(file.isEmpty() || function.isEmpty())
+        extraInfo = QString(" (%1:%2, %3)").arg(file).arg(context.line).arg(function);
+    emit m_ptr->devMessage(DevForm::typeName(type), msg + extraInfo);
 }
 
 
@@ -4,11 +4,20 @@
 #include <QMainWindow>
 #include <QJsonObject>
 #include <QSettings>
+#include <QThread>
 
 #include "deviceform.h"
 #include "devform.h"
 #include "comms/comm.h"
+#include "comms/adapterbalancer.h"
+#include "comms/connectionpool.h"
 #include "devices/basedevice.h"
+#include "devices/devicecatalog.h"
+#include "telemetry/telemetrysampler.h"
+#include "inventory/fleetinventory.h"
+#include "scripting/scriptexecutor.h"
+#include "scripting/clonejob.h"
+#include "control/controlserver.h"
 
 
 QT_BEGIN_NAMESPACE
@@ -26,6 +35,9 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    // name: see ControlServer::listen(), an empty name means the one in preference.ini
+    bool startControlServer(const QString& name = QString());
+
     static void devMessageHandler(QtMsgType type, const QMessageLogContext& context, const QString& msg);
 public slots:
     void showMessage(const QString &msg);
@@ -38,10 +50,21 @@ private:
     DeviceForm* m_deviceForm = nullptr;
     DevForm* m_devForm = nullptr;
     Comm* m_comm = nullptr;
+    // all Comm objects live in this thread
+    QThread* m_commThread = nullptr;
+    AdapterBalancer* m_adapterBalancer = nullptr;
+    // recently used sessions which are still connected
+    ConnectionPool* m_connectionPool = nullptr;
     bool m_connected = false;
     BaseDevice* m_device = nullptr;
-    QJsonObject* m_deviceInfo = nullptr;
-    QHash<QBluetoothUuid, QString> m_deviceServiceMap;
+    DeviceCatalog* m_deviceCatalog = nullptr;
+    TelemetrySampler* m_telemetrySampler = nullptr;
+    FleetInventory* m_inventory = nullptr;
+    ScriptExecutor* m_scriptExecutor = nullptr;
+    CloneJob* m_cloneJob = nullptr;
+    ControlServer* m_controlServer = nullptr;
+    // the address of the current session
+    QString m_currentAddress;
     int m_clickCounter = 0;
     bool m_isDevMode = false;
     QSettings* m_settings = nullptr;
@@ -50,14 +73,29 @@ private:
 
     void changeDevice(const QString &deviceName);
     void connectDevice2Comm();
+    // a session for a script or clone target, not the current one, close it with ConnectionPool::closeSession()
+    Comm* createSession(const QBluetoothDeviceInfo& info, bool isBLE);
     void loadDeviceInfo();
+    void selectDevice(const QString &deviceName);
+    void loadPinnedAdapters();
+    void abortScript(const QString& reason);
+    // parks m_comm in m_connectionPool or closes it
+    // isKept: a live session is parked in the pool
+    void releaseComm(bool isKept = true);
 private slots:
     void connectToDevice(const QBluetoothDeviceInfo &address, bool isBLE);
     void disconnectDevice();
     void onCommStateChanged(bool state);
+    void onCommRequestFailed(const QByteArray& cmd, const QString& reason);
     void on_readSettingsButton_clicked();
 
     void on_deviceBox_currentIndexChanged(int index);
+    void onDeviceCatalogChanged();
+    void exportTelemetry();
+    void exportTrace();
+    void onProfileApplied(const QString &profile);
+    void runScript(const QString &filename);
+    void startClone();
 
     void processDeviceFeature(const QString &feature, bool isBLE);
     void on_tabWidget_tabBarClicked(int index);
@@ -65,6 +103,7 @@ private slots:
 signals:
     void commStateChanged(bool connected);
     void readSettings();
-    void devMessage(QtMsgType type, const QMessageLogContext& context, const QString& msg);
+    // see DevForm::handleDevMessage()
+    void devMessage(const QString& type, const QString& msg);
 };
 #endif // MAINWINDOW_H
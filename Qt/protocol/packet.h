@@ -0,0 +1,29 @@
+#ifndef PROTOCOL_PACKET_H
+#define PROTOCOL_PACKET_H
+
+#include <cstddef>
+
+#include "protocol.h"
+
+namespace protocol
+{
+
+// A whole frame(head, len, payload and checksum) in a fixed-size buffer
+struct Packet
+{
+    std::size_t size = 0;
+    std::byte data[maxFrameLen];
+
+    ByteSpan buffer()
+    {
+        return ByteSpan(data, maxFrameLen);
+    }
+    ConstByteSpan bytes() const
+    {
+        return ConstByteSpan(data, size);
+    }
+};
+
+} // namespace protocol
+
+#endif // PROTOCOL_PACKET_H
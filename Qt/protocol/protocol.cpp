@@ -0,0 +1,376 @@
+#include "protocol.h"
+
+namespace protocol
+{
+
+namespace
+{
+
+inline std::uint8_t at(ConstByteSpan data, std::size_t i)
+{
+    return static_cast<std::uint8_t>(data[i]);
+}
+
+inline bool isRxHead(std::uint8_t head)
+{
+    return head == responseHead || head == notificationHead;
+}
+
+} // namespace
+
+std::uint16_t checksum(ConstByteSpan data)
+{
+    std::uint16_t sum = checksumSeed;
+    for(std::byte i : data)
+        sum += static_cast<std::uint8_t>(i);
+    return sum;
+}
+
+bool verifyChecksum(ConstByteSpan frame)
+{
+    if(frame.size() < headerLen + checksumLen)
+        return false;
+    const std::size_t len = frame.size() - checksumLen;
+    const std::uint16_t expected = checksum(frame.first(len));
+    return at(frame, len) == (expected >> 8) && at(frame, len + 1) == (expected & 0xFF);
+}
+
+std::size_t encodeFrame(ConstByteSpan cmd, ByteSpan out)
+{
+    const std::size_t frameLen = headerLen + cmd.size() + checksumLen;
+    if(cmd.empty() || cmd.size() > maxPayloadLen || out.size() < frameLen)
+        return 0;
+    out[0] = std::byte{commandHead};
+    out[1] = static_cast<std::byte>(cmd.size());
+    for(std::size_t i = 0; i < cmd.size(); i++)
+        out[headerLen + i] = cmd[i];
+    const std::uint16_t sum = checksum(ConstByteSpan(out.data(), headerLen + cmd.size()));
+    out[frameLen - 2] = static_cast<std::byte>(sum >> 8);
+    out[frameLen - 1] = static_cast<std::byte>(sum & 0xFF);
+    return frameLen;
+}
+
+FrameResult checkFrame(ConstByteSpan buffer)
+{
+    FrameResult result;
+    if(buffer.empty())
+        return result;
+    if(!isRxHead(at(buffer, 0)))
+    {
+        result.status = FrameStatus::BadHead;
+        return result;
+    }
+    if(buffer.size() < headerLen)
+        return result;
+    result.length = headerLen + at(buffer, 1) + checksumLen;
+    if(buffer.size() < result.length)
+        return result;
+    result.status = verifyChecksum(buffer.first(result.length)) ? FrameStatus::Complete : FrameStatus::BadChecksum;
+    return result;
+}
+
+std::size_t findNextHead(ConstByteSpan buffer, std::size_t from)
+{
+    for(std::size_t i = from; i < buffer.size(); i++)
+    {
+        if(isRxHead(at(buffer, i)))
+            return i;
+    }
+    return buffer.size();
+}
+
+namespace
+{
+
+// the settings reported by 0xCC notifications, the cmd bytes are the same as the setting commands
+bool decodeNotification(ConstByteSpan data, std::size_t len, std::uint8_t cmd, Decoded& out)
+{
+    if(len == 1 && cmd == 0xD2)
+    {
+        out.field = Field::ShutdownTimerEnabled;
+        out.value = 0;
+        return true;
+    }
+    if(len == 2)
+    {
+        const std::uint8_t ch = at(data, 3);
+        out.value = ch;
+        switch(cmd)
+        {
+        case 0xC1:
+            out.field = Field::NoiseMode;
+            out.extra = -1;
+            break;
+        case 0xC4:
+            out.field = Field::SoundEffect;
+            break;
+        case 0x09:
+            out.field = Field::GameMode;
+            out.value = ch == 0x01;
+            break;
+        case 0x49:
+            out.field = Field::LDAC;
+            break;
+        case 0x06:
+            out.field = Field::PromptVolume;
+            break;
+        case 0xD6:
+            out.field = Field::AutoPoweroff;
+            out.value = ch == 0x01;
+            break;
+        case 0xD2:
+            out.field = Field::ShutdownTimerEnabled;
+            out.value = 0;
+            break;
+        case 0xC2:
+            out.field = Field::PlaybackControl;
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+    if(len == 3)
+    {
+        if(cmd == 0xC1 && at(data, 3) == 0x03)
+        {
+            out.field = Field::NoiseMode;
+            out.value = 3;
+            out.extra = static_cast<int>(at(data, 4)) - 6;
+        }
+        else if(cmd == 0xD1 && at(data, 3) == 0x00)
+        {
+            out.field = Field::ShutdownTimer;
+            out.value = at(data, 4);
+        }
+        else if(cmd == 0xF1 && at(data, 3) == 0x0A)
+        {
+            out.field = Field::ControlSettings;
+            out.value = at(data, 4);
+        }
+        else
+            return false;
+        return true;
+    }
+    return false;
+}
+
+bool decodeResponse(ConstByteSpan data, std::size_t len, std::uint8_t cmd, Decoded& out)
+{
+    if(len == 2)
+    {
+        // cmd + single byte response
+        const std::uint8_t ch = at(data, 3);
+        out.value = ch;
+        switch(cmd)
+        {
+        case 0xD5:
+            out.field = Field::SoundEffect;
+            break;
+        case 0x08:
+            out.field = Field::GameMode;
+            out.value = ch == 0x01;
+            break;
+        case 0xD0:
+            out.field = Field::Battery;
+            break;
+        case 0x48:
+            out.field = Field::LDAC;
+            break;
+        case 0x05:
+            out.field = Field::PromptVolume;
+            break;
+        case 0xD3:
+            out.field = Field::ShutdownTimerEnabled;
+            out.value = ch != 0x00;
+            break;
+        case 0xD7:
+            out.field = Field::AutoPoweroff;
+            out.value = ch == 0x01;
+            break;
+        // the echoes of the setting commands
+        case 0x09:
+            out.field = Field::GameMode;
+            out.value = ch == 0x01;
+            break;
+        case 0x49:
+            out.field = Field::LDAC;
+            break;
+        case 0x06:
+            out.field = Field::PromptVolume;
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+    else if(len > 2)
+    {
+        if(cmd == 0xC8 && len == 7)
+        {
+            out.field = Field::MACAddress;
+            out.bytes = data.subspan(3, 6);
+        }
+        else if(cmd == 0xC6 && len == 4)
+        {
+            out.field = Field::Firmware;
+            out.bytes = data.subspan(3, 3);
+        }
+        else if(cmd == 0xCC && len == 3)
+        {
+            out.field = Field::NoiseMode;
+            out.value = at(data, 3);
+            out.extra = static_cast<int>(at(data, 4)) - 6;
+        }
+        else if(cmd == 0xC9)
+        {
+            out.field = Field::Name;
+            out.bytes = data.subspan(3, len - 1);
+        }
+        else if(cmd == 0xF0 && len == 3 && at(data, 3) == 0x0A)
+        {
+            out.field = Field::ControlSettings;
+            out.value = at(data, 4);
+        }
+        else if(cmd == 0xD3 && len == 3)
+        {
+            out.field = Field::ShutdownTimer;
+            out.value = at(data, 4);
+        }
+        // the echo of C1(noise mode), same layout as the response of CC
+        else if(cmd == 0xC1 && len == 3)
+        {
+            out.field = Field::NoiseMode;
+            out.value = at(data, 3);
+            out.extra = static_cast<int>(at(data, 4)) - 6;
+        }
+        else if(cmd == 0xF1 && len == 3 && at(data, 3) == 0x0A)
+        {
+            out.field = Field::ControlSettings;
+            out.value = at(data, 4);
+        }
+        else
+            return false;
+        return true;
+    }
+    return false;
+}
+
+// the settings answered with 0x01 instead of the value: rename, shutdown timer on/off
+bool isAcknowledgedOnly(std::uint8_t cmd)
+{
+    return cmd == 0xCA || cmd == 0xD1 || cmd == 0xD2;
+}
+
+// only the ones captured in doc/KnownCommands, the response of D6(auto poweroff) is unknown
+bool isEchoedSetting(std::uint8_t cmd)
+{
+    switch(cmd)
+    {
+    case 0xC1: // noise mode, ambient sound volume
+    case 0xC4: // sound effect
+    case 0x06: // prompt volume
+    case 0x09: // game mode
+    case 0x49: // LDAC
+    case 0xF1: // control settings
+        return true;
+    default:
+        return false;
+    }
+}
+
+} // namespace
+
+std::uint8_t replyHead(ConstByteSpan cmd)
+{
+    if(cmd.empty())
+        return 0;
+    const std::uint8_t type = at(cmd, 0);
+    if(isAcknowledgedOnly(type) || type == 0xC4)
+        return notificationHead;
+    // poweroff, disconnect, re-pair and reset are never answered
+    if(type == 0xCE || type == 0xCD || type == 0xCF || type == 0x07)
+        return 0;
+    // queries have no argument, except F00A(control settings)
+    if(cmd.size() == 1 || type == 0xF0)
+        return responseHead;
+    switch(type)
+    {
+    case 0xC1:
+    case 0xF1:
+    case 0x06:
+    case 0x09:
+    case 0x49:
+        return responseHead;
+    default:
+        return 0;
+    }
+}
+
+EchoStatus checkEcho(ConstByteSpan cmd, ConstByteSpan response)
+{
+    if(cmd.empty() || response.size() < 3 || response.size() < headerLen + at(response, 1))
+        return EchoStatus::NotApplicable;
+    const std::uint8_t type = at(cmd, 0);
+    const std::size_t len = at(response, 1);
+    if(!isRxHead(at(response, 0)) || len == 0 || at(response, 2) != type)
+        return EchoStatus::NotApplicable;
+    // a notification with the same cmd byte(like a button press) is not the echo
+    const std::uint8_t expectedHead = replyHead(cmd);
+    if(expectedHead != 0 && expectedHead != at(response, 0))
+        return EchoStatus::NotApplicable;
+
+    if(isAcknowledgedOnly(type))
+    {
+        // D2 without argument is acknowledged with 01 as well
+        if(len == 2 && at(response, 3) == 0x01)
+            return EchoStatus::Acknowledged;
+        return EchoStatus::Mismatched;
+    }
+    if(!isEchoedSetting(type))
+        return EchoStatus::NotApplicable;
+
+    // the echo might carry more than the arguments, like the ambient sound volume after the noise mode
+    const std::size_t argLen = cmd.size() - 1;
+    if(len - 1 < argLen)
+        return EchoStatus::Mismatched;
+    for(std::size_t i = 0; i < argLen; i++)
+    {
+        if(at(cmd, 1 + i) != at(response, 3 + i))
+            return EchoStatus::Mismatched;
+    }
+    return EchoStatus::Confirmed;
+}
+
+bool hasEcho(ConstByteSpan cmd)
+{
+    return !cmd.empty() && (isAcknowledgedOnly(at(cmd, 0)) || isEchoedSetting(at(cmd, 0)));
+}
+
+bool decode(ConstByteSpan data, Decoded& out)
+{
+    out = Decoded();
+    if(data.size() < 3 || data.size() < headerLen + at(data, 1))
+        return false;
+    const std::uint8_t head = at(data, 0);
+    const std::size_t len = at(data, 1);
+    const std::uint8_t cmd = at(data, 2);
+    if(head != responseHead && head != notificationHead)
+        return false;
+    if(head == responseHead)
+        return decodeResponse(data, len, cmd, out);
+
+    if(len == 0)
+        return false;
+    out.isNotification = true;
+    // queried values(like battery) might be pushed as well
+    if(decodeNotification(data, len, cmd, out) || decodeResponse(data, len, cmd, out))
+        return true;
+    out.field = Field::Event;
+    out.value = cmd;
+    out.extra = 0;
+    out.bytes = data.subspan(3, len - 1);
+    return true;
+}
+
+} // namespace protocol
@@ -0,0 +1,116 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// Qt-free core of the Edifier protocol.
+// No function there allocates memory, the output buffers are provided by the caller.
+//
+// Frame format:
+// [head][len][cmd + args(len bytes)][checksum(2 bytes, big endian)]
+// head: 0xAA(host -> device), 0xBB(response), 0xCC(notification)
+// checksum: 8217 + sum of all previous bytes
+
+#include <cstddef>
+#include <cstdint>
+
+#include "span.h"
+
+namespace protocol
+{
+
+constexpr std::uint8_t commandHead = 0xAA;
+constexpr std::uint8_t responseHead = 0xBB;
+constexpr std::uint8_t notificationHead = 0xCC;
+constexpr std::uint16_t checksumSeed = 8217;
+constexpr std::size_t headerLen = 2;
+constexpr std::size_t checksumLen = 2;
+// the length byte limits the payload
+constexpr std::size_t maxPayloadLen = 255;
+constexpr std::size_t maxFrameLen = headerLen + maxPayloadLen + checksumLen;
+
+enum class FrameStatus
+{
+    Complete,
+    Incomplete, // wait for more data
+    BadHead, // the first byte is not 0xBB or 0xCC
+    BadChecksum,
+};
+
+struct FrameResult
+{
+    FrameStatus status = FrameStatus::Incomplete;
+    // the length of the whole frame(with checksum), 0 if unknown
+    std::size_t length = 0;
+};
+
+std::uint16_t checksum(ConstByteSpan data);
+// frame: the whole frame with checksum
+bool verifyChecksum(ConstByteSpan frame);
+
+// writes [0xAA][len][cmd][checksum] into out
+// returns the frame length, or 0 if cmd is empty/too long or out is too small
+std::size_t encodeFrame(ConstByteSpan cmd, ByteSpan out);
+// checks the frame at the beginning of buffer(a received frame, 0xBB or 0xCC)
+FrameResult checkFrame(ConstByteSpan buffer);
+// returns the index of the next 0xBB/0xCC at or after from, or buffer.size() if not found
+std::size_t findNextHead(ConstByteSpan buffer, std::size_t from);
+
+enum class Field : std::uint8_t
+{
+    Unknown,
+    SoundEffect, // value: 0 normal, 1 pop, 2 classical, 3 rock
+    GameMode, // value: 0/1
+    Battery, // value: percent
+    LDAC, // value: 0 off, 1 48k, 2 96k
+    PromptVolume, // value
+    ShutdownTimerEnabled, // value: 0/1
+    ShutdownTimer, // value: minutes
+    AutoPoweroff, // value: 0/1
+    MACAddress, // bytes: 6 bytes
+    Firmware, // bytes: 3 bytes
+    NoiseMode, // value: 1 normal, 2 noise reduction, 3 ambient sound, extra: ambient sound volume, -1 if unknown
+    ControlSettings, // value: bit0 normal, bit1 noise reduction, bit2 ambient sound
+    Name, // bytes: UTF-8 name
+    // only in notifications
+    PlaybackControl, // value: 0 play, 1 pause, 2 volume up, 3 volume down, 4 next, 5 previous
+    Event, // value: the cmd byte, bytes: the arguments, for other notifications
+};
+
+struct Decoded
+{
+    Field field = Field::Unknown;
+    int value = 0;
+    int extra = 0;
+    // points into the input, valid as long as the input is valid
+    ConstByteSpan bytes;
+    // an unsolicited 0xCC frame, like a change made with the buttons on the device
+    bool isNotification = false;
+};
+
+// data: a received frame without checksum, like the argument of BaseDevice::processData()
+// 0xBB responses and 0xCC notifications are accepted,
+// a notification carries the cmd byte of the setting command(like 0xC4 for sound effect)
+// returns false if the frame is not recognized, every well-formed notification is recognized
+bool decode(ConstByteSpan data, Decoded& out);
+
+// the device answers a setting command with a frame carrying the same cmd byte,
+// most settings echo the new value(AA02C101 -> BB03C10106), some are only acknowledged(AA03D1003C -> CC02D101)
+enum class EchoStatus
+{
+    NotApplicable, // a query, a command without an echo, or the frame is for another cmd
+    Acknowledged, // accepted, but the value is not echoed
+    Confirmed, // the echo starts with the written arguments
+    Mismatched,
+};
+
+// cmd: a command without head and checksum, response: a received frame without checksum
+EchoStatus checkEcho(ConstByteSpan cmd, ConstByteSpan response);
+// the commands checkEcho() can verify
+bool hasEcho(ConstByteSpan cmd);
+// the head of the reply to cmd(without head and checksum) in doc/KnownCommands:
+// responseHead for the queries and most settings, notificationHead for the acknowledged ones(C4, D1, D2, CA),
+// 0 if no reply is captured(playback controls, auto poweroff, poweroff...), Comm doesn't wait for it then
+std::uint8_t replyHead(ConstByteSpan cmd);
+
+} // namespace protocol
+
+#endif // PROTOCOL_H
@@ -0,0 +1,10 @@
+# Qt-free protocol core, shared by the app and the standalone library(protocol.pro)
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/protocol.cpp
+
+HEADERS += \
+    $$PWD/span.h \
+    $$PWD/protocol.h \
+    $$PWD/packet.h
@@ -0,0 +1,9 @@
+# Standalone static library of the protocol core, without Qt
+# qmake protocol.pro && make
+# tests/protocoltest.pro checks it against the captures in doc/KnownCommands
+TEMPLATE = lib
+CONFIG += staticlib c++17
+CONFIG -= qt
+TARGET = edifierprotocol
+
+include(protocol.pri)
@@ -0,0 +1,86 @@
+#ifndef PROTOCOL_SPAN_H
+#define PROTOCOL_SPAN_H
+
+#include <cstddef>
+
+#if defined(__has_include)
+#if __has_include(<span>) && __cplusplus > 201703L
+#include <span>
+#endif
+#endif
+
+namespace protocol
+{
+
+#ifdef __cpp_lib_span
+
+template <typename T>
+using Span = std::span<T>;
+
+#else
+
+// Minimal subset of std::span for C++17 toolchains(e.g. older Android NDK)
+template <typename T>
+class Span
+{
+public:
+    constexpr Span() noexcept = default;
+    constexpr Span(T* data, std::size_t size) noexcept
+        : m_data(data), m_size(size) {}
+    template <std::size_t N>
+    constexpr Span(T (&array)[N]) noexcept
+        : m_data(array), m_size(N) {}
+    // Span<std::byte> -> Span<const std::byte>
+    template <typename U>
+    constexpr Span(const Span<U>& other) noexcept
+        : m_data(other.data()), m_size(other.size()) {}
+
+    constexpr T* data() const noexcept
+    {
+        return m_data;
+    }
+    constexpr std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+    constexpr bool empty() const noexcept
+    {
+        return m_size == 0;
+    }
+    constexpr T& operator[](std::size_t i) const noexcept
+    {
+        return m_data[i];
+    }
+    constexpr T* begin() const noexcept
+    {
+        return m_data;
+    }
+    constexpr T* end() const noexcept
+    {
+        return m_data + m_size;
+    }
+    constexpr Span first(std::size_t count) const noexcept
+    {
+        return Span(m_data, count);
+    }
+    constexpr Span subspan(std::size_t offset) const noexcept
+    {
+        return Span(m_data + offset, m_size - offset);
+    }
+    constexpr Span subspan(std::size_t offset, std::size_t count) const noexcept
+    {
+        return Span(m_data + offset, count);
+    }
+private:
+    T* m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+#endif
+
+using ConstByteSpan = Span<const std::byte>;
+using ByteSpan = Span<std::byte>;
+
+} // namespace protocol
+
+#endif // PROTOCOL_SPAN_H
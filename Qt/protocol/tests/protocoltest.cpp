@@ -0,0 +1,205 @@
+// Runs the frames captured in doc/KnownCommands through the protocol core.
+// Every sendData must be what encodeFrame() writes, and every readData must be a complete frame
+// which decode() recognizes and checkEcho() accepts for the command sent before it.
+// usage: protocoltest [capture file or directory]
+
+#include "protocol.h"
+
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using Bytes = std::vector<std::byte>;
+
+int failureCount = 0;
+int frameCount = 0;
+
+protocol::ConstByteSpan asSpan(const Bytes& data)
+{
+    return protocol::ConstByteSpan(data.data(), data.size());
+}
+
+std::string toHex(protocol::ConstByteSpan data)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    std::string result;
+    for(std::byte i : data)
+    {
+        result += digits[static_cast<std::uint8_t>(i) >> 4];
+        result += digits[static_cast<std::uint8_t>(i) & 0x0F];
+    }
+    return result;
+}
+
+// returns false for the placeholders in the captures, like "BB16D8xxxxyyyy"
+bool fromHex(const std::string& text, Bytes& out)
+{
+    std::size_t len = 0;
+    while(len < text.size() && std::isxdigit(static_cast<unsigned char>(text[len])))
+        len++;
+    // a comment might follow the frame, like "BB02D30021A9（无）"
+    if(len == 0 || len % 2 != 0 || (len < text.size() && std::isalnum(static_cast<unsigned char>(text[len]))))
+        return false;
+    out.clear();
+    for(std::size_t i = 0; i < len; i += 2)
+        out.push_back(static_cast<std::byte>(std::stoi(text.substr(i, 2), nullptr, 16)));
+    return true;
+}
+
+void check(bool condition, const char* what, const std::string& detail)
+{
+    if(condition)
+        return;
+    failureCount++;
+    std::printf("FAIL: %s: %s\n", what, detail.c_str());
+}
+
+// the replies whose meaning is unknown("获取？" in the captures)
+bool isUnknownReply(std::uint8_t cmd)
+{
+    return cmd == 0x68 || cmd == 0xC3;
+}
+
+void checkSendFrame(const Bytes& frame)
+{
+    check(frame.size() > protocol::headerLen + protocol::checksumLen, "sendData too short", toHex(asSpan(frame)));
+    if(frame.size() <= protocol::headerLen + protocol::checksumLen)
+        return;
+    const protocol::ConstByteSpan cmd = asSpan(frame).subspan(protocol::headerLen, frame.size() - protocol::headerLen - protocol::checksumLen);
+    std::byte encoded[protocol::maxFrameLen];
+    const std::size_t len = protocol::encodeFrame(cmd, encoded);
+    check(toHex(protocol::ConstByteSpan(encoded, len)) == toHex(asSpan(frame)), "encodeFrame", toHex(asSpan(frame)));
+}
+
+void checkReadFrame(const Bytes& sent, const Bytes& frame)
+{
+    const std::string hex = toHex(asSpan(frame));
+    const protocol::FrameResult result = protocol::checkFrame(asSpan(frame));
+    check(result.status == protocol::FrameStatus::Complete && result.length == frame.size(), "checkFrame", hex);
+    if(result.status != protocol::FrameStatus::Complete || frame.size() < protocol::headerLen + protocol::checksumLen + 1)
+        return;
+    const protocol::ConstByteSpan data = asSpan(frame).first(frame.size() - protocol::checksumLen);
+
+    protocol::Decoded decoded;
+    const bool isDecoded = protocol::decode(data, decoded);
+    if(!isUnknownReply(static_cast<std::uint8_t>(data[2])))
+        check(isDecoded, "decode", hex);
+    check(!isDecoded || decoded.isNotification == (data[0] == std::byte{protocol::notificationHead}), "isNotification", hex);
+
+    if(sent.size() <= protocol::headerLen + protocol::checksumLen)
+        return;
+    const protocol::ConstByteSpan cmd = asSpan(sent).subspan(protocol::headerLen, sent.size() - protocol::headerLen - protocol::checksumLen);
+    const std::string detail = toHex(cmd) + " -> " + hex;
+    const std::uint8_t head = protocol::replyHead(cmd);
+    check(head == 0 || head == static_cast<std::uint8_t>(data[0]), "replyHead", detail);
+    const protocol::EchoStatus echo = protocol::checkEcho(cmd, data);
+    if(protocol::hasEcho(cmd))
+        check(echo == protocol::EchoStatus::Confirmed || echo == protocol::EchoStatus::Acknowledged, "checkEcho", detail);
+    else
+        check(echo == protocol::EchoStatus::NotApplicable, "checkEcho(no echo)", detail);
+}
+
+// sendData:AA02C1012187
+// readData:BB03C10106219F
+void checkCaptureFile(const std::filesystem::path& path)
+{
+    std::ifstream file(path);
+    check(file.is_open(), "open", path.string());
+    static const std::string sendPrefix = "sendData:";
+    static const std::string readPrefix = "readData:";
+    Bytes sent;
+    Bytes frame;
+    std::string line;
+    while(std::getline(file, line))
+    {
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if(line.compare(0, sendPrefix.size(), sendPrefix) == 0)
+        {
+            sent.clear();
+            if(!fromHex(line.substr(sendPrefix.size()), sent))
+                continue;
+            frameCount++;
+            checkSendFrame(sent);
+        }
+        else if(line.compare(0, readPrefix.size(), readPrefix) == 0)
+        {
+            // a command might be answered more than once, they are all checked against it
+            if(!fromHex(line.substr(readPrefix.size()), frame))
+                continue;
+            frameCount++;
+            checkReadFrame(sent, frame);
+        }
+    }
+}
+
+// the values decoded from a few captured frames
+void checkDecodedValues()
+{
+    struct Case
+    {
+        const char* frame; // without checksum
+        protocol::Field field;
+        int value;
+        bool isNotification;
+    };
+    static const Case cases[] =
+    {
+        {"BB03C10106", protocol::Field::NoiseMode, 1, false},
+        {"BB03C10309", protocol::Field::NoiseMode, 3, false},
+        {"BB02D04D", protocol::Field::Battery, 0x4D, false},
+        {"BB02050720", protocol::Field::PromptVolume, 7, false},
+        {"BB024801", protocol::Field::LDAC, 1, false},
+        {"BB04C6030002", protocol::Field::Firmware, 0, false},
+        {"CC02C403", protocol::Field::SoundEffect, 3, true},
+        {"CC02D201", protocol::Field::ShutdownTimerEnabled, 0, true},
+    };
+    for(const Case& i : cases)
+    {
+        Bytes data;
+        fromHex(i.frame, data);
+        protocol::Decoded decoded;
+        const bool isDecoded = protocol::decode(asSpan(data), decoded);
+        check(isDecoded && decoded.field == i.field && decoded.isNotification == i.isNotification, "decoded field", i.frame);
+        if(isDecoded && i.field != protocol::Field::Firmware)
+            check(decoded.value == i.value, "decoded value", i.frame);
+    }
+    // AA02C101 is answered with the old mode, the echo doesn't confirm the new one
+    Bytes cmd;
+    Bytes response;
+    fromHex("C102", cmd);
+    fromHex("BB03C10106", response);
+    check(protocol::checkEcho(asSpan(cmd), asSpan(response)) == protocol::EchoStatus::Mismatched, "checkEcho(mismatch)", "C102 -> BB03C10106");
+    // a button press reported with the cmd byte of a BB-echoed command is not its echo
+    fromHex("0901", cmd);
+    fromHex("CC020901", response);
+    check(protocol::checkEcho(asSpan(cmd), asSpan(response)) == protocol::EchoStatus::NotApplicable, "checkEcho(notification)", "0901 -> CC020901");
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const std::filesystem::path root = argc > 1 ? argv[1] : KNOWN_COMMANDS_DIR;
+    if(std::filesystem::is_directory(root))
+    {
+        for(const auto& entry : std::filesystem::directory_iterator(root))
+        {
+            if(entry.is_regular_file() && entry.path().extension() == ".txt")
+                checkCaptureFile(entry.path());
+        }
+    }
+    else
+        checkCaptureFile(root);
+    check(frameCount > 0, "no frames found", root.string());
+    checkDecodedValues();
+
+    std::printf("%d frames, %d failures\n", frameCount, failureCount);
+    return failureCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,13 @@
+# Checks the protocol core against the captures in doc/KnownCommands, without Qt
+# qmake protocoltest.pro && make check
+TEMPLATE = app
+CONFIG += console c++17 testcase
+CONFIG -= qt app_bundle
+TARGET = protocoltest
+
+include(../protocol.pri)
+
+DEFINES += KNOWN_COMMANDS_DIR=\\\"$$PWD/../../../doc/KnownCommands\\\"
+
+SOURCES += \
+    protocoltest.cpp
@@ -0,0 +1,476 @@
+#include "clonejob.h"
+#include "provisionscript.h"
+#include "scriptexecutor.h"
+#include "comms/comm.h"
+#include "comms/connectionpool.h"
+
+#include <QDebug>
+#include <QTimer>
+#include <QJsonArray>
+
+namespace
+{
+
+// Sends commands to one session and waits until each of them is answered, failed or timed out.
+// The decoded fields of all received frames and the writes confirmed by their echoes are collected.
+class CommandBatch : public QObject
+{
+public:
+    // isComplete: every command is answered
+    using Callback = std::function<void(const QHash<QString, QString>& values, bool isComplete, const QList<QByteArray>& confirmed)>;
+
+    CommandBatch(Comm* comm, const QList<QByteArray>& commands, int priority, const Callback& callback, QObject *parent)
+        : QObject{parent}
+        , m_callback(callback)
+    {
+        // Comm lives in the I/O thread, these are queued connections
+        connect(comm, &Comm::newData, this, [ = ](const QByteArray & data) {onNewData(data);});
+        connect(comm, &Comm::requestFailed, this, [ = ](const QByteArray & cmd)
+        {
+            if(!cmd.isEmpty() && m_pending.removeOne(cmd[0]))
+            {
+                m_isComplete = false;
+                finishIfDone();
+            }
+        });
+        // emitted before newData(), so the confirmation is there when the batch finishes
+        connect(comm, &Comm::writeVerified, this, [ = ](const QByteArray & cmd, int echoStatus)
+        {
+            if(echoStatus == static_cast<int>(protocol::EchoStatus::Confirmed))
+                m_confirmed.append(cmd);
+        });
+        QTimer::singleShot(CloneJob::batchTimeoutMs, this, [ = ]
+        {
+            m_isComplete = false;
+            finish();
+        });
+        for(const auto& cmd : commands)
+        {
+            if(Comm::expectsResponse(cmd))
+                m_pending.append(cmd[0]);
+            comm->scheduleCommand(cmd, priority);
+        }
+        // nothing to wait for, the callback is still called asynchronously
+        if(m_pending.isEmpty())
+            QTimer::singleShot(0, this, [ = ] {finish();});
+    }
+private:
+    Callback m_callback;
+    // the cmd bytes of the unanswered commands
+    QList<char> m_pending;
+    QHash<QString, QString> m_values;
+    QList<QByteArray> m_confirmed;
+    bool m_isComplete = true;
+    bool m_isFinished = false;
+
+    void onNewData(const QByteArray& data)
+    {
+        protocol::Decoded decoded;
+        if(protocol::decode(Comm::asSpan(data), decoded))
+        {
+            const auto values = ScriptExecutor::fieldValues(decoded);
+            for(const auto& value : values)
+                m_values[value.first] = value.second;
+        }
+        // both 0xBB and 0xCC responses carry the cmd byte of the request
+        if(data.length() >= 3 && m_pending.removeOne(data[2]))
+            finishIfDone();
+    }
+    void finishIfDone()
+    {
+        if(m_pending.isEmpty())
+            finish();
+    }
+    void finish()
+    {
+        if(m_isFinished)
+            return;
+        m_isFinished = true;
+        deleteLater();
+        // the callback might delete this batch
+        const Callback callback = m_callback;
+        callback(QHash<QString, QString>(m_values), m_isComplete, QList<QByteArray>(m_confirmed));
+    }
+};
+
+} // namespace
+
+const QStringList CloneJob::clonedFields =
+{
+    "noise", "ambientvolume", "soundeffect", "gamemode", "ldac", "promptvolume", "shutdowntimer", "autopoweroff", "controlsettings",
+};
+
+CloneJob::CloneJob(const SessionFactory& factory, QObject *parent)
+    : QObject{parent}
+    , m_factory(factory)
+{
+}
+
+CloneJob::~CloneJob()
+{
+    for(int i = 0; i < m_units.length(); i++)
+        closeUnitSession(i);
+}
+
+void CloneJob::setMaxParallel(int count)
+{
+    m_maxParallel = qMax(count, 1);
+}
+
+void CloneJob::setMaxAttempts(int count)
+{
+    m_maxAttempts = qMax(count, 1);
+}
+
+void CloneJob::readReference(Comm* comm, const QList<QByteArray>& queryPlan)
+{
+    m_queryPlan = queryPlan;
+    m_reference.clear();
+    if(comm == nullptr)
+    {
+        emit referenceRead(false, tr("Device not connected"));
+        return;
+    }
+    new CommandBatch(comm, queryPlan, Comm::QueryPriority, [ = ](const QHash<QString, QString>& values, bool isComplete, const QList<QByteArray>&)
+    {
+        for(const auto& field : clonedFields)
+        {
+            if(values.contains(field))
+                m_reference[field] = values[field];
+        }
+        qDebug() << "clone: reference" << m_reference << (isComplete ? "" : "(incomplete)");
+        if(m_reference.isEmpty())
+            emit referenceRead(false, tr("No setting is read from the reference device"));
+        else
+            emit referenceRead(true, isComplete ? QString() : tr("Some settings are not read"));
+    }, this);
+}
+
+QHash<QString, QString> CloneJob::reference() const
+{
+    return m_reference;
+}
+
+QJsonObject CloneJob::profile(const QString& name) const
+{
+    QJsonArray commands;
+    const auto settings = settingCommands(m_reference.keys());
+    for(const auto& setting : settings)
+    {
+        QJsonObject cmdObject;
+        cmdObject.insert("cmd", QString::fromLatin1(setting.second.toHex()));
+        cmdObject.insert("name", setting.first);
+        commands.append(cmdObject);
+    }
+    QJsonObject profileObject;
+    profileObject.insert("name", name);
+    profileObject.insert("commands", commands);
+    return profileObject;
+}
+
+void CloneJob::start(const QList<Target>& targets)
+{
+    if(m_isRunning)
+        return;
+    for(int i = 0; i < m_units.length(); i++)
+        closeUnitSession(i);
+    m_units.clear();
+    for(const auto& target : targets)
+    {
+        Unit unit;
+        unit.target = target;
+        unit.address = target.info.address().toString();
+        m_units.append(unit);
+    }
+    m_nextUnit = 0;
+    m_activeCount = 0;
+    m_isRunning = true;
+    emit progress(0, m_units.length());
+    startNextUnits();
+}
+
+bool CloneJob::isRunning() const
+{
+    return m_isRunning;
+}
+
+void CloneJob::abort(const QString& reason)
+{
+    if(!m_isRunning)
+        return;
+    const QString message = reason.isEmpty() ? tr("Aborted") : reason;
+    // the waiting units are never started
+    for(; m_nextUnit < m_units.length(); m_nextUnit++)
+        setUnitState(m_nextUnit, UnitState::Failed, message);
+    for(int i = 0; i < m_units.length(); i++)
+    {
+        const UnitState state = m_units[i].state;
+        if(state != UnitState::Matched && state != UnitState::Mismatched && state != UnitState::Failed)
+            finishUnit(i, UnitState::Failed, message);
+    }
+}
+
+void CloneJob::startNextUnits()
+{
+    while(m_isRunning && m_activeCount < m_maxParallel && m_nextUnit < m_units.length())
+    {
+        m_activeCount++;
+        connectUnit(m_nextUnit++);
+    }
+    if(m_isRunning && m_activeCount == 0 && m_nextUnit >= m_units.length())
+    {
+        m_isRunning = false;
+        int matched = 0;
+        for(const auto& unit : qAsConst(m_units))
+            matched += unit.state == UnitState::Matched;
+        emit finished(matched, m_units.length());
+    }
+}
+
+void CloneJob::connectUnit(int index)
+{
+    Unit& unit = m_units[index];
+    unit.connectAttempts++;
+    setUnitState(index, UnitState::Connecting, tr("attempt %1").arg(unit.connectAttempts));
+    unit.comm = m_factory(unit.target.info, unit.target.isBLE);
+    // LDAC re-pairs the device, the session reconnects and resumes the commands
+    unit.comm->setAutoReconnect(true);
+    connect(unit.comm, &Comm::stateChanged, this, [ = ](bool connected) {onUnitStateChanged(index, connected);});
+    if(unit.connectTimer == nullptr)
+    {
+        unit.connectTimer = new QTimer(this);
+        unit.connectTimer->setSingleShot(true);
+        unit.connectTimer->setInterval(connectTimeoutMs);
+        connect(unit.connectTimer, &QTimer::timeout, this, [ = ] {onUnitStateChanged(index, false);});
+    }
+    unit.connectTimer->start();
+    QMetaObject::invokeMethod(unit.comm, "open", Qt::QueuedConnection, Q_ARG(QBluetoothDeviceInfo, unit.target.info));
+}
+
+void CloneJob::onUnitStateChanged(int index, bool connected)
+{
+    Unit& unit = m_units[index];
+    if(unit.state != UnitState::Connecting)
+        return; // the session reconnects by itself after the first connection
+    if(connected)
+    {
+        unit.connectTimer->stop();
+        readUnit(index, m_queryPlan);
+        return;
+    }
+    unit.connectTimer->stop();
+    closeUnitSession(index);
+    if(unit.connectAttempts < maxConnectAttempts)
+        QTimer::singleShot(Comm::reconnectInitialDelayMs, this, [ = ] {if(m_units.value(index).state == UnitState::Connecting) connectUnit(index);});
+    else
+        finishUnit(index, UnitState::Failed, tr("Failed to connect"));
+}
+
+void CloneJob::readUnit(int index, const QList<QByteArray>& queries)
+{
+    Unit& unit = m_units[index];
+    // the first read finds the settings to write, the later ones verify the writes without an echo
+    setUnitState(index, unit.attempts == 0 ? UnitState::Reading : UnitState::Verifying);
+    unit.batch = new CommandBatch(unit.comm, queries, Comm::QueryPriority, [ = ](const QHash<QString, QString>& values, bool isComplete, const QList<QByteArray>&)
+    {
+        Q_UNUSED(isComplete); // the missing fields are treated as different
+        onUnitRead(index, values);
+    }, this);
+}
+
+void CloneJob::onUnitRead(int index, const QHash<QString, QString>& values)
+{
+    Unit& unit = m_units[index];
+    for(auto it = values.cbegin(); it != values.cend(); ++it)
+        unit.values[it.key()] = it.value();
+    const QStringList fields = diff(unit.values);
+    if(fields.isEmpty())
+        finishUnit(index, UnitState::Matched, unit.attempts == 0 ? tr("already matched") : QString());
+    else if(unit.attempts >= m_maxAttempts)
+        finishUnit(index, UnitState::Mismatched, fields.join(", "));
+    else
+        applyUnit(index, fields);
+}
+
+void CloneJob::applyUnit(int index, const QStringList& fields)
+{
+    Unit& unit = m_units[index];
+    unit.attempts++;
+    setUnitState(index, UnitState::Applying, fields.join(", "));
+    QList<QByteArray> commands;
+    const auto settings = settingCommands(fields);
+    for(const auto& setting : settings)
+        commands.append(setting.second);
+    unit.batch = new CommandBatch(unit.comm, commands, Comm::SettingPriority, [ = ](const QHash<QString, QString>& values, bool, const QList<QByteArray>& confirmed)
+    {
+        onUnitApplied(index, settings, values, confirmed);
+    }, this);
+}
+
+void CloneJob::onUnitApplied(int index, const QList<QPair<QString, QByteArray>>& settings, const QHash<QString, QString>& values, const QList<QByteArray>& confirmed)
+{
+    Unit& unit = m_units[index];
+    for(auto it = values.cbegin(); it != values.cend(); ++it)
+        unit.values[it.key()] = it.value();
+    // the echo of a confirmed write carries the value, only the other writes are read back
+    QList<QByteArray> queries;
+    for(const auto& setting : settings)
+    {
+        QStringList fields = {setting.first};
+        if(setting.first == "ambientvolume")
+            fields.append("noise");
+        for(const auto& field : qAsConst(fields))
+        {
+            if(confirmed.contains(setting.second))
+            {
+                unit.values[field] = m_reference.value(field);
+                continue;
+            }
+            // a missing response counts as different
+            unit.values.remove(field);
+            const QByteArray query = ProvisionScript::queryCommand(field);
+            if(!query.isEmpty() && !queries.contains(query))
+                queries.append(query);
+        }
+    }
+    if(queries.isEmpty())
+        onUnitRead(index, QHash<QString, QString>());
+    else
+        readUnit(index, queries);
+}
+
+void CloneJob::finishUnit(int index, UnitState state, const QString& message)
+{
+    Unit& unit = m_units[index];
+    if(unit.connectTimer != nullptr)
+        unit.connectTimer->stop();
+    delete unit.batch;
+    closeUnitSession(index);
+    setUnitState(index, state, message);
+    m_activeCount--;
+    int done = 0;
+    for(const auto& item : qAsConst(m_units))
+        done += item.state == UnitState::Matched || item.state == UnitState::Mismatched || item.state == UnitState::Failed;
+    emit progress(done, m_units.length());
+    startNextUnits();
+}
+
+void CloneJob::setUnitState(int index, UnitState state, const QString& message)
+{
+    Unit& unit = m_units[index];
+    unit.state = state;
+    unit.message = message;
+    qDebug() << "clone:" << unit.address << stateName(state) << message;
+    emit unitStateChanged(unit.address, state, message);
+}
+
+void CloneJob::closeUnitSession(int index)
+{
+    Unit& unit = m_units[index];
+    if(unit.comm == nullptr)
+        return;
+    unit.comm->disconnect(this);
+    ConnectionPool::closeSession(unit.comm);
+    unit.comm = nullptr;
+}
+
+QStringList CloneJob::diff(const QHash<QString, QString>& values) const
+{
+    QStringList fields;
+    for(const auto& field : clonedFields)
+    {
+        if(!m_reference.contains(field))
+            continue;
+        // the ambient volume is only applied with the ambient sound mode
+        if(field == "ambientvolume" && m_reference.value("noise") != "ambient")
+            continue;
+        if(values.value(field) != m_reference[field])
+            fields.append(field);
+    }
+    return fields;
+}
+
+QList<QPair<QString, QByteArray>> CloneJob::settingCommands(const QStringList& fields) const
+{
+    const bool isAmbient = m_reference.value("noise") == "ambient" && m_reference.contains("ambientvolume");
+    QList<QPair<QString, QByteArray>> commands;
+    for(const auto& field : clonedFields)
+    {
+        if(!fields.contains(field) || !m_reference.contains(field))
+            continue;
+        if(field == "ambientvolume" && !isAmbient)
+            continue;
+        QString name = field;
+        // C103<volume> sets the mode and the volume at once
+        if(field == "noise" && isAmbient)
+            name = "ambientvolume";
+        const QByteArray cmd = ProvisionScript::settingCommand(name, m_reference[name]);
+        if(cmd.isEmpty())
+        {
+            qDebug() << "clone: invalid setting" << name << m_reference[name];
+            continue;
+        }
+        bool isDuplicate = false;
+        for(const auto& command : qAsConst(commands))
+            isDuplicate |= command.second == cmd;
+        if(!isDuplicate)
+            commands.append({name, cmd});
+    }
+    return commands;
+}
+
+QList<CloneJob::UnitResult> CloneJob::results() const
+{
+    QList<UnitResult> results;
+    for(const auto& unit : m_units)
+    {
+        UnitResult result;
+        result.address = unit.address;
+        result.state = unit.state;
+        result.attempts = unit.attempts;
+        result.message = unit.message;
+        result.firmware = unit.values.value("firmware");
+        results.append(result);
+    }
+    return results;
+}
+
+QString CloneJob::summary() const
+{
+    QStringList lines;
+    const auto unitResults = results();
+    for(const auto& result : unitResults)
+    {
+        QString line = result.address + ": " + stateName(result.state);
+        if(result.attempts > 0)
+            line += " " + tr("(%n write(s))", "", result.attempts);
+        if(!result.message.isEmpty())
+            line += " - " + result.message;
+        lines.append(line);
+    }
+    return lines.join('\n');
+}
+
+QString CloneJob::stateName(UnitState state)
+{
+    switch(state)
+    {
+    case UnitState::Waiting:
+        return tr("waiting");
+    case UnitState::Connecting:
+        return tr("connecting");
+    case UnitState::Reading:
+        return tr("reading");
+    case UnitState::Applying:
+        return tr("applying");
+    case UnitState::Verifying:
+        return tr("verifying");
+    case UnitState::Matched:
+        return tr("matched");
+    case UnitState::Mismatched:
+        return tr("mismatched");
+    case UnitState::Failed:
+        return tr("failed");
+    }
+    return QString();
+}
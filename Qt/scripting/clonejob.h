@@ -0,0 +1,131 @@
+#ifndef CLONEJOB_H
+#define CLONEJOB_H
+
+#include <QObject>
+#include <QHash>
+#include <QPointer>
+#include <QJsonObject>
+#include <QBluetoothDeviceInfo>
+#include <functional>
+
+class Comm;
+class QTimer;
+
+// Reads the settings of a reference headset and replicates them to other units in parallel.
+// Every unit is read first, only the settings which differ are written.
+// A write confirmed by its echo(see Comm::writeVerified()) is done, the other ones are read back.
+// The settings which still differ are written again, up to maxAttempts.
+// The name is not cloned, every unit keeps its own.
+class CloneJob : public QObject
+{
+    Q_OBJECT
+public:
+    enum class UnitState
+    {
+        Waiting,
+        Connecting,
+        Reading,
+        Applying,
+        Verifying,
+        Matched,
+        Mismatched,
+        Failed,
+    };
+
+    struct Target
+    {
+        QBluetoothDeviceInfo info;
+        bool isBLE = false;
+    };
+
+    struct UnitResult
+    {
+        QString address;
+        UnitState state = UnitState::Waiting;
+        int attempts = 0;
+        QString message;
+        QString firmware;
+    };
+
+    // creates a session which lives in the I/O thread, it's closed with ConnectionPool::closeSession()
+    using SessionFactory = std::function<Comm*(const QBluetoothDeviceInfo& info, bool isBLE)>;
+
+    explicit CloneJob(const SessionFactory& factory, QObject *parent = nullptr);
+    ~CloneJob();
+
+    // queryPlan: the queries of the model, see DeviceCatalog::DeviceModel
+    void readReference(Comm* comm, const QList<QByteArray>& queryPlan);
+    // field -> value, in the format of ScriptExecutor::fieldValues()
+    QHash<QString, QString> reference() const;
+    // in the format of "Save to File", it can be applied with "Write to Device"
+    QJsonObject profile(const QString& name) const;
+    void start(const QList<Target>& targets);
+    bool isRunning() const;
+    QList<UnitResult> results() const;
+    // one line per unit
+    QString summary() const;
+
+    void setMaxParallel(int count);
+    void setMaxAttempts(int count);
+
+    static QString stateName(UnitState state);
+    // the fields which are cloned
+    static const QStringList clonedFields;
+
+    static const int defaultMaxParallel = 4;
+    static const int defaultMaxAttempts = 3;
+    static const int connectTimeoutMs = 20000;
+    static const int maxConnectAttempts = 3;
+    // LDAC triggers re-pairing, so a batch might wait for a reconnection
+    static const int batchTimeoutMs = 15000;
+public slots:
+    void abort(const QString& reason = QString());
+private:
+    struct Unit
+    {
+        Target target;
+        QString address;
+        UnitState state = UnitState::Waiting;
+        int attempts = 0;
+        int connectAttempts = 0;
+        Comm* comm = nullptr;
+        QHash<QString, QString> values;
+        QString message;
+        QTimer* connectTimer = nullptr;
+        QPointer<QObject> batch;
+    };
+
+    SessionFactory m_factory;
+    QHash<QString, QString> m_reference;
+    QList<QByteArray> m_queryPlan;
+    QList<Unit> m_units;
+    int m_nextUnit = 0;
+    int m_activeCount = 0;
+    int m_maxParallel = defaultMaxParallel;
+    int m_maxAttempts = defaultMaxAttempts;
+    bool m_isRunning = false;
+
+    void startNextUnits();
+    void connectUnit(int index);
+    void readUnit(int index, const QList<QByteArray>& queries);
+    void applyUnit(int index, const QStringList& fields);
+    void finishUnit(int index, UnitState state, const QString& message);
+    void setUnitState(int index, UnitState state, const QString& message = QString());
+    void closeUnitSession(int index);
+    // the cloned fields where values differ from the reference
+    QStringList diff(const QHash<QString, QString>& values) const;
+    // field -> command, ambientvolume also sets the noise mode
+    QList<QPair<QString, QByteArray>> settingCommands(const QStringList& fields) const;
+    void onUnitStateChanged(int index, bool connected);
+    // values are merged into the ones read before
+    void onUnitRead(int index, const QHash<QString, QString>& values);
+    // confirmed: the commands confirmed by their echoes
+    void onUnitApplied(int index, const QList<QPair<QString, QByteArray>>& settings, const QHash<QString, QString>& values, const QList<QByteArray>& confirmed);
+signals:
+    void referenceRead(bool success, const QString& message);
+    void unitStateChanged(const QString& address, CloneJob::UnitState state, const QString& message);
+    void progress(int done, int total);
+    void finished(int matched, int total);
+};
+
+#endif // CLONEJOB_H
@@ -0,0 +1,281 @@
+#include "provisionscript.h"
+
+#include <QFile>
+#include <QHash>
+#include <QVector>
+
+bool ProvisionScript::load(const QString &filename, QString *errorString)
+{
+    QFile file(filename);
+    if(!file.open(QFile::ReadOnly | QFile::Text))
+    {
+        if(errorString != nullptr)
+            *errorString = tr("Failed to open") + " " + filename;
+        return false;
+    }
+    return parse(QString::fromUtf8(file.readAll()), errorString);
+}
+
+bool ProvisionScript::parse(const QString &text, QString *errorString)
+{
+    static const QHash<QString, Op> opMap =
+    {
+        {"let", Op::Let},
+        {"send", Op::Send},
+        {"set", Op::Set},
+        {"read", Op::Read},
+        {"wait", Op::Wait},
+        {"assert", Op::Assert},
+        {"delay", Op::Delay},
+        {"foreach", Op::ForEach},
+        {"end", Op::End},
+    };
+    static const QStringList assertOpList = {"==", "!=", ">=", "<=", ">", "<"};
+
+    auto fail = [ = ](int line, const QString & msg)
+    {
+        if(errorString != nullptr)
+            *errorString = tr("Line %1: %2").arg(line).arg(msg);
+        return false;
+    };
+
+    m_statements.clear();
+    QList<int> loopStack;
+    const QStringList lines = text.split('\n');
+    for(int i = 0; i < lines.length(); i++)
+    {
+        const int lineNum = i + 1;
+        bool ok;
+        QStringList tokens = tokenize(lines[i], &ok);
+        if(!ok)
+            return fail(lineNum, tr("unterminated string"));
+        if(tokens.isEmpty())
+            continue;
+        const QString keyword = tokens.takeFirst().toLower();
+        if(!opMap.contains(keyword))
+            return fail(lineNum, tr("unknown statement") + " " + keyword);
+
+        Statement statement;
+        statement.op = opMap[keyword];
+        statement.line = lineNum;
+        statement.args = tokens;
+        switch(statement.op)
+        {
+        case Op::Let:
+            if(tokens.length() != 3 || tokens[1] != "=")
+                return fail(lineNum, tr("expected: let <var> = <value>"));
+            statement.args = QStringList{tokens[0], tokens[2]};
+            break;
+        case Op::Send:
+            if(tokens.length() != 1)
+                return fail(lineNum, tr("expected: send <hex>"));
+            break;
+        case Op::Set:
+            if(tokens.length() != 2)
+                return fail(lineNum, tr("expected: set <setting> <value>"));
+            // the value is checked at runtime if it contains variables
+            if(!tokens[1].contains("${") && settingCommand(tokens[0], tokens[1]).isEmpty())
+                return fail(lineNum, tr("invalid setting") + " " + tokens.join(' '));
+            break;
+        case Op::Read:
+            if(tokens.length() != 1 || queryCommand(tokens[0]).isEmpty())
+                return fail(lineNum, tr("expected: read <field>"));
+            break;
+        case Op::Wait:
+            if(tokens.length() < 1 || tokens.length() > 2)
+                return fail(lineNum, tr("expected: wait <field> [timeoutMs]"));
+            break;
+        case Op::Assert:
+            if(tokens.length() != 3 || !assertOpList.contains(tokens[1]))
+                return fail(lineNum, tr("expected: assert <field> <op> <value>"));
+            break;
+        case Op::Delay:
+            tokens.value(0).toInt(&ok);
+            if(tokens.length() != 1 || !ok)
+                return fail(lineNum, tr("expected: delay <ms>"));
+            break;
+        case Op::ForEach:
+            if(tokens != QStringList{"device"})
+                return fail(lineNum, tr("expected: foreach device"));
+            if(!loopStack.isEmpty())
+                return fail(lineNum, tr("nested foreach is not supported"));
+            loopStack.append(m_statements.length());
+            break;
+        case Op::End:
+            if(loopStack.isEmpty())
+                return fail(lineNum, tr("end without foreach"));
+            statement.jump = loopStack.takeLast();
+            m_statements[statement.jump].jump = m_statements.length();
+            break;
+        }
+        m_statements.append(statement);
+    }
+    if(!loopStack.isEmpty())
+        return fail(m_statements[loopStack.last()].line, tr("foreach without end"));
+    return true;
+}
+
+const QList<ProvisionScript::Statement>& ProvisionScript::statements() const
+{
+    return m_statements;
+}
+
+QStringList ProvisionScript::tokenize(const QString &line, bool *ok)
+{
+    QStringList tokens;
+    QString token;
+    bool inString = false;
+    bool hasToken = false;
+    *ok = true;
+    for(const QChar ch : line)
+    {
+        if(inString)
+        {
+            if(ch == '"')
+                inString = false;
+            else
+                token += ch;
+        }
+        else if(ch == '"')
+        {
+            inString = true;
+            hasToken = true;
+        }
+        else if(ch == '#')
+            break;
+        else if(ch.isSpace())
+        {
+            if(hasToken)
+                tokens.append(token);
+            token.clear();
+            hasToken = false;
+        }
+        else
+        {
+            token += ch;
+            hasToken = true;
+        }
+    }
+    if(inString)
+        *ok = false;
+    else if(hasToken)
+        tokens.append(token);
+    return tokens;
+}
+
+QByteArray ProvisionScript::settingCommand(const QString &setting, const QString &value)
+{
+    // the same commands as BaseDevice
+    static const QHash<QString, QHash<QString, QByteArray>> enumSettings =
+    {
+        {"noise", {{"normal", "C101"}, {"reduction", "C102"}, {"ambient", "C103"}}},
+        {"soundeffect", {{"normal", "C400"}, {"pop", "C401"}, {"classical", "C402"}, {"rock", "C403"}}},
+        {"gamemode", {{"off", "0900"}, {"on", "0901"}}},
+        {"ldac", {{"off", "4900"}, {"48k", "4901"}, {"96k", "4902"}}},
+        {"autopoweroff", {{"off", "D600"}, {"on", "D601"}}},
+    };
+    const QString name = setting.toLower();
+    if(enumSettings.contains(name))
+        return QByteArray::fromHex(enumSettings[name].value(value.toLower()));
+
+    if(name == "name")
+    {
+        if(value.isEmpty())
+            return QByteArray();
+        return "\xCA" + value.toUtf8();
+    }
+    if(name == "shutdowntimer" && value.toLower() == "off")
+        return QByteArray::fromHex("D2");
+
+    bool ok;
+    int number = value.toInt(&ok);
+    if(!ok)
+        return QByteArray();
+    QByteArray cmd;
+    if(name == "ambientvolume" && number >= -3 && number <= 3)
+    {
+        cmd = "\xC1\x03";
+        cmd += (char)(6 + number);
+    }
+    else if(name == "promptvolume" && number >= 0 && number <= 15)
+    {
+        cmd = "\x06";
+        cmd += (char)number;
+    }
+    else if(name == "shutdowntimer" && number > 0 && number <= 255)
+    {
+        // This contains '\0', so the length must be specified
+        cmd = QByteArray("\xD1\x00", 2);
+        cmd += (char)number;
+    }
+    else if(name == "controlsettings" && number >= 0 && number <= 7)
+    {
+        cmd = "\xF1\x0A";
+        cmd += (char)number;
+    }
+    return cmd;
+}
+
+QByteArray ProvisionScript::queryCommand(const QString &field)
+{
+    static const QHash<QString, QByteArray> queryMap =
+    {
+        {"battery", "D0"},
+        {"mac", "C8"},
+        {"firmware", "C6"},
+        {"name", "C9"},
+        {"noise", "CC"},
+        {"ambientvolume", "CC"},
+        {"soundeffect", "D5"},
+        {"gamemode", "08"},
+        {"ldac", "48"},
+        {"promptvolume", "05"},
+        {"shutdowntimer", "D3"},
+        {"autopoweroff", "D7"},
+        {"controlsettings", "F00A"},
+    };
+    return QByteArray::fromHex(queryMap.value(field.toLower()));
+}
+
+bool ProvisionScript::compare(const QString &lhs, const QString &op, const QString &rhs)
+{
+    int result = 0;
+    bool isLhsNumber, isRhsNumber;
+    double lhsNumber = lhs.toDouble(&isLhsNumber);
+    double rhsNumber = rhs.toDouble(&isRhsNumber);
+    if(isLhsNumber && isRhsNumber)
+        result = (lhsNumber > rhsNumber) - (lhsNumber < rhsNumber);
+    else
+    {
+        // versions, compare each part as number
+        const QStringList lhsParts = lhs.split('.');
+        const QStringList rhsParts = rhs.split('.');
+        bool isVersion = lhsParts.length() > 1 && lhsParts.length() == rhsParts.length();
+        QVector<int> lhsVersion, rhsVersion;
+        for(int i = 0; isVersion && i < lhsParts.length(); i++)
+        {
+            bool ok1, ok2;
+            lhsVersion.append(lhsParts[i].toInt(&ok1));
+            rhsVersion.append(rhsParts[i].toInt(&ok2));
+            isVersion = ok1 && ok2;
+        }
+        if(isVersion)
+            result = (lhsVersion > rhsVersion) - (lhsVersion < rhsVersion);
+        else
+            result = QString::compare(lhs, rhs, Qt::CaseInsensitive);
+    }
+
+    if(op == "==")
+        return result == 0;
+    else if(op == "!=")
+        return result != 0;
+    else if(op == ">=")
+        return result >= 0;
+    else if(op == "<=")
+        return result <= 0;
+    else if(op == ">")
+        return result > 0;
+    else if(op == "<")
+        return result < 0;
+    return false;
+}
@@ -0,0 +1,74 @@
+#ifndef PROVISIONSCRIPT_H
+#define PROVISIONSCRIPT_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QByteArray>
+#include <QCoreApplication>
+
+// A line-based provisioning script, for example:
+//
+// # comments start with '#'
+// let prefix = "Bench-"
+// foreach device
+//     set noise reduction
+//     set name "${prefix}${index}"
+//     read battery
+//     read firmware
+//     assert battery >= 30
+//     assert firmware == 01.02.03
+// end
+//
+// Statements:
+// let <var> = <value>            define a variable, ${var} is expanded in later values
+// send <hex>                     send a command(without head and checksum)
+// set <setting> <value>          send a named setting, see settingCommand()
+// read <field>                   query a field, the response is stored as ${field}
+// wait <field> [timeoutMs]       block until the field is received, pushed ones(playback, event) included
+// assert <field> <op> <value>    op: == != >= <= > <, queries and waits for the field if it's not read yet
+// delay <ms>
+// foreach device ... end         run the body for every target(the discovered devices), ${address} and ${index} are set
+class ProvisionScript
+{
+    Q_DECLARE_TR_FUNCTIONS(ProvisionScript)
+public:
+    enum class Op
+    {
+        Let,
+        Send,
+        Set,
+        Read,
+        Wait,
+        Assert,
+        Delay,
+        ForEach,
+        End,
+    };
+
+    struct Statement
+    {
+        Op op;
+        int line;
+        QStringList args;
+        // ForEach: the index of End, End: the index of ForEach
+        int jump = -1;
+    };
+
+    bool load(const QString& filename, QString* errorString = nullptr);
+    bool parse(const QString& text, QString* errorString = nullptr);
+    const QList<Statement>& statements() const;
+
+    // returns an empty QByteArray if the setting or the value is invalid
+    static QByteArray settingCommand(const QString& setting, const QString& value);
+    // returns an empty QByteArray if the field is unknown
+    static QByteArray queryCommand(const QString& field);
+    // numbers and versions(like 1.2.3) are compared by value, others are compared as strings
+    static bool compare(const QString& lhs, const QString& op, const QString& rhs);
+private:
+    QList<Statement> m_statements;
+
+    static QStringList tokenize(const QString& line, bool* ok);
+};
+
+#endif // PROVISIONSCRIPT_H
@@ -0,0 +1,388 @@
+#include "scriptexecutor.h"
+#include "comms/comm.h"
+#include "comms/connectionpool.h"
+
+#include <QDebug>
+#include <QRegularExpression>
+
+ScriptExecutor::ScriptExecutor(const ProvisionScript& script, const QList<Target>& targets, QObject *parent)
+    : QObject{parent}
+    , m_script(script)
+    , m_targets(targets)
+{
+    m_waitTimer = new QTimer(this);
+    m_waitTimer->setSingleShot(true);
+    connect(m_waitTimer, &QTimer::timeout, this, [ = ]
+    {
+        abort(tr("Timeout waiting for") + " " + m_waitingField);
+    });
+    m_delayTimer = new QTimer(this);
+    m_delayTimer->setSingleShot(true);
+    connect(m_delayTimer, &QTimer::timeout, this, &ScriptExecutor::step);
+    m_connectTimer = new QTimer(this);
+    m_connectTimer->setSingleShot(true);
+    m_connectTimer->setInterval(connectTimeoutMs);
+    connect(m_connectTimer, &QTimer::timeout, this, [ = ] {onLoopSessionStateChanged(false);});
+
+    for(const auto& target : qAsConst(m_targets))
+    {
+        if(target.comm == nullptr)
+            continue;
+        Comm* comm = target.comm;
+        // Comm lives in the I/O thread, this is a queued connection
+        connect(comm, &Comm::newData, this, [ = ](const QByteArray & data) {onNewData(comm, data);});
+    }
+}
+
+bool ScriptExecutor::isRunning() const
+{
+    return m_isRunning;
+}
+
+void ScriptExecutor::setSessionFactory(const SessionFactory& factory)
+{
+    m_factory = factory;
+}
+
+void ScriptExecutor::start()
+{
+    if(m_isRunning)
+        return;
+    m_pc = 0;
+    m_loopIndex = -1;
+    m_variables.clear();
+    m_fields.clear();
+    m_waitingField.clear();
+    m_minPriority = Comm::InteractivePriority;
+    m_isRunning = true;
+    step();
+}
+
+void ScriptExecutor::abort(const QString& reason)
+{
+    if(!m_isRunning)
+        return;
+    const auto& statements = m_script.statements();
+    QString message = reason;
+    if(m_pc < statements.length())
+        message = tr("Line %1: %2").arg(statements[m_pc].line).arg(reason);
+    if(m_loopIndex >= 0)
+        message = m_targets[m_loopIndex].address + ": " + message;
+    finish(false, message);
+}
+
+void ScriptExecutor::finish(bool success, const QString& message)
+{
+    m_isRunning = false;
+    m_waitTimer->stop();
+    m_delayTimer->stop();
+    m_waitingField.clear();
+    closeLoopSession();
+    emit log(message);
+    emit finished(success, message);
+}
+
+void ScriptExecutor::step()
+{
+    const auto& statements = m_script.statements();
+    while(m_isRunning && m_pc < statements.length())
+    {
+        // execute() returns false if it blocks, step() is called again later
+        if(!execute(statements[m_pc]))
+            return;
+    }
+    if(m_isRunning)
+        finish(true, tr("Script finished"));
+}
+
+bool ScriptExecutor::execute(const ProvisionScript::Statement& statement)
+{
+    const QStringList& args = statement.args;
+    Comm* comm = currentComm();
+    switch(statement.op)
+    {
+    case ProvisionScript::Op::Let:
+        m_variables[args[0]] = expand(args[1]);
+        break;
+    case ProvisionScript::Op::Send:
+    {
+        QByteArray cmd = QByteArray::fromHex(expand(args[0]).toLatin1());
+        if(comm == nullptr || cmd.isEmpty())
+        {
+            abort(tr("Failed to send") + " " + args[0]);
+            return false;
+        }
+        send(comm, cmd);
+        break;
+    }
+    case ProvisionScript::Op::Set:
+    {
+        QByteArray cmd = ProvisionScript::settingCommand(args[0], expand(args[1]));
+        if(comm == nullptr || cmd.isEmpty())
+        {
+            abort(tr("Invalid setting") + " " + args[0] + " " + expand(args[1]));
+            return false;
+        }
+        clearField(args[0].toLower());
+        send(comm, cmd);
+        break;
+    }
+    case ProvisionScript::Op::Read:
+    {
+        if(comm == nullptr)
+        {
+            abort(tr("Device not connected"));
+            return false;
+        }
+        const QString field = args[0].toLower();
+        clearField(field);
+        send(comm, ProvisionScript::queryCommand(field));
+        break;
+    }
+    case ProvisionScript::Op::Wait:
+        if(!waitFor(args[0].toLower(), args.value(1).isEmpty() ? defaultWaitTimeoutMs : args[1].toInt()))
+            return false;
+        break;
+    case ProvisionScript::Op::Assert:
+    {
+        const QString field = args[0].toLower();
+        // a field which is not read yet is queried once, pushed ones(playback, event) have no query
+        if(!m_fields.contains(field) && m_waitingField != field && comm != nullptr)
+        {
+            const QByteArray query = ProvisionScript::queryCommand(field);
+            if(!query.isEmpty())
+                send(comm, query);
+        }
+        // the assert is executed again when the field arrives
+        if(!waitFor(field, defaultWaitTimeoutMs))
+            return false;
+        const QString expected = expand(args[2]);
+        if(!ProvisionScript::compare(m_fields[field], args[1], expected))
+        {
+            abort(tr("Assertion failed") + QString(": %1 %2 %3 (%4)").arg(field, args[1], expected, m_fields[field]));
+            return false;
+        }
+        emit log(QString("%1 %2 %3: OK").arg(field, args[1], expected));
+        break;
+    }
+    case ProvisionScript::Op::Delay:
+        m_pc++;
+        m_delayTimer->start(args[0].toInt());
+        return false;
+    case ProvisionScript::Op::ForEach:
+        if(m_targets.isEmpty())
+        {
+            m_pc = statement.jump + 1;
+            return true;
+        }
+        m_loopIndex = 0;
+        m_pc++;
+        return enterLoopIteration();
+    case ProvisionScript::Op::End:
+        closeLoopSession();
+        m_loopIndex++;
+        if(m_loopIndex < m_targets.length())
+        {
+            m_pc = statement.jump + 1;
+            return enterLoopIteration();
+        }
+        m_loopIndex = -1;
+        m_fields.clear();
+        break;
+    }
+    m_pc++;
+    return true;
+}
+
+bool ScriptExecutor::waitFor(const QString& field, int timeoutMs)
+{
+    if(m_fields.contains(field))
+    {
+        m_waitingField.clear();
+        m_waitTimer->stop();
+        return true;
+    }
+    if(m_waitingField != field)
+    {
+        m_waitingField = field;
+        m_waitTimer->start(timeoutMs);
+    }
+    return false;
+}
+
+void ScriptExecutor::send(Comm* comm, const QByteArray& cmd)
+{
+    // Comm sends the queries before the settings,
+    // the script order is kept by never going back to a higher priority
+    const int priority = qMax(Comm::autoPriority(cmd), m_minPriority);
+    comm->scheduleCommand(cmd, priority);
+    m_minPriority = Comm::isDeferred(cmd) ? int(Comm::DeferredPriority) : priority;
+}
+
+void ScriptExecutor::clearField(const QString& field)
+{
+    m_fields.remove(field);
+    // both are in the response of 0xCC
+    if(field == "noise" || field == "ambientvolume")
+    {
+        m_fields.remove("noise");
+        m_fields.remove("ambientvolume");
+    }
+}
+
+bool ScriptExecutor::enterLoopIteration()
+{
+    const Target& target = m_targets[m_loopIndex];
+    m_fields.clear();
+    m_minPriority = Comm::InteractivePriority;
+    m_variables["address"] = target.address;
+    m_variables["index"] = QString::number(m_loopIndex + 1);
+    emit log(tr("Device") + " " + target.address);
+    if(target.comm != nullptr || !m_factory)
+        return true;
+
+    Comm* comm = m_factory(target.info, target.isBLE);
+    m_loopSession = comm;
+    m_isConnecting = true;
+    // Comm lives in the I/O thread, these are queued connections
+    connect(comm, &Comm::newData, this, [ = ](const QByteArray & data) {onNewData(comm, data);});
+    connect(comm, &Comm::stateChanged, this, &ScriptExecutor::onLoopSessionStateChanged);
+    m_connectTimer->start();
+    QMetaObject::invokeMethod(comm, "open", Qt::QueuedConnection, Q_ARG(QBluetoothDeviceInfo, target.info));
+    return false;
+}
+
+void ScriptExecutor::onLoopSessionStateChanged(bool connected)
+{
+    if(!m_isRunning || !m_isConnecting)
+        return;
+    m_connectTimer->stop();
+    m_isConnecting = false;
+    if(!connected)
+    {
+        abort(tr("Failed to connect"));
+        return;
+    }
+    step();
+}
+
+void ScriptExecutor::closeLoopSession()
+{
+    m_connectTimer->stop();
+    m_isConnecting = false;
+    if(m_loopSession == nullptr)
+        return;
+    m_loopSession->disconnect(this);
+    ConnectionPool::closeSession(m_loopSession);
+    m_loopSession = nullptr;
+}
+
+Comm* ScriptExecutor::currentComm() const
+{
+    if(m_loopIndex >= 0)
+        return m_loopSession != nullptr ? m_loopSession : m_targets[m_loopIndex].comm;
+    for(const auto& target : m_targets)
+    {
+        if(target.comm != nullptr)
+            return target.comm;
+    }
+    return nullptr;
+}
+
+QString ScriptExecutor::expand(const QString& value) const
+{
+    static const QRegularExpression variablePattern("\\$\\{(\\w+)\\}");
+    QString result;
+    int last = 0;
+    auto it = variablePattern.globalMatch(value);
+    while(it.hasNext())
+    {
+        auto match = it.next();
+        const QString name = match.captured(1);
+        result += value.midRef(last, match.capturedStart() - last);
+        result += m_variables.contains(name) ? m_variables[name] : m_fields.value(name.toLower());
+        last = match.capturedEnd();
+    }
+    result += value.midRef(last);
+    return result;
+}
+
+void ScriptExecutor::onNewData(Comm* comm, const QByteArray& data)
+{
+    if(!m_isRunning || comm != currentComm())
+        return;
+    protocol::Decoded decoded;
+    if(!protocol::decode(Comm::asSpan(data), decoded))
+        return;
+    const auto values = fieldValues(decoded);
+    for(const auto& value : values)
+        m_fields[value.first] = value.second;
+    if(!m_waitingField.isEmpty() && m_fields.contains(m_waitingField) && !m_delayTimer->isActive())
+        step();
+}
+
+QList<QPair<QString, QString>> ScriptExecutor::fieldValues(const protocol::Decoded& decoded)
+{
+    static const QStringList noiseModes = {"", "normal", "reduction", "ambient"};
+    static const QStringList soundEffects = {"normal", "pop", "classical", "rock"};
+    static const QStringList LDACModes = {"off", "48k", "96k"};
+    static const QStringList playbackControls = {"play", "pause", "volumeup", "volumedown", "next", "previous"};
+    const QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(decoded.bytes.data()), decoded.bytes.size());
+    const int value = decoded.value;
+    QList<QPair<QString, QString>> result;
+    switch(decoded.field)
+    {
+    case protocol::Field::Battery:
+        result.append({"battery", QString::number(value)});
+        break;
+    case protocol::Field::Firmware:
+        // the same format as the panel and the inventory
+        result.append({"firmware", QString(bytes.toHex('.'))});
+        break;
+    case protocol::Field::MACAddress:
+        result.append({"mac", QString(bytes.toHex(':'))});
+        break;
+    case protocol::Field::Name:
+        result.append({"name", QString::fromUtf8(bytes)});
+        break;
+    case protocol::Field::NoiseMode:
+        result.append({"noise", noiseModes.value(value, QString::number(value))});
+        if(decoded.extra >= 0)
+            result.append({"ambientvolume", QString::number(decoded.extra)});
+        break;
+    case protocol::Field::SoundEffect:
+        result.append({"soundeffect", soundEffects.value(value, QString::number(value))});
+        break;
+    case protocol::Field::GameMode:
+        result.append({"gamemode", value ? "on" : "off"});
+        break;
+    case protocol::Field::LDAC:
+        result.append({"ldac", LDACModes.value(value, QString::number(value))});
+        break;
+    case protocol::Field::PromptVolume:
+        result.append({"promptvolume", QString::number(value)});
+        break;
+    case protocol::Field::ShutdownTimerEnabled:
+        if(!value)
+            result.append({"shutdowntimer", "off"});
+        break;
+    case protocol::Field::ShutdownTimer:
+        result.append({"shutdowntimer", QString::number(value)});
+        break;
+    case protocol::Field::AutoPoweroff:
+        result.append({"autopoweroff", value ? "on" : "off"});
+        break;
+    case protocol::Field::ControlSettings:
+        result.append({"controlsettings", QString::number(value)});
+        break;
+    case protocol::Field::PlaybackControl:
+        result.append({"playback", playbackControls.value(value, QString::number(value))});
+        break;
+    case protocol::Field::Event:
+        result.append({"event", QString(QByteArray(1, value).toHex().toUpper() + bytes.toHex().toUpper())});
+        break;
+    default:
+        break;
+    }
+    return result;
+}
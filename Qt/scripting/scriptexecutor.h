@@ -0,0 +1,91 @@
+#ifndef SCRIPTEXECUTOR_H
+#define SCRIPTEXECUTOR_H
+
+#include <QObject>
+#include <QHash>
+#include <QTimer>
+#include <QBluetoothDeviceInfo>
+#include <functional>
+
+#include "provisionscript.h"
+#include "protocol.h"
+
+class Comm;
+
+// Runs a ProvisionScript against one or more sessions.
+// Commands are sent without waiting for the responses,
+// the executor only blocks on wait/assert/delay, so independent steps are pipelined.
+// They are never scheduled ahead of the commands sent before them, so a read follows the set before it.
+// Outside foreach, the first target with a session is used.
+// Inside foreach, a target without a session is connected with the session factory,
+// one at a time, and the session is closed at the end of its iteration.
+class ScriptExecutor : public QObject
+{
+    Q_OBJECT
+public:
+    struct Target
+    {
+        QString address;
+        // nullptr: opened with the session factory inside foreach
+        Comm* comm = nullptr;
+        QBluetoothDeviceInfo info;
+        bool isBLE = false;
+    };
+
+    // creates a session which lives in the I/O thread, it's closed with ConnectionPool::closeSession()
+    using SessionFactory = std::function<Comm*(const QBluetoothDeviceInfo& info, bool isBLE)>;
+
+    explicit ScriptExecutor(const ProvisionScript& script, const QList<Target>& targets, QObject *parent = nullptr);
+    bool isRunning() const;
+    void setSessionFactory(const SessionFactory& factory);
+
+    // field name -> value, in the format used by assert
+    static QList<QPair<QString, QString>> fieldValues(const protocol::Decoded& decoded);
+
+    static const int defaultWaitTimeoutMs = 3000;
+    static const int connectTimeoutMs = 20000;
+public slots:
+    void start();
+    void abort(const QString& reason = QString());
+private:
+    ProvisionScript m_script;
+    QList<Target> m_targets;
+    int m_pc = 0;
+    // the index in m_targets inside foreach, -1 outside
+    int m_loopIndex = -1;
+    QHash<QString, QString> m_variables;
+    // the fields received from the current target
+    QHash<QString, QString> m_fields;
+    QString m_waitingField;
+    QTimer* m_waitTimer = nullptr;
+    QTimer* m_delayTimer = nullptr;
+    QTimer* m_connectTimer = nullptr;
+    SessionFactory m_factory;
+    // the session opened for the current iteration, nullptr if the target has its own
+    Comm* m_loopSession = nullptr;
+    bool m_isConnecting = false;
+    bool m_isRunning = false;
+    // the lowest priority(the largest Comm::Priority) used by the current target so far
+    int m_minPriority = 0;
+
+    void step();
+    bool execute(const ProvisionScript::Statement& statement);
+    bool waitFor(const QString& field, int timeoutMs);
+    void send(Comm* comm, const QByteArray& cmd);
+    // the old value must not satisfy the following wait/assert
+    void clearField(const QString& field);
+    // returns false if the target is being connected, step() is called after connected
+    bool enterLoopIteration();
+    void closeLoopSession();
+    void onLoopSessionStateChanged(bool connected);
+    void finish(bool success, const QString& message);
+    Comm* currentComm() const;
+    QString expand(const QString& value) const;
+private slots:
+    void onNewData(Comm* comm, const QByteArray& data);
+signals:
+    void log(const QString& msg);
+    void finished(bool success, const QString& message);
+};
+
+#endif // SCRIPTEXECUTOR_H
@@ -0,0 +1,172 @@
+#include "telemetrysampler.h"
+#include "comms/comm.h"
+
+#include <QDebug>
+#include <QDateTime>
+#include <QTextStream>
+
+TelemetrySampler::TelemetrySampler(QObject *parent)
+    : QObject{parent}
+{
+    m_pollTimer = new QTimer(this);
+    m_pollTimer->setSingleShot(true);
+    connect(m_pollTimer, &QTimer::timeout, this, &TelemetrySampler::onPollTimeout);
+    addMetric('\xD0', "battery");
+}
+
+void TelemetrySampler::addMetric(char cmd, const QString& name)
+{
+    m_metrics[cmd] = name;
+}
+
+void TelemetrySampler::addSession(const QString& deviceId, Comm* comm)
+{
+    removeSession(deviceId);
+    // a reconnected unit keeps its samples, only the session is replaced
+    Session& session = m_sessions[deviceId];
+    session.comm = comm;
+    session.isConnected = false;
+    // Comm lives in the I/O thread, these are queued connections
+    connect(comm, &Comm::newData, this, [ = ](const QByteArray & data) {onNewData(deviceId, data);});
+    connect(comm, &Comm::stateChanged, this, [ = ](bool connected) {onStateChanged(deviceId, connected);});
+    connect(comm, &QObject::destroyed, this, [ = ]
+    {
+        if(m_sessions.value(deviceId).comm == comm)
+            removeSession(deviceId);
+    });
+}
+
+void TelemetrySampler::removeSession(const QString& deviceId)
+{
+    if(!m_sessions.contains(deviceId))
+        return;
+    Comm* comm = m_sessions[deviceId].comm;
+    // keep the samples, only stop polling
+    m_sessions[deviceId].comm = nullptr;
+    m_sessions[deviceId].isConnected = false;
+    if(comm != nullptr)
+        disconnect(comm, nullptr, this, nullptr);
+    updatePollTimer();
+}
+
+void TelemetrySampler::setEnabled(bool enabled)
+{
+    m_isEnabled = enabled;
+    updatePollTimer();
+}
+
+bool TelemetrySampler::isEnabled() const
+{
+    return m_isEnabled;
+}
+
+void TelemetrySampler::onStateChanged(const QString& deviceId, bool connected)
+{
+    if(!m_sessions.contains(deviceId))
+        return;
+    Session& session = m_sessions[deviceId];
+    session.isConnected = connected;
+    if(connected)
+    {
+        // poll soon after connected, the response of readSettings() might come first
+        const qint64 now = QDateTime::currentMSecsSinceEpoch();
+        for(auto it = m_metrics.cbegin(); it != m_metrics.cend(); ++it)
+            session.series[it.key()].nextPollTime = now + minIntervalMs;
+    }
+    updatePollTimer();
+}
+
+void TelemetrySampler::onNewData(const QString& deviceId, const QByteArray& data)
+{
+    // cmd + single byte response, or a pushed value(0xCC) which postpones the next poll as well
+    if(data.length() != 4 || (data[0] != '\xBB' && data[0] != '\xCC') || data[1] != '\x02')
+        return;
+    const char cmd = data[2];
+    if(!m_metrics.contains(cmd) || !m_sessions.contains(deviceId))
+        return;
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const qint32 value = (quint8)data[3];
+    Series& series = m_sessions[deviceId].series[cmd];
+    if(series.ring.isEmpty())
+        series.intervalMs = initialIntervalMs;
+    else if(value < series.ring.last().value)
+        series.intervalMs = minIntervalMs; // dropping
+    else if(value == series.ring.last().value)
+        series.intervalMs = qMin(series.intervalMs * 2, maxIntervalMs); // stable
+    else
+        series.intervalMs = initialIntervalMs; // charging
+    series.ring.append(now / 1000, value);
+    series.nextPollTime = now + series.intervalMs;
+    updatePollTimer();
+}
+
+void TelemetrySampler::onPollTimeout()
+{
+    if(!m_isEnabled)
+        return;
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for(auto it = m_sessions.begin(); it != m_sessions.end(); ++it)
+    {
+        if(!it->isConnected || it->comm == nullptr)
+            continue;
+        for(auto seriesIt = it->series.begin(); seriesIt != it->series.end(); ++seriesIt)
+        {
+            if(seriesIt->nextPollTime > now)
+                continue;
+            // thread-safe
+            it->comm->sendCommand(QByteArray(1, seriesIt.key()));
+            // rescheduled by the response, this is the fallback
+            seriesIt->nextPollTime = now + seriesIt->intervalMs;
+        }
+    }
+    updatePollTimer();
+}
+
+void TelemetrySampler::updatePollTimer()
+{
+    qint64 earliest = -1;
+    for(const auto& session : qAsConst(m_sessions))
+    {
+        if(!session.isConnected || session.comm == nullptr)
+            continue;
+        for(const auto& series : session.series)
+        {
+            if(earliest == -1 || series.nextPollTime < earliest)
+                earliest = series.nextPollTime;
+        }
+    }
+    if(!m_isEnabled || earliest == -1)
+    {
+        m_pollTimer->stop();
+        return;
+    }
+    qint64 remaining = earliest - QDateTime::currentMSecsSinceEpoch();
+    m_pollTimer->start(qMax<qint64>(remaining, 0));
+}
+
+bool TelemetrySampler::exportCsv(QIODevice* device) const
+{
+    if(device == nullptr || !device->isWritable())
+        return false;
+    QTextStream stream(device);
+    stream << "device,metric,time,value\n";
+    for(auto it = m_sessions.cbegin(); it != m_sessions.cend(); ++it)
+    {
+        for(auto seriesIt = it->series.cbegin(); seriesIt != it->series.cend(); ++seriesIt)
+        {
+            const QString metric = m_metrics.value(seriesIt.key());
+            const TimeSeriesRing& ring = seriesIt->ring;
+            for(int i = 0; i < ring.size(); i++)
+            {
+                TimeSeriesRing::Sample sample = ring.at(i);
+                stream << it.key() << ','
+                       << metric << ','
+                       << QDateTime::fromSecsSinceEpoch(sample.time).toString(Qt::ISODate) << ','
+                       << sample.value << '\n';
+            }
+        }
+    }
+    stream.flush();
+    return stream.status() == QTextStream::Ok;
+}
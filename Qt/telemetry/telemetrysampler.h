@@ -0,0 +1,62 @@
+#ifndef TELEMETRYSAMPLER_H
+#define TELEMETRYSAMPLER_H
+
+#include <QObject>
+#include <QHash>
+#include <QTimer>
+#include <QIODevice>
+
+#include "timeseriesring.h"
+
+class Comm;
+
+// Polls cheap status queries(battery by default) of all connected sessions.
+// The interval grows when the value is stable and shrinks when it is dropping.
+// Any response to the same query(e.g. from readSettings()) counts as a sample,
+// so the poll is skipped if the value is already fresh.
+class TelemetrySampler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TelemetrySampler(QObject *parent = nullptr);
+
+    // the query must have a single byte response, like D0(battery) or 08(game mode)
+    void addMetric(char cmd, const QString& name);
+    void addSession(const QString& deviceId, Comm* comm);
+    void removeSession(const QString& deviceId);
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+    // CSV: device,metric,time,value
+    bool exportCsv(QIODevice* device) const;
+
+    static const int minIntervalMs = 15000;
+    static const int initialIntervalMs = 60000;
+    static const int maxIntervalMs = 600000;
+    static const int ringCapacity = 1024;
+private:
+    struct Series
+    {
+        TimeSeriesRing ring = TimeSeriesRing(ringCapacity);
+        int intervalMs = initialIntervalMs;
+        qint64 nextPollTime = 0;
+    };
+    struct Session
+    {
+        Comm* comm = nullptr;
+        bool isConnected = false;
+        QHash<char, Series> series;
+    };
+
+    QHash<char, QString> m_metrics;
+    QHash<QString, Session> m_sessions;
+    QTimer* m_pollTimer = nullptr;
+    bool m_isEnabled = true;
+
+    void updatePollTimer();
+private slots:
+    void onPollTimeout();
+    void onNewData(const QString& deviceId, const QByteArray& data);
+    void onStateChanged(const QString& deviceId, bool connected);
+};
+
+#endif // TELEMETRYSAMPLER_H
@@ -0,0 +1,65 @@
+#ifndef TIMESERIESRING_H
+#define TIMESERIESRING_H
+
+#include <QVector>
+
+// Fixed-size ring of samples, the oldest sample is overwritten when it's full.
+// The storage is allocated once in the constructor.
+class TimeSeriesRing
+{
+public:
+    struct Sample
+    {
+        quint32 time; // seconds since epoch
+        qint32 value;
+    };
+
+    explicit TimeSeriesRing(int capacity = 1024)
+        : m_samples(capacity)
+    {
+    }
+
+    void append(quint32 time, qint32 value)
+    {
+        if(m_samples.isEmpty())
+            return;
+        m_samples[(m_head + m_size) % m_samples.size()] = {time, value};
+        if(m_size < m_samples.size())
+            m_size++;
+        else
+            m_head = (m_head + 1) % m_samples.size();
+    }
+
+    int size() const
+    {
+        return m_size;
+    }
+
+    int capacity() const
+    {
+        return m_samples.size();
+    }
+
+    bool isEmpty() const
+    {
+        return m_size == 0;
+    }
+
+    // 0 is the oldest one
+    Sample at(int i) const
+    {
+        return m_samples.at((m_head + i) % m_samples.size());
+    }
+
+    Sample last() const
+    {
+        return at(m_size - 1);
+    }
+
+private:
+    QVector<Sample> m_samples;
+    int m_head = 0;
+    int m_size = 0;
+};
+
+#endif // TIMESERIESRING_H
@@ -0,0 +1,176 @@
+#include "tracerecorder.h"
+
+#include <QIODevice>
+#include <QThread>
+#include <QCoreApplication>
+#include <QJsonDocument>
+
+TraceRecorder* TraceRecorder::instance()
+{
+    static TraceRecorder recorder;
+    return &recorder;
+}
+
+TraceRecorder::TraceRecorder()
+{
+    m_clock.start();
+}
+
+void TraceRecorder::setEnabled(bool enabled)
+{
+    m_isEnabled.storeRelaxed(enabled ? 1 : 0);
+}
+
+void TraceRecorder::setCapacity(int capacity)
+{
+    QMutexLocker locker(&m_lock);
+    m_capacity = qMax(capacity, 1);
+    m_events.clear();
+    m_head = 0;
+}
+
+void TraceRecorder::clear()
+{
+    QMutexLocker locker(&m_lock);
+    m_events.clear();
+    m_head = 0;
+}
+
+int TraceRecorder::eventCount() const
+{
+    QMutexLocker locker(&m_lock);
+    return m_events.length();
+}
+
+qint64 TraceRecorder::timestamp() const
+{
+    return m_clock.nsecsElapsed() / 1000;
+}
+
+quint32 TraceRecorder::nextId()
+{
+    quint32 id = m_nextId.fetchAndAddRelaxed(1) + 1;
+    // wrapped around
+    if(id == 0)
+        id = m_nextId.fetchAndAddRelaxed(1) + 1;
+    return id;
+}
+
+void TraceRecorder::complete(const char* category, const QString& name, qint64 startUs, const QJsonObject& args)
+{
+    if(!isEnabled())
+        return;
+    const qint64 now = timestamp();
+    record('X', category, name, startUs, now - startUs, 0, args);
+}
+
+void TraceRecorder::instant(const char* category, const QString& name, const QJsonObject& args)
+{
+    if(!isEnabled())
+        return;
+    record('i', category, name, timestamp(), 0, 0, args);
+}
+
+void TraceRecorder::asyncBegin(const char* category, const QString& name, quint32 id, const QJsonObject& args)
+{
+    if(!isEnabled())
+        return;
+    record('b', category, name, timestamp(), 0, id, args);
+}
+
+void TraceRecorder::asyncEnd(const char* category, const QString& name, quint32 id, const QJsonObject& args)
+{
+    // not checked, so a span started before disabling is still closed
+    // the callers only end the spans they have begun
+    record('e', category, name, timestamp(), 0, id, args);
+}
+
+void TraceRecorder::record(char phase, const char* category, const QString& name, qint64 timestamp, qint64 duration, quint32 id, const QJsonObject& args)
+{
+    const Qt::HANDLE threadId = QThread::currentThreadId();
+    QMutexLocker locker(&m_lock);
+    auto it = m_threadIndexes.constFind(threadId);
+    if(it == m_threadIndexes.constEnd())
+    {
+        QString threadName = QThread::currentThread()->objectName();
+        if(threadName.isEmpty())
+            threadName = QThread::currentThread() == QCoreApplication::instance()->thread() ? "Main" : QString("Thread %1").arg(m_threadNames.length());
+        it = m_threadIndexes.insert(threadId, m_threadNames.length());
+        m_threadNames.append(threadName);
+    }
+    Event event {phase, category, name, timestamp, duration, id, it.value(), args};
+    if(m_events.length() < m_capacity)
+        m_events.append(event);
+    else
+    {
+        m_events[m_head] = event;
+        m_head = (m_head + 1) % m_capacity;
+    }
+}
+
+bool TraceRecorder::exportJson(QIODevice* device) const
+{
+    if(device == nullptr || !device->isWritable())
+        return false;
+    QMutexLocker locker(&m_lock);
+    const qint64 pid = QCoreApplication::applicationPid();
+    // one event per line, so a large trace doesn't have to be built in memory
+    device->write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool isFirst = true;
+    auto writeEvent = [&](const QJsonObject & object)
+    {
+        if(!isFirst)
+            device->write(",\n");
+        isFirst = false;
+        device->write(QJsonDocument(object).toJson(QJsonDocument::Compact));
+    };
+    for(int i = 0; i < m_threadNames.length(); i++)
+    {
+        writeEvent(
+        {
+            {"ph", "M"}, {"name", "thread_name"}, {"pid", pid}, {"tid", i},
+            {"args", QJsonObject{{"name", m_threadNames[i]}}},
+        });
+    }
+    for(int i = 0; i < m_events.length(); i++)
+    {
+        const Event& event = m_events[(m_head + i) % m_events.length()];
+        QJsonObject object
+        {
+            {"ph", QString(event.phase)},
+            {"cat", event.category},
+            {"name", event.name},
+            {"ts", event.timestamp},
+            {"pid", pid},
+            {"tid", event.thread},
+        };
+        if(event.phase == 'X')
+            object.insert("dur", event.duration);
+        else if(event.phase == 'i')
+            object.insert("s", "t");
+        else
+            object.insert("id", QString("0x%1").arg(event.id, 0, 16));
+        if(!event.args.isEmpty())
+            object.insert("args", event.args);
+        writeEvent(object);
+    }
+    device->write("\n]}\n");
+    return true;
+}
+
+TraceSpan::TraceSpan(const char* category, const QString& name, const QJsonObject& args)
+    : m_category(category)
+{
+    TraceRecorder* recorder = TraceRecorder::instance();
+    if(!recorder->isEnabled())
+        return;
+    m_name = name;
+    m_args = args;
+    m_start = recorder->timestamp();
+}
+
+TraceSpan::~TraceSpan()
+{
+    if(m_start >= 0)
+        TraceRecorder::instance()->complete(m_category, m_name, m_start, m_args);
+}
@@ -0,0 +1,92 @@
+#ifndef TRACERECORDER_H
+#define TRACERECORDER_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QStringList>
+#include <QJsonObject>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+class QIODevice;
+
+// Records timeline events and exports them in the Chrome trace-event format,
+// which Perfetto(ui.perfetto.dev) and chrome://tracing can open.
+// Thread-safe. Disabled by default, the record functions return immediately then.
+// The oldest events are dropped when the buffer is full.
+class TraceRecorder
+{
+public:
+    static TraceRecorder* instance();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const
+    {
+        return m_isEnabled.loadRelaxed();
+    }
+    // clears the recorded events
+    void setCapacity(int capacity);
+    void clear();
+    int eventCount() const;
+
+    // microseconds since the recorder is created
+    qint64 timestamp() const;
+    // for async spans, never returns 0
+    quint32 nextId();
+
+    // a span on the current thread, from startUs to now
+    void complete(const char* category, const QString& name, qint64 startUs, const QJsonObject& args = QJsonObject());
+    void instant(const char* category, const QString& name, const QJsonObject& args = QJsonObject());
+    // a span which might start and end on different threads, matched by category and id
+    // spans with the same id are nested, asyncEnd() is recorded even if disabled
+    void asyncBegin(const char* category, const QString& name, quint32 id, const QJsonObject& args = QJsonObject());
+    void asyncEnd(const char* category, const QString& name, quint32 id, const QJsonObject& args = QJsonObject());
+
+    // {"traceEvents": [...]}
+    bool exportJson(QIODevice* device) const;
+
+    static const int defaultCapacity = 100000;
+private:
+    struct Event
+    {
+        char phase;
+        const char* category;
+        QString name;
+        qint64 timestamp;
+        qint64 duration;
+        quint32 id;
+        int thread;
+        QJsonObject args;
+    };
+
+    TraceRecorder();
+    void record(char phase, const char* category, const QString& name, qint64 timestamp, qint64 duration, quint32 id, const QJsonObject& args);
+
+    mutable QMutex m_lock;
+    QAtomicInt m_isEnabled;
+    QAtomicInteger<quint32> m_nextId;
+    QElapsedTimer m_clock;
+    // a ring buffer, m_head is the oldest event when it's full
+    QVector<Event> m_events;
+    int m_capacity = defaultCapacity;
+    int m_head = 0;
+    QHash<Qt::HANDLE, int> m_threadIndexes;
+    QStringList m_threadNames;
+};
+
+// Records a complete span from the constructor to the destructor
+class TraceSpan
+{
+public:
+    TraceSpan(const char* category, const QString& name, const QJsonObject& args = QJsonObject());
+    ~TraceSpan();
+private:
+    const char* m_category;
+    QString m_name;
+    QJsonObject m_args;
+    qint64 m_start = -1;
+};
+
+#endif // TRACERECORDER_H
@@ -0,0 +1,84 @@
+#include "commsim.h"
+
+#include <QDateTime>
+
+CommSim::CommSim(const Config& config, int index, QObject *parent)
+    : Comm{parent}
+    , m_config(config)
+    , m_headset(index)
+    , m_random(index + 1)
+{
+}
+
+void CommSim::open(const QBluetoothDeviceInfo& deviceInfo)
+{
+    sessionDeviceInfo = deviceInfo;
+    const quint32 generation = ++m_generation;
+    QTimer::singleShot(m_config.connectDelayMs, this, [ = ]
+    {
+        if(generation != m_generation)
+            return;
+        m_isOpen = true;
+        emit stateChanged(true);
+    });
+}
+
+void CommSim::close()
+{
+    m_generation++;
+    cancelTransfer();
+    if(!m_isOpen)
+        return;
+    m_isOpen = false;
+    emit stateChanged(false);
+}
+
+const SimulatedHeadset& CommSim::headset() const
+{
+    return m_headset;
+}
+
+qint64 CommSim::write(const QByteArray &data)
+{
+    if(!m_isOpen)
+        return -1;
+    // data might point into a pooled packet, receive() copies it
+    const QList<QByteArray> responses = m_headset.receive(data);
+    for(const auto& frame : responses)
+    {
+        if(m_config.lossRate > 0 && m_random.generateDouble() < m_config.lossRate)
+            continue;
+        deliver(frame);
+    }
+    return data.length();
+}
+
+void CommSim::deliver(const QByteArray& frame)
+{
+    int delay = m_config.latencyMs;
+    if(m_config.jitterMs > 0)
+        delay += m_random.bounded(-m_config.jitterMs, m_config.jitterMs + 1);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const qint64 deliveryTime = qMax(now + qMax(delay, 0), m_lastDeliveryTime);
+    m_lastDeliveryTime = deliveryTime;
+
+    QList<QByteArray> fragments;
+    if(m_config.maxFragmentLen > 0)
+    {
+        for(int i = 0; i < frame.length(); i += m_config.maxFragmentLen)
+            fragments.append(frame.mid(i, m_config.maxFragmentLen));
+    }
+    else
+        fragments.append(frame);
+
+    const quint32 generation = m_generation;
+    // timers with the same deadline fire in the order they are started
+    QTimer::singleShot(deliveryTime - now, this, [ = ]
+    {
+        if(generation != m_generation)
+            return;
+        // one chunk per read, like a socket with a small MTU
+        for(const auto& fragment : fragments)
+            appendRxData(fragment);
+    });
+}
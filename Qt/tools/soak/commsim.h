@@ -0,0 +1,47 @@
+#ifndef COMMSIM_H
+#define COMMSIM_H
+
+#include "comms/comm.h"
+#include "simulatedheadset.h"
+
+#include <QRandomGenerator>
+
+// A Comm connected to a SimulatedHeadset instead of a radio.
+// Everything above write()/appendRxData() is the real Comm(framing, scheduling, retries),
+// the link only adds latency, loss and fragmentation.
+class CommSim : public Comm
+{
+    Q_OBJECT
+public:
+    struct Config
+    {
+        // one way, the response arrives after latencyMs +/- jitterMs
+        int latencyMs = 20;
+        int jitterMs = 10;
+        // the probability that a response is lost, 0-1
+        double lossRate = 0;
+        // the responses are split into chunks of this size, 0 to disable
+        int maxFragmentLen = 0;
+        int connectDelayMs = 100;
+    };
+
+    CommSim(const Config& config, int index, QObject *parent = nullptr);
+    void open(const QBluetoothDeviceInfo& deviceInfo) override;
+    void close() override;
+    const SimulatedHeadset& headset() const;
+protected:
+    qint64 write(const QByteArray &data) override;
+private:
+    Config m_config;
+    SimulatedHeadset m_headset;
+    QRandomGenerator m_random;
+    bool m_isOpen = false;
+    // deliveries scheduled before close() are dropped
+    quint32 m_generation = 0;
+    // the link keeps the order, a response never overtakes the previous one
+    qint64 m_lastDeliveryTime = 0;
+
+    void deliver(const QByteArray& frame);
+};
+
+#endif // COMMSIM_H
@@ -0,0 +1,79 @@
+#include "soakharness.h"
+#include "telemetry/tracerecorder.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QLoggingCategory>
+#include <QDebug>
+#include <QFile>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("mEDIFIER-soak");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Drives simulated headsets through Comm and reports the throughput, latency and resource usage.");
+    parser.addHelpOption();
+    const QList<QCommandLineOption> options =
+    {
+        {"sessions", "The number of simulated headsets.", "n", "1000"},
+        {"ramp-step", "Sessions added per ramp interval.", "n", "100"},
+        {"ramp-interval-ms", "The interval between ramp steps.", "ms", "10000"},
+        {"io-threads", "The number of I/O threads the sessions are spread over.", "n", "1"},
+        {"report-interval-ms", "The interval between report lines.", "ms", "5000"},
+        {"duration-ms", "Stop after this time, 0: one ramp interval after the last session is added.", "ms", "0"},
+        {"latency", "One way link latency.", "ms", "20"},
+        {"jitter", "Link latency jitter.", "ms", "10"},
+        {"loss", "The probability that a response is lost(0-1).", "rate", "0"},
+        {"fragment", "Split the responses into chunks of this size, 0 to disable.", "bytes", "0"},
+        {"script", "A provisioning script run on every session, a built-in one is used if not set.", "file"},
+        {"trace", "Record the command lifecycle and save it as a Chrome trace(open it in Perfetto).", "file"},
+        {"verbose", "Print the debug output of Comm."},
+    };
+    parser.addOptions(options);
+    parser.process(a);
+
+    // Comm logs every frame, that would flood the output
+    if(!parser.isSet("verbose"))
+        QLoggingCategory::setFilterRules("default.debug=false");
+
+    ProvisionScript script;
+    QString errorString;
+    const bool isLoaded = parser.isSet("script") ? script.load(parser.value("script"), &errorString)
+                          : script.parse(SoakHarness::builtinScript, &errorString);
+    if(!isLoaded)
+    {
+        qCritical().noquote() << errorString;
+        return 1;
+    }
+
+    SoakHarness::Options harnessOptions;
+    harnessOptions.sessions = qMax(parser.value("sessions").toInt(), 1);
+    harnessOptions.rampStep = qMax(parser.value("ramp-step").toInt(), 1);
+    harnessOptions.rampIntervalMs = qMax(parser.value("ramp-interval-ms").toInt(), 100);
+    harnessOptions.ioThreads = qMax(parser.value("io-threads").toInt(), 1);
+    harnessOptions.reportIntervalMs = qMax(parser.value("report-interval-ms").toInt(), 100);
+    harnessOptions.durationMs = qMax(parser.value("duration-ms").toInt(), 0);
+    harnessOptions.link.latencyMs = qMax(parser.value("latency").toInt(), 0);
+    harnessOptions.link.jitterMs = qMax(parser.value("jitter").toInt(), 0);
+    harnessOptions.link.lossRate = qBound(0.0, parser.value("loss").toDouble(), 1.0);
+    harnessOptions.link.maxFragmentLen = qMax(parser.value("fragment").toInt(), 0);
+
+    const QString traceFilename = parser.value("trace");
+    TraceRecorder::instance()->setEnabled(!traceFilename.isEmpty());
+
+    SoakHarness harness(harnessOptions, script);
+    QObject::connect(&harness, &SoakHarness::finished, &a, [&]
+    {
+        if(!traceFilename.isEmpty())
+        {
+            QFile file(traceFilename);
+            if(!file.open(QFile::WriteOnly | QFile::Truncate) || !TraceRecorder::instance()->exportJson(&file))
+                qCritical().noquote() << "Failed to save to" << traceFilename;
+        }
+        QCoreApplication::quit();
+    }, Qt::QueuedConnection);
+    QMetaObject::invokeMethod(&harness, "start", Qt::QueuedConnection);
+    return a.exec();
+}
@@ -0,0 +1,201 @@
+#include "simulatedheadset.h"
+#include "comms/comm.h"
+
+SimulatedHeadset::SimulatedHeadset(int index)
+{
+    // a locally administered address, so it never matches a real device
+    m_macAddress = QByteArray::fromHex("020000000000");
+    m_macAddress[3] = (char)(index >> 16);
+    m_macAddress[4] = (char)(index >> 8);
+    m_macAddress[5] = (char)index;
+    m_name = "EDIFIER W820NB-" + QByteArray::number(index);
+    m_firmware = QByteArray::fromHex("010203");
+    m_battery = 50 + index % 50;
+}
+
+QByteArray SimulatedHeadset::macAddress() const
+{
+    return m_macAddress;
+}
+
+QString SimulatedHeadset::name() const
+{
+    return QString::fromUtf8(m_name);
+}
+
+QList<QByteArray> SimulatedHeadset::receive(const QByteArray& data)
+{
+    QList<QByteArray> responses;
+    m_rxBuffer.append(data);
+    while(!m_rxBuffer.isEmpty())
+    {
+        if((quint8)m_rxBuffer[0] != protocol::commandHead)
+        {
+            int next = m_rxBuffer.indexOf((char)protocol::commandHead, 1);
+            m_rxBuffer.remove(0, next < 0 ? m_rxBuffer.length() : next);
+            continue;
+        }
+        if(m_rxBuffer.length() < (int)protocol::headerLen)
+            break;
+        const int frameLen = protocol::headerLen + (quint8)m_rxBuffer[1] + protocol::checksumLen;
+        if(m_rxBuffer.length() < frameLen)
+            break;
+        const QByteArray frame = m_rxBuffer.left(frameLen);
+        if(!protocol::verifyChecksum(Comm::asSpan(frame)))
+        {
+            // the device ignores broken frames, the host retries after the timeout
+            m_rxBuffer.remove(0, 1);
+            continue;
+        }
+        m_rxBuffer.remove(0, frameLen);
+        responses.append(handleCommand(frame.mid(protocol::headerLen, frameLen - protocol::headerLen - protocol::checksumLen)));
+    }
+    return responses;
+}
+
+QList<QByteArray> SimulatedHeadset::handleCommand(const QByteArray& cmd)
+{
+    QList<QByteArray> responses;
+    if(cmd.isEmpty())
+        return responses;
+    const quint8 type = cmd[0];
+    const int arg = cmd.length() > 1 ? (quint8)cmd[1] : -1;
+
+    if(cmd.length() == 1 || (type == 0xF0 && cmd.length() == 2))
+    {
+        // poweroff, disconnect, re-pair and reset are not simulated
+        if(!Comm::expectsResponse(cmd))
+            return responses;
+        // queries
+        QByteArray payload = cmd;
+        switch(type)
+        {
+        case 0xD0:
+            payload += byte(m_battery);
+            break;
+        case 0xC8:
+            payload += m_macAddress;
+            break;
+        case 0xC6:
+            payload += m_firmware;
+            break;
+        case 0xCC:
+            payload += byte(m_noiseMode);
+            payload += byte(m_ambientVolume + 6);
+            break;
+        case 0xC9:
+            payload += m_name;
+            break;
+        case 0xD5:
+            payload += byte(m_soundEffect);
+            break;
+        case 0x08:
+            payload += byte(m_gameMode);
+            break;
+        case 0x48:
+            payload += byte(m_ldac);
+            break;
+        case 0x05:
+            payload += byte(m_promptVolume);
+            break;
+        case 0xD3:
+            payload += byte(m_shutdownTimer != 0);
+            if(m_shutdownTimer != 0)
+                payload += byte(m_shutdownTimer);
+            break;
+        case 0xD7:
+            payload += byte(m_autoPoweroff);
+            break;
+        case 0xF0:
+            payload += byte(m_controlSettings);
+            break;
+        default:
+            return responses;
+        }
+        responses.append(frame(protocol::responseHead, payload));
+        return responses;
+    }
+
+    // settings, answered like in doc/KnownCommands:
+    // most are echoed in a 0xBB frame, some in a 0xCC frame, rename and the shutdown timer only get 01
+    char head = protocol::responseHead;
+    QByteArray echo = cmd;
+    switch(type)
+    {
+    case 0xC1:
+        if(arg == 0x03 && cmd.length() == 3)
+        {
+            m_noiseMode = 3;
+            m_ambientVolume = (quint8)cmd[2] - 6;
+        }
+        else
+        {
+            m_noiseMode = arg;
+            // AA02C101 -> BB03C10106, the ambient sound volume follows the mode
+            echo += byte(m_ambientVolume + 6);
+        }
+        break;
+    case 0xC4:
+        m_soundEffect = arg;
+        head = protocol::notificationHead;
+        break;
+    case 0x09:
+        m_gameMode = arg == 0x01;
+        break;
+    case 0x49:
+        m_ldac = arg;
+        break;
+    case 0x06:
+        m_promptVolume = arg;
+        break;
+    case 0xD6:
+        m_autoPoweroff = arg == 0x01;
+        break;
+    case 0xD1:
+        if(cmd.length() != 3)
+            return responses;
+        m_shutdownTimer = (quint8)cmd[2];
+        head = protocol::notificationHead;
+        echo = QByteArray("\xD1\x01");
+        break;
+    case 0xF1:
+        if(cmd.length() != 3)
+            return responses;
+        m_controlSettings = (quint8)cmd[2];
+        break;
+    case 0xC2:
+        // playback controls have no state there
+        break;
+    case 0xCA:
+        m_name = cmd.mid(1);
+        head = protocol::notificationHead;
+        echo = QByteArray("\xCA\x01");
+        break;
+    case 0xD2:
+        m_shutdownTimer = 0;
+        head = protocol::notificationHead;
+        echo = QByteArray("\xD2\x01");
+        break;
+    default:
+        return responses;
+    }
+    // auto poweroff and the playback controls are not answered
+    if(Comm::expectsResponse(cmd))
+        responses.append(frame(head, echo));
+    return responses;
+}
+
+QByteArray SimulatedHeadset::frame(char head, const QByteArray& payload)
+{
+    QByteArray data;
+    data.reserve(protocol::headerLen + payload.length() + protocol::checksumLen);
+    data.append(head);
+    data.append(payload.length());
+    data.append(payload);
+    return Comm::addChecksum(data);
+}
+
+QByteArray SimulatedHeadset::byte(int value)
+{
+    return QByteArray(1, (char)value);
+}
@@ -0,0 +1,44 @@
+#ifndef SIMULATEDHEADSET_H
+#define SIMULATEDHEADSET_H
+
+#include <QByteArray>
+#include <QList>
+
+// The device side of the protocol, without any transport.
+// It keeps the settings of one headset and answers the commands like a W820NB does:
+// queries get a 0xBB response, settings get an echo of the new value(0xBB or 0xCC, like the captures),
+// poweroff/disconnect/re-pair/reset get nothing.
+class SimulatedHeadset
+{
+public:
+    explicit SimulatedHeadset(int index = 0);
+
+    // data: the bytes written by the host, frames can be split or merged
+    // returns the response frames(with checksum)
+    QList<QByteArray> receive(const QByteArray& data);
+    // cmd: without head and checksum
+    QList<QByteArray> handleCommand(const QByteArray& cmd);
+
+    QByteArray macAddress() const;
+    QString name() const;
+private:
+    QByteArray m_rxBuffer;
+    QByteArray m_macAddress;
+    QByteArray m_name;
+    QByteArray m_firmware;
+    int m_battery = 80;
+    int m_noiseMode = 1;
+    int m_ambientVolume = 0;
+    int m_soundEffect = 0;
+    bool m_gameMode = false;
+    int m_ldac = 0;
+    int m_promptVolume = 8;
+    int m_shutdownTimer = 0;
+    bool m_autoPoweroff = true;
+    int m_controlSettings = 7;
+
+    static QByteArray frame(char head, const QByteArray& payload);
+    static QByteArray byte(int value);
+};
+
+#endif // SIMULATEDHEADSET_H
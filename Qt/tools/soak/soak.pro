@@ -0,0 +1,34 @@
+# Load test for Comm with simulated headsets, no Bluetooth adapter is needed
+# qmake soak.pro && make && ./mEDIFIER-soak --help
+QT += core bluetooth
+QT -= gui
+CONFIG += c++17 console
+CONFIG -= app_bundle
+TARGET = mEDIFIER-soak
+
+# the app sources are included by path, like "comms/comm.h"
+INCLUDEPATH += ../.. ../../comms
+
+SOURCES += \
+    ../../comms/adaptermanager.cpp \
+    ../../comms/comm.cpp \
+    ../../scripting/provisionscript.cpp \
+    ../../scripting/scriptexecutor.cpp \
+    ../../telemetry/tracerecorder.cpp \
+    commsim.cpp \
+    main.cpp \
+    simulatedheadset.cpp \
+    soakharness.cpp
+
+HEADERS += \
+    ../../comms/adaptermanager.h \
+    ../../comms/comm.h \
+    ../../comms/mpscqueue.h \
+    ../../scripting/provisionscript.h \
+    ../../scripting/scriptexecutor.h \
+    ../../telemetry/tracerecorder.h \
+    commsim.h \
+    simulatedheadset.h \
+    soakharness.h
+
+include(../../protocol/protocol.pri)
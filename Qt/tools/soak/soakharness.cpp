@@ -0,0 +1,297 @@
+#include "soakharness.h"
+#include "scripting/scriptexecutor.h"
+
+#include <QCoreApplication>
+#include <QBluetoothDeviceInfo>
+#include <QBluetoothAddress>
+#include <QFile>
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+const char* SoakHarness::builtinScript = R"(
+foreach device
+    read battery
+    read firmware
+    read mac
+    assert battery >= 30
+    assert firmware == 01.02.03
+    set noise reduction
+    set soundeffect pop
+    set promptvolume 10
+    set shutdowntimer 30
+    set name "Bench"
+    read noise
+    read soundeffect
+    read name
+    assert noise == reduction
+    assert soundeffect == pop
+    assert name == Bench
+end
+)";
+
+LagProbe::LagProbe(QObject *parent)
+    : QObject{parent}
+{
+    m_timer = new QTimer(this);
+    m_timer->setTimerType(Qt::PreciseTimer);
+    m_timer->setInterval(intervalMs);
+    connect(m_timer, &QTimer::timeout, this, &LagProbe::onTimeout);
+}
+
+void LagProbe::start()
+{
+    m_clock.start();
+    m_lastTick = 0;
+    m_timer->start();
+}
+
+int LagProbe::takeMaxLagMs()
+{
+    return m_maxLagMs.fetchAndStoreRelaxed(0);
+}
+
+void LagProbe::onTimeout()
+{
+    const qint64 now = m_clock.elapsed();
+    const int lag = qMax<qint64>(now - m_lastTick - intervalMs, 0);
+    m_lastTick = now;
+    int current = m_maxLagMs.loadRelaxed();
+    while(lag > current && !m_maxLagMs.testAndSetRelaxed(current, lag, current))
+        ;
+}
+
+SoakHarness::SoakHarness(const Options& options, const ProvisionScript& script, QObject *parent)
+    : QObject{parent}
+    , m_options(options)
+    , m_script(script)
+    , m_out(stdout)
+{
+    qRegisterMetaType<QBluetoothDeviceInfo>();
+    qRegisterMetaType<QBluetoothAddress>();
+
+    m_mainProbe = new LagProbe(this);
+    for(int i = 0; i < qMax(m_options.ioThreads, 1); i++)
+    {
+        QThread* thread = new QThread(this);
+        thread->setObjectName(QString("CommThread%1").arg(i));
+        LagProbe* probe = new LagProbe;
+        probe->moveToThread(thread);
+        connect(thread, &QThread::finished, probe, &QObject::deleteLater);
+        m_threads.append(thread);
+        m_ioProbes.append(probe);
+    }
+
+    m_rampTimer = new QTimer(this);
+    m_rampTimer->setInterval(m_options.rampIntervalMs);
+    connect(m_rampTimer, &QTimer::timeout, this, &SoakHarness::onRampTimeout);
+    m_reportTimer = new QTimer(this);
+    m_reportTimer->setInterval(m_options.reportIntervalMs);
+    connect(m_reportTimer, &QTimer::timeout, this, &SoakHarness::report);
+}
+
+SoakHarness::~SoakHarness()
+{
+    stop();
+}
+
+void SoakHarness::start()
+{
+    for(int i = 0; i < m_threads.length(); i++)
+    {
+        m_threads[i]->start();
+        QMetaObject::invokeMethod(m_ioProbes[i], "start", Qt::QueuedConnection);
+    }
+    m_mainProbe->start();
+    m_clock.start();
+    m_lastCpuTime = cpuTimeSeconds();
+    m_out << "# latency, link: " << m_options.link.latencyMs << "+/-" << m_options.link.jitterMs << "ms"
+          << " loss: " << m_options.link.lossRate
+          << " fragment: " << m_options.link.maxFragmentLen
+          << " I/O threads: " << m_threads.length() << Qt::endl;
+    m_out << "# time(s) sessions connected units/min failed(units) failed(requests)"
+          << " latency(ms) p50 p90 p99 max cpu(%) cpu/session(%) rss(MiB) rss/session(KiB) lag(ms) main io" << Qt::endl;
+    onRampTimeout();
+    m_rampTimer->start();
+    m_reportTimer->start();
+}
+
+void SoakHarness::stop()
+{
+    m_rampTimer->stop();
+    m_reportTimer->stop();
+    for(auto& session : m_sessions)
+    {
+        session.executor->abort();
+        session.comm->setAutoReconnect(false);
+        QMetaObject::invokeMethod(session.comm, "close", Qt::QueuedConnection);
+        session.comm->deleteLater();
+    }
+    m_sessions.clear();
+    // the pending deleteLater() calls are processed before the threads finish
+    for(auto thread : qAsConst(m_threads))
+    {
+        thread->quit();
+        thread->wait();
+    }
+}
+
+void SoakHarness::onRampTimeout()
+{
+    if(m_sessions.length() < m_options.sessions)
+    {
+        addSessions(qMin(m_options.rampStep, m_options.sessions - m_sessions.length()));
+        if(m_sessions.length() == m_options.sessions)
+            m_fullTime = m_clock.elapsed();
+        return;
+    }
+    const qint64 holdMs = m_options.durationMs > 0 ? m_options.durationMs - m_fullTime : m_options.rampIntervalMs;
+    if(m_clock.elapsed() - m_fullTime >= holdMs)
+    {
+        report();
+        m_out << "# total units: " << m_totalUnitCount << Qt::endl;
+        stop();
+        emit finished();
+    }
+}
+
+void SoakHarness::addSessions(int count)
+{
+    for(int i = 0; i < count; i++)
+    {
+        const int index = m_sessions.length();
+        Session session;
+        session.comm = new CommSim(m_options.link, index);
+        const QBluetoothAddress address(QString(session.comm->headset().macAddress().toHex(':')));
+        session.address = address.toString();
+
+        // the counters are updated in the I/O threads, without going through the main event loop
+        connect(session.comm, &Comm::requestCompleted, session.comm, [ = ](const QByteArray&, int latencyMs)
+        {
+            QMutexLocker locker(&m_latencyLock);
+            m_latencies.append(latencyMs);
+        }, Qt::DirectConnection);
+        connect(session.comm, &Comm::requestFailed, session.comm, [ = ]
+        {
+            m_failedRequestCount.ref();
+        }, Qt::DirectConnection);
+        connect(session.comm, &Comm::stateChanged, session.comm, [ = ](bool connected)
+        {
+            if(connected)
+                m_connectedCount.ref();
+            else
+                m_connectedCount.deref();
+        }, Qt::DirectConnection);
+
+        session.executor = new ScriptExecutor(m_script, {{session.address, session.comm}}, this);
+        ScriptExecutor* executor = session.executor;
+        connect(session.comm, &Comm::stateChanged, executor, [ = ](bool connected)
+        {
+            if(connected && !executor->isRunning())
+                executor->start();
+        });
+        connect(executor, &ScriptExecutor::finished, this, [ = ](bool success, const QString& message)
+        {
+            if(!m_reportTimer->isActive())
+                return; // stopped
+            if(success)
+            {
+                m_unitCount++;
+                m_totalUnitCount++;
+                // start() must not be called inside finished()
+                QMetaObject::invokeMethod(executor, "start", Qt::QueuedConnection);
+            }
+            else
+            {
+                m_failedUnitCount++;
+                qWarning().noquote() << message;
+                QTimer::singleShot(Comm::requestTimeoutMs, executor, &ScriptExecutor::start);
+            }
+        });
+
+        session.comm->setAutoReconnect(true);
+        session.comm->moveToThread(m_threads[index % m_threads.length()]);
+        QMetaObject::invokeMethod(session.comm, "open", Qt::QueuedConnection,
+                                  Q_ARG(QBluetoothDeviceInfo, QBluetoothDeviceInfo(address, session.comm->headset().name(), 0)));
+        m_sessions.append(session);
+    }
+}
+
+void SoakHarness::report()
+{
+    const qint64 now = m_clock.elapsed();
+    const qint64 window = qMax<qint64>(now - m_lastReportTime, 1);
+    m_lastReportTime = now;
+
+    QVector<int> latencies;
+    {
+        QMutexLocker locker(&m_latencyLock);
+        latencies.swap(m_latencies);
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    const double cpuTime = cpuTimeSeconds();
+    const double cpuPercent = cpuTime < 0 ? -1 : (cpuTime - m_lastCpuTime) * 100000 / window;
+    m_lastCpuTime = cpuTime;
+    const qint64 rss = residentBytes();
+    int ioLag = 0;
+    for(auto probe : qAsConst(m_ioProbes))
+        ioLag = qMax(ioLag, probe->takeMaxLagMs());
+
+    m_out << QString::number(now / 1000.0, 'f', 1)
+          << ' ' << m_sessions.length()
+          << ' ' << m_connectedCount.loadRelaxed()
+          << ' ' << QString::number(m_unitCount * 60000.0 / window, 'f', 0)
+          << ' ' << m_failedUnitCount
+          << ' ' << m_failedRequestCount.fetchAndStoreRelaxed(0)
+          << ' ' << percentile(latencies, 0.5)
+          << ' ' << percentile(latencies, 0.9)
+          << ' ' << percentile(latencies, 0.99)
+          << ' ' << (latencies.isEmpty() ? 0 : latencies.last())
+          << ' ' << QString::number(cpuPercent, 'f', 1)
+          << ' ' << (cpuPercent < 0 || m_sessions.isEmpty() ? QString("-") : QString::number(cpuPercent / m_sessions.length(), 'f', 3))
+          << ' ' << (rss < 0 ? QString("-") : QString::number(rss / 1048576.0, 'f', 1))
+          << ' ' << (rss < 0 || m_sessions.isEmpty() ? QString("-") : QString::number(rss / 1024.0 / m_sessions.length(), 'f', 1))
+          << ' ' << m_mainProbe->takeMaxLagMs()
+          << ' ' << ioLag << Qt::endl;
+    m_unitCount = 0;
+    m_failedUnitCount = 0;
+}
+
+int SoakHarness::percentile(const QVector<int>& sorted, double p)
+{
+    if(sorted.isEmpty())
+        return 0;
+    return sorted[qMin<int>(sorted.length() * p, sorted.length() - 1)];
+}
+
+double SoakHarness::cpuTimeSeconds()
+{
+#ifdef Q_OS_UNIX
+    rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#else
+    return -1;
+#endif
+}
+
+qint64 SoakHarness::residentBytes()
+{
+#ifdef Q_OS_LINUX
+    // /proc/self/statm: size resident shared ..., in pages
+    QFile file("/proc/self/statm");
+    if(!file.open(QIODevice::ReadOnly))
+        return -1;
+    const QList<QByteArray> fields = file.readAll().split(' ');
+    if(fields.length() < 2)
+        return -1;
+    return fields[1].toLongLong() * sysconf(_SC_PAGESIZE);
+#else
+    return -1;
+#endif
+}
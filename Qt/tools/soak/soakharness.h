@@ -0,0 +1,108 @@
+#ifndef SOAKHARNESS_H
+#define SOAKHARNESS_H
+
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QVector>
+#include <QTextStream>
+
+#include "commsim.h"
+#include "scripting/provisionscript.h"
+
+class ScriptExecutor;
+
+// Measures the event loop lag of the thread it lives in
+class LagProbe : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LagProbe(QObject *parent = nullptr);
+    // the largest lag since the last call
+    int takeMaxLagMs();
+
+    static const int intervalMs = 50;
+public slots:
+    void start();
+private:
+    QTimer* m_timer = nullptr;
+    QElapsedTimer m_clock;
+    qint64 m_lastTick = 0;
+    QAtomicInt m_maxLagMs;
+private slots:
+    void onTimeout();
+};
+
+// Ramps up simulated sessions and runs a provisioning script on each of them in a loop.
+// A report line is printed every reportIntervalMs.
+class SoakHarness : public QObject
+{
+    Q_OBJECT
+public:
+    struct Options
+    {
+        int sessions = 1000;
+        int rampStep = 100;
+        int rampIntervalMs = 10000;
+        int ioThreads = 1;
+        int reportIntervalMs = 5000;
+        // 0: stop one ramp interval after all sessions are started
+        int durationMs = 0;
+        CommSim::Config link;
+    };
+
+    explicit SoakHarness(const Options& options, const ProvisionScript& script, QObject *parent = nullptr);
+    ~SoakHarness();
+
+    // the script used if no file is given, one "unit" is one run of it
+    static const char* builtinScript;
+public slots:
+    void start();
+    void stop();
+private:
+    struct Session
+    {
+        CommSim* comm = nullptr;
+        ScriptExecutor* executor = nullptr;
+        QString address;
+    };
+
+    Options m_options;
+    ProvisionScript m_script;
+    QList<QThread*> m_threads;
+    QList<LagProbe*> m_ioProbes;
+    LagProbe* m_mainProbe = nullptr;
+    QList<Session> m_sessions;
+    QTimer* m_rampTimer = nullptr;
+    QTimer* m_reportTimer = nullptr;
+    QElapsedTimer m_clock;
+    qint64 m_fullTime = -1;
+    QTextStream m_out;
+
+    // updated in the I/O threads
+    QMutex m_latencyLock;
+    QVector<int> m_latencies;
+    QAtomicInt m_connectedCount;
+    QAtomicInt m_failedRequestCount;
+    // updated in the main thread
+    int m_unitCount = 0;
+    int m_failedUnitCount = 0;
+    qint64 m_totalUnitCount = 0;
+    qint64 m_lastReportTime = 0;
+    double m_lastCpuTime = 0;
+
+    void addSessions(int count);
+    void report();
+    static double cpuTimeSeconds();
+    static qint64 residentBytes();
+    static int percentile(const QVector<int>& sorted, double p);
+private slots:
+    void onRampTimeout();
+signals:
+    void finished();
+};
+
+#endif // SOAKHARNESS_H